@@ -0,0 +1,173 @@
+/*
+ * Compares the checksum implementations with each other and with the
+ * original scalar routine across a range of payload sizes.
+ *
+ * Usage: checksum_bench [min_time_ms]
+ *
+ * Build with optimizations (-DCMAKE_BUILD_TYPE=Release) to get meaningful
+ * numbers.
+ *
+ * Prints one line per size and implementation:
+ *
+ *   size,impl,ns_per_call,gbytes_per_sec
+ */
+
+#include "platform.h"
+#include "checksum.h"
+
+#define MAX_SIZE 65536
+
+/*
+ * The routine that cping used before, kept for comparison. It only handles
+ * even sizes correctly.
+ */
+static uint16_t reference_checksum(const char *buf, size_t size)
+{
+    /* RFC 1071 - http://tools.ietf.org/html/rfc1071 */
+
+    size_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < size; i += 2) {
+        sum += *(uint16_t *)buf;
+        buf += 2;
+    }
+    if (size - i > 0)
+        sum += *(uint8_t *)buf;
+
+    while ((sum >> 16) != 0)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+static uint32_t reference_add(uint32_t sum, const void *buf, size_t len)
+{
+    return (uint16_t)~reference_checksum(buf, len) + sum;
+}
+
+/*
+ * Checks all implementations against each other on buffers of every length
+ * up to a few hundred bytes, at odd and even offsets, and in two pieces.
+ */
+static int verify(const struct checksum_impl *impls,
+                  size_t num_impls,
+                  const uint8_t *data)
+{
+    size_t len;
+    size_t offset;
+    size_t i;
+
+    for (len = 0; len < 600; len++) {
+        for (offset = 0; offset < 4; offset++) {
+            uint16_t expected = checksum_finish(
+                impls[0].add(0, data + offset, len));
+
+            if (len % 2 == 0 && offset % 2 == 0
+                && reference_checksum((const char *)data + offset, len)
+                   != expected) {
+                fprintf(stderr, "reference mismatch: len=%lu\n",
+                        (unsigned long)len);
+                return -1;
+            }
+            for (i = 0; i < num_impls; i++) {
+                size_t split = (len / 2) & ~(size_t)1;
+                uint16_t whole = checksum_finish(
+                    impls[i].add(0, data + offset, len));
+                uint16_t pieces = checksum_finish(
+                    impls[i].add(impls[i].add(0, data + offset, split),
+                                 data + offset + split,
+                                 len - split));
+                if (whole != expected || pieces != expected) {
+                    fprintf(stderr, "%s mismatch: len=%lu offset=%lu\n",
+                            impls[i].name,
+                            (unsigned long)len,
+                            (unsigned long)offset);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Runs the implementation on the buffer until min_time has passed and
+ * returns the average time per call in nanoseconds.
+ */
+static double measure(checksum_add_func add,
+                      const uint8_t *data,
+                      size_t size,
+                      uint64_t min_time,
+                      volatile uint32_t *sink)
+{
+    unsigned long iterations = 1;
+
+    for (;;) {
+        uint64_t start = ntime();
+        uint64_t elapsed;
+        unsigned long i;
+        uint32_t sum = 0;
+
+        for (i = 0; i < iterations; i++) {
+            sum += add(0, data, size);
+        }
+        elapsed = ntime() - start;
+        *sink = sum;
+
+        if (elapsed >= min_time) {
+            return (double)elapsed / iterations;
+        }
+        iterations *= 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = {
+        8, 40, 64, 128, 256, 512, 1024, 1480, 4096, 9000, 16384, 65506
+    };
+    const struct checksum_impl *impls;
+    size_t num_impls;
+    uint64_t min_time = 100000000;
+    volatile uint32_t sink;
+    uint8_t *data;
+    size_t i;
+    size_t j;
+
+    if (argc > 1) {
+        min_time = (uint64_t)atol(argv[1]) * 1000000;
+    }
+
+    data = malloc(MAX_SIZE + 4);
+    if (data == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    srand(1);
+    for (i = 0; i < MAX_SIZE + 4; i++) {
+        data[i] = (uint8_t)rand();
+    }
+
+    impls = checksum_impls(&num_impls);
+    if (verify(impls, num_impls, data) != 0) {
+        free(data);
+        return EXIT_FAILURE;
+    }
+
+    printf("size,impl,ns_per_call,gbytes_per_sec\n");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double ns = measure(reference_add, data, sizes[i], min_time, &sink);
+        printf("%lu,reference,%.1f,%.2f\n",
+               (unsigned long)sizes[i], ns, sizes[i] / ns);
+        for (j = 0; j < num_impls; j++) {
+            ns = measure(impls[j].add, data, sizes[i], min_time, &sink);
+            printf("%lu,%s,%.1f,%.2f\n",
+                   (unsigned long)sizes[i], impls[j].name, ns, sizes[i] / ns);
+        }
+        fflush(stdout);
+    }
+
+    free(data);
+    return EXIT_SUCCESS;
+}
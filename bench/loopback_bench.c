@@ -0,0 +1,468 @@
+/*
+ * Measures cping's own overhead against echo responders on this host: the
+ * kernel answering on the loopback interface and, when run as root, a
+ * network namespace behind a veth pair, which adds a real (if short) trip
+ * through the network stack.
+ *
+ * Usage: loopback_bench path/to/cping [seconds_per_run] [-- cping options]
+ *
+ * Options after "--" are passed on to every cping run, e.g. "--io uring"
+ * to compare backends. Build with optimizations for meaningful numbers.
+ *
+ * For each environment, the request rate is doubled until cping can't keep
+ * up (it falls behind by more than 10% or loses more than 0.1% of the
+ * replies) and then narrowed down. Prints one line per environment:
+ *
+ *   env,targets,max_pps,loss,cpu_ns_per_probe,syscalls_per_probe,
+ *   added_latency_avg_us,added_latency_max_us
+ *
+ * CPU time and system calls per probe are measured at the highest rate
+ * that was sustained. The system calls are counted by the kernel through
+ * the raw_syscalls:sys_enter tracepoint, which needs tracefs to be mounted
+ * and enough privileges; the column is left empty otherwise. The added
+ * latency is how much longer the round trip looks from cping's user space
+ * than by the kernel's timestamps, measured at MIN_RATE so that it isn't
+ * inflated by queuing.
+ */
+
+#include "platform.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define NUM_TARGETS 100
+#define MIN_RATE 1000
+#define MAX_RATE (1L << 22)
+#define BISECT_STEPS 3
+#define MAX_LOSS 0.001
+#define MIN_ACHIEVED 0.9
+#define MAX_ARGS 64
+#define LINE_SIZE 4096
+
+#define NETNS "cping-bench"
+#define VETH_HOST "cpb0"
+#define VETH_NETNS "cpb1"
+#define VETH_HOST_ADDR "10.201.0.1"
+#define VETH_NETNS_ADDR "10.201.0.2"
+
+struct run_result {
+    unsigned long sent;
+    unsigned long received;
+    uint64_t elapsed;        /* wall clock, ns */
+    uint64_t cpu_time;       /* user and system, ns */
+    long long syscalls;      /* -1 if they couldn't be counted */
+    double added_avg_us;
+    double added_max_us;
+};
+
+static const char *tracepoint_paths[] = {
+    "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+    "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+};
+
+/*
+ * Opens a counter of the system calls made by the process and the threads
+ * it starts, enabled when it calls exec(). Returns -1 if not possible.
+ */
+static int open_syscall_counter(pid_t pid)
+{
+    struct perf_event_attr attr;
+    unsigned long id = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(tracepoint_paths) / sizeof(*tracepoint_paths);
+         i++) {
+        FILE *file = fopen(tracepoint_paths[i], "r");
+        if (file != NULL) {
+            int found = fscanf(file, "%lu", &id) == 1;
+            fclose(file);
+            if (found) {
+                break;
+            }
+        }
+    }
+    if (id == 0) {
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+/*
+ * Finds "key": in a JSON line and parses the number after it.
+ */
+static int json_number(const char *line, const char *key, double *value)
+{
+    char pattern[64];
+    const char *p;
+
+    sprintf(pattern, "\"%s\":", key);
+    p = strstr(line, pattern);
+    if (p == NULL) {
+        return -1;
+    }
+    *value = strtod(p + strlen(pattern), NULL);
+    return 0;
+}
+
+static void parse_line(const char *line, struct run_result *result)
+{
+    double value;
+
+    if (strstr(line, "\"type\":\"total\"") != NULL) {
+        if (json_number(line, "sent", &value) == 0) {
+            result->sent = (unsigned long)value;
+        }
+        if (json_number(line, "received", &value) == 0) {
+            result->received = (unsigned long)value;
+        }
+    } else if (strstr(line, "\"type\":\"run\"") != NULL) {
+        json_number(line, "added_latency_avg_us", &result->added_avg_us);
+        json_number(line, "added_latency_max_us", &result->added_max_us);
+    }
+}
+
+/*
+ * Runs cping with the given arguments and collects what it reported and
+ * what it cost. Returns -1 if it couldn't be run or failed.
+ */
+static int run_cping(char **args, struct run_result *result)
+{
+    int output[2];
+    int go[2];
+    int counter;
+    pid_t pid;
+    FILE *file;
+    char line[LINE_SIZE];
+    struct rusage usage;
+    int status;
+    uint64_t start;
+
+    memset(result, 0, sizeof(*result));
+    result->syscalls = -1;
+
+    if (pipe(output) != 0 || pipe(go) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        char c;
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(output[1], STDOUT_FILENO);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDERR_FILENO);
+        }
+        close(output[0]);
+        close(output[1]);
+        close(go[1]);
+        /* wait until the counter is attached */
+        if (read(go[0], &c, 1) < 0) {
+            _exit(127);
+        }
+        execv(args[0], args);
+        _exit(127);
+    }
+
+    close(output[1]);
+    close(go[0]);
+    counter = open_syscall_counter(pid);
+    start = ntime();
+    if (write(go[1], "x", 1) != 1) {
+        perror("write");
+    }
+    close(go[1]);
+
+    file = fdopen(output[0], "r");
+    if (file == NULL) {
+        perror("fdopen");
+        close(output[0]);
+    } else {
+        while (fgets(line, sizeof(line), file) != NULL) {
+            parse_line(line, result);
+        }
+        fclose(file);
+    }
+
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    result->elapsed = ntime() - start;
+    result->cpu_time =
+        ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+            * 1000000000
+        + ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)
+            * 1000;
+
+    if (counter >= 0) {
+        uint64_t count;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+            result->syscalls = (long long)count;
+        }
+        close(counter);
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s exited with status %d\n", args[0], status);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Pings every target in the file at the given total rate for the given
+ * time.
+ */
+static int run_rate(const char *cping,
+                    const char *targets_file,
+                    long rate,
+                    int seconds,
+                    char **extra_args,
+                    int num_extra_args,
+                    struct run_result *result)
+{
+    char *args[MAX_ARGS];
+    char rate_str[32];
+    char count_str[32];
+    long count = rate * seconds / NUM_TARGETS;
+    int n = 0;
+    int i;
+
+    if (count < 1) {
+        count = 1;
+    }
+    sprintf(rate_str, "%ld", rate);
+    sprintf(count_str, "%ld", count);
+
+    args[n++] = (char *)cping;
+    args[n++] = "-q";
+    args[n++] = "-o";
+    args[n++] = "json";
+    args[n++] = "--flush";
+    args[n++] = "full";
+    args[n++] = "-R";
+    args[n++] = rate_str;
+    args[n++] = "-n";
+    args[n++] = count_str;
+    args[n++] = "-f";
+    args[n++] = (char *)targets_file;
+    for (i = 0; i < num_extra_args && n < MAX_ARGS - 1; i++) {
+        args[n++] = extra_args[i];
+    }
+    args[n] = NULL;
+
+    return run_cping(args, result);
+}
+
+/*
+ * Whether cping kept up with the rate.
+ */
+static int sustained(const struct run_result *result, long rate)
+{
+    double achieved;
+
+    if (result->sent == 0) {
+        return 0;
+    }
+    achieved = (double)result->sent * 1000000000.0 / result->elapsed;
+    return achieved >= rate * MIN_ACHIEVED
+        && (double)(result->sent - result->received) / result->sent
+           <= MAX_LOSS;
+}
+
+static void bench_env(const char *env,
+                      const char *cping,
+                      const char *targets_file,
+                      int seconds,
+                      char **extra_args,
+                      int num_extra_args)
+{
+    struct run_result best;
+    struct run_result result;
+    struct run_result baseline;
+    long good = 0;
+    long bad = 0;
+    long rate;
+    int i;
+
+    memset(&best, 0, sizeof(best));
+
+    for (rate = MIN_RATE; rate <= MAX_RATE; rate *= 2) {
+        if (run_rate(cping, targets_file, rate, seconds, extra_args,
+                     num_extra_args, &result) != 0) {
+            return;
+        }
+        fprintf(stderr, "%s: %ld/s %s\n", env, rate,
+                sustained(&result, rate) ? "ok" : "too fast");
+        if (!sustained(&result, rate)) {
+            bad = rate;
+            break;
+        }
+        good = rate;
+        best = result;
+    }
+    for (i = 0; i < BISECT_STEPS && good > 0 && bad > 0; i++) {
+        rate = good + (bad - good) / 2;
+        if (run_rate(cping, targets_file, rate, seconds, extra_args,
+                     num_extra_args, &result) != 0) {
+            return;
+        }
+        fprintf(stderr, "%s: %ld/s %s\n", env, rate,
+                sustained(&result, rate) ? "ok" : "too fast");
+        if (sustained(&result, rate)) {
+            good = rate;
+            best = result;
+        } else {
+            bad = rate;
+        }
+    }
+
+    if (run_rate(cping, targets_file, MIN_RATE, seconds, extra_args,
+                 num_extra_args, &baseline) != 0) {
+        return;
+    }
+
+    printf("%s,%d,%ld,", env, NUM_TARGETS, good);
+    if (good > 0) {
+        printf("%.5f,%.1f,",
+               (double)(best.sent - best.received) / best.sent,
+               (double)best.cpu_time / best.sent);
+        if (best.syscalls >= 0) {
+            printf("%.2f", (double)best.syscalls / best.sent);
+        }
+    } else {
+        printf(",,");
+    }
+    printf(",%.3f,%.3f\n", baseline.added_avg_us, baseline.added_max_us);
+    fflush(stdout);
+}
+
+static int write_targets(const char *path, int loopback)
+{
+    FILE *file = fopen(path, "w");
+    int i;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    for (i = 0; i < NUM_TARGETS; i++) {
+        if (loopback) {
+            fprintf(file, "127.0.%d.%d\n", i / 250, i % 250 + 1);
+        } else {
+            fprintf(file, "%s\n", VETH_NETNS_ADDR);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static int shell(const char *command)
+{
+    int status = system(command);
+    return status == 0 ? 0 : -1;
+}
+
+static void teardown_veth(void)
+{
+    shell("ip netns del " NETNS " 2>/dev/null");
+}
+
+/*
+ * Puts the other end of a veth pair into its own network namespace, where
+ * the kernel answers echo requests.
+ */
+static int setup_veth(void)
+{
+    teardown_veth();
+    if (shell("ip netns add " NETNS) != 0
+        || shell("ip link add " VETH_HOST " type veth peer name "
+                 VETH_NETNS) != 0
+        || shell("ip link set " VETH_NETNS " netns " NETNS) != 0
+        || shell("ip addr add " VETH_HOST_ADDR "/24 dev " VETH_HOST) != 0
+        || shell("ip link set " VETH_HOST " up") != 0
+        || shell("ip -n " NETNS " addr add " VETH_NETNS_ADDR "/24 dev "
+                 VETH_NETNS) != 0
+        || shell("ip -n " NETNS " link set " VETH_NETNS " up") != 0
+        || shell("ip -n " NETNS " link set lo up") != 0) {
+        teardown_veth();
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char targets_file[] = "/tmp/cping-bench-XXXXXX";
+    char **extra_args = NULL;
+    int num_extra_args = 0;
+    int seconds = 2;
+    int fd;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr,
+                "Usage: %s path/to/cping [seconds_per_run] "
+                "[-- cping options]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra_args = &argv[i + 1];
+            num_extra_args = argc - i - 1;
+            break;
+        }
+        seconds = atoi(argv[i]);
+        if (seconds <= 0) {
+            fprintf(stderr, "Invalid duration: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    fd = mkstemp(targets_file);
+    if (fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("env,targets,max_pps,loss,cpu_ns_per_probe,syscalls_per_probe,"
+           "added_latency_avg_us,added_latency_max_us\n");
+    fflush(stdout);
+
+    if (write_targets(targets_file, 1) == 0) {
+        bench_env("loopback", argv[1], targets_file, seconds, extra_args,
+                  num_extra_args);
+    }
+
+    if (geteuid() != 0) {
+        fprintf(stderr, "Not root, skipping the veth benchmark\n");
+    } else if (setup_veth() != 0) {
+        fprintf(stderr, "Could not set up the veth pair, skipping it\n");
+    } else {
+        if (write_targets(targets_file, 0) == 0) {
+            bench_env("veth", argv[1], targets_file, seconds, extra_args,
+                      num_extra_args);
+        }
+        teardown_veth();
+    }
+
+    remove(targets_file);
+    return EXIT_SUCCESS;
+}
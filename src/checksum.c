@@ -0,0 +1,238 @@
+#include "checksum.h"
+
+#if (defined __GNUC__ || defined __clang__) \
+    && (defined __x86_64__ || defined __i386__)
+    #define HAVE_X86_SIMD
+    #include <immintrin.h>
+#endif
+
+/*
+ * Folds a 64-bit sum of 16-bit words into 16 bits.
+ */
+static uint32_t fold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint32_t)sum;
+}
+
+/*
+ * Sums 64 bits at a time with end-around carry: the ones' complement sum of
+ * 64-bit words folds down to that of 16-bit words (RFC 1071, section 2).
+ */
+static uint32_t checksum_add_scalar(uint32_t sum, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t acc = sum;
+    uint64_t word;
+
+    while (len >= 32) {
+        uint64_t words[4];
+        memcpy(words, p, sizeof(words));
+        acc += words[0];
+        acc += acc < words[0];
+        acc += words[1];
+        acc += acc < words[1];
+        acc += words[2];
+        acc += acc < words[2];
+        acc += words[3];
+        acc += acc < words[3];
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        memcpy(&word, p, 8);
+        acc += word;
+        acc += acc < word;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        uint32_t word32;
+        memcpy(&word32, p, 4);
+        acc += word32;
+        acc += acc < word32;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t word16;
+        memcpy(&word16, p, 2);
+        acc += word16;
+        acc += acc < word16;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        /* Pad the last byte with zero, whatever the byte order. */
+        uint16_t word16 = 0;
+        memcpy(&word16, p, 1);
+        acc += word16;
+        acc += acc < word16;
+    }
+
+    return fold64(acc);
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * The vector versions widen 16-bit words to 32-bit lanes and add them up.
+ * A lane can take 65536 words before it may overflow, so the lanes are
+ * flushed into a 64-bit sum every SIMD_BLOCK iterations.
+ */
+#define SIMD_BLOCK 32768
+
+__attribute__((target("sse2")))
+static uint32_t checksum_add_sse2(uint32_t sum, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t total = sum;
+
+    while (len >= 16) {
+        __m128i acc_lo = _mm_setzero_si128();
+        __m128i acc_hi = _mm_setzero_si128();
+        size_t n = len / 16;
+        uint32_t lanes[8];
+        size_t i;
+
+        if (n > SIMD_BLOCK) {
+            n = SIMD_BLOCK;
+        }
+        for (i = 0; i < n; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            acc_lo = _mm_add_epi32(acc_lo, _mm_unpacklo_epi16(v, zero));
+            acc_hi = _mm_add_epi32(acc_hi, _mm_unpackhi_epi16(v, zero));
+            p += 16;
+        }
+        len -= n * 16;
+
+        _mm_storeu_si128((__m128i *)&lanes[0], acc_lo);
+        _mm_storeu_si128((__m128i *)&lanes[4], acc_hi);
+        for (i = 0; i < 8; i++) {
+            total += lanes[i];
+        }
+    }
+
+    return checksum_add_scalar(fold64(total), p, len);
+}
+
+__attribute__((target("avx2")))
+static uint32_t checksum_add_avx2(uint32_t sum, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t total = sum;
+
+    while (len >= 32) {
+        __m256i acc_lo = _mm256_setzero_si256();
+        __m256i acc_hi = _mm256_setzero_si256();
+        size_t n = len / 32;
+        uint32_t lanes[16];
+        size_t i;
+
+        if (n > SIMD_BLOCK) {
+            n = SIMD_BLOCK;
+        }
+        for (i = 0; i < n; i++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_unpacklo_epi16(v, zero));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_unpackhi_epi16(v, zero));
+            p += 32;
+        }
+        len -= n * 32;
+
+        _mm256_storeu_si256((__m256i *)&lanes[0], acc_lo);
+        _mm256_storeu_si256((__m256i *)&lanes[8], acc_hi);
+        for (i = 0; i < 16; i++) {
+            total += lanes[i];
+        }
+    }
+
+    return checksum_add_sse2(fold64(total), p, len);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static struct checksum_impl impls[3];
+static size_t num_impls;
+static checksum_add_func best_impl;
+
+/*
+ * Picks the implementations supported by the CPU. Running this more than
+ * once (e.g. from several threads at the same time) is harmless.
+ */
+static void init_impls(void)
+{
+    size_t count = 0;
+
+    impls[count].name = "scalar";
+    impls[count].add = checksum_add_scalar;
+    count++;
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        impls[count].name = "sse2";
+        impls[count].add = checksum_add_sse2;
+        count++;
+        if (__builtin_cpu_supports("avx2")) {
+            impls[count].name = "avx2";
+            impls[count].add = checksum_add_avx2;
+            count++;
+        }
+    }
+#endif
+
+    num_impls = count;
+    best_impl = impls[count - 1].add;
+}
+
+const struct checksum_impl *checksum_impls(size_t *count)
+{
+    if (best_impl == NULL) {
+        init_impls();
+    }
+    *count = num_impls;
+    return impls;
+}
+
+uint32_t checksum_add(uint32_t sum, const void *buf, size_t len)
+{
+    /*
+     * The vector versions only pay off on larger buffers (see
+     * bench/checksum_bench.c).
+     */
+    if (len < 256) {
+        return checksum_add_scalar(sum, buf, len);
+    }
+    if (best_impl == NULL) {
+        init_impls();
+    }
+    return best_impl(sum, buf, len);
+}
+
+uint16_t checksum_finish(uint32_t sum)
+{
+    return (uint16_t)~fold64(sum);
+}
+
+uint16_t compute_checksum(const void *buf, size_t len)
+{
+    return checksum_finish(checksum_add(0, buf, len));
+}
+
+uint16_t checksum_update(uint16_t checksum,
+                         uint16_t old_word,
+                         uint16_t new_word)
+{
+    uint32_t sum = (uint16_t)~checksum;
+
+    sum += (uint16_t)~old_word;
+    sum += new_word;
+    return checksum_finish(sum);
+}
@@ -0,0 +1,55 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "platform.h"
+
+/*
+ * The Internet checksum (RFC 1071).
+ *
+ * Partial sums are 16-bit ones' complement sums of the data taken as native
+ * byte order words, so the final checksum can be stored into a packet as is.
+ * Data can be summed in pieces (e.g. the IPv6 pseudo-header and the ICMPv6
+ * message) as long as every piece but the last one has an even length.
+ */
+
+typedef uint32_t (*checksum_add_func)(uint32_t sum,
+                                      const void *buf,
+                                      size_t len);
+
+struct checksum_impl {
+    const char *name;
+    checksum_add_func add;
+};
+
+/**
+ * Adds len bytes of buf to the partial sum and returns the new one. Uses the
+ * fastest implementation supported by the CPU.
+ */
+uint32_t checksum_add(uint32_t sum, const void *buf, size_t len);
+
+/**
+ * Turns a partial sum into a checksum.
+ */
+uint16_t checksum_finish(uint32_t sum);
+
+/**
+ * Computes the checksum of a single buffer.
+ */
+uint16_t compute_checksum(const void *buf, size_t len);
+
+/**
+ * Updates a checksum after one 16-bit word of the data that it covers has
+ * changed from old_word to new_word (RFC 1624, equation 3).
+ */
+uint16_t checksum_update(uint16_t checksum,
+                         uint16_t old_word,
+                         uint16_t new_word);
+
+/**
+ * Returns the implementations that can run on this CPU, from the slowest to
+ * the fastest, and stores their number in count. Only useful for testing
+ * and benchmarking.
+ */
+const struct checksum_impl *checksum_impls(size_t *count);
+
+#endif /* CHECKSUM_H */
@@ -0,0 +1,342 @@
+#include "evloop.h"
+
+#ifdef EVLOOP_EPOLL
+    #include <sys/epoll.h>
+#endif
+#ifdef EVLOOP_TIMERFD
+    #include <sys/timerfd.h>
+#endif
+
+/*
+ * Both epoll and poll() accept timeouts in milliseconds. Round up so that we
+ * never wake up before the deadline and end up spinning on a zero timeout.
+ */
+static int timeout_to_ms(uint64_t deadline)
+{
+    uint64_t now;
+    uint64_t timeout;
+    uint64_t timeout_ms;
+
+    if (deadline == (uint64_t)-1) {
+        return -1;
+    }
+    now = ntime();
+    if (deadline <= now) {
+        return 0;
+    }
+    timeout = deadline - now;
+    if (timeout >= (uint64_t)0x7fffffff * 1000000) {
+        return 0x7fffffff;
+    }
+    timeout_ms = (timeout + 999999) / 1000000;
+    return (int)timeout_ms;
+}
+
+#ifdef EVLOOP_TIMERFD
+
+/*
+ * Arms the timer to go off at the deadline. Returns the timeout to pass to
+ * epoll_wait(), which is infinite unless the timer couldn't be used. When
+ * we are not going to wait, the timer is armed even if the deadline has
+ * passed, so that it goes off right away and makes the epoll fd readable.
+ */
+static int arm_timer(struct evloop *loop, uint64_t deadline, int block)
+{
+    struct itimerspec spec;
+
+    if (loop->timer_fd < 0) {
+        return timeout_to_ms(deadline);
+    }
+    if (deadline == (uint64_t)-1 || (block && deadline <= ntime())) {
+        return timeout_to_ms(deadline);
+    }
+    if (deadline == loop->timer_deadline) {
+        return -1;
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(deadline / 1000000000);
+    spec.it_value.tv_nsec = (long)(deadline % 1000000000);
+    loop->stats.timer_updates++;
+    if (timerfd_settime(loop->timer_fd,
+                        TFD_TIMER_ABSTIME,
+                        &spec,
+                        NULL) != 0) {
+        return timeout_to_ms(deadline);
+    }
+    loop->timer_deadline = deadline;
+    return -1;
+}
+
+#endif /* EVLOOP_TIMERFD */
+
+#ifdef EVLOOP_WAKEUP
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0
+        || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0
+        || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0
+        ? -1
+        : 0;
+}
+
+static void open_wake_pipe(struct evloop *loop)
+{
+    if (pipe(loop->wake_fds) != 0) {
+        loop->wake_fds[0] = -1;
+        loop->wake_fds[1] = -1;
+        return;
+    }
+    if (set_nonblocking(loop->wake_fds[0]) != 0
+        || set_nonblocking(loop->wake_fds[1]) != 0
+        || evloop_add(loop, loop->wake_fds[0], loop->wake_fds) != 0) {
+        close(loop->wake_fds[0]);
+        close(loop->wake_fds[1]);
+        loop->wake_fds[0] = -1;
+        loop->wake_fds[1] = -1;
+    }
+}
+
+static void drain_wake_pipe(struct evloop *loop)
+{
+    char buf[64];
+    while (read(loop->wake_fds[0], buf, sizeof(buf)) > 0) {
+        continue;
+    }
+}
+
+#endif /* EVLOOP_WAKEUP */
+
+int evloop_init(struct evloop *loop)
+{
+    memset(loop, 0, sizeof(*loop));
+#ifdef EVLOOP_WAKEUP
+    loop->wake_fds[0] = -1;
+    loop->wake_fds[1] = -1;
+#endif
+#ifdef EVLOOP_EPOLL
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        return -1;
+    }
+#endif
+#ifdef EVLOOP_TIMERFD
+    /*
+     * ntime() is based on CLOCK_MONOTONIC, so the timer must be too. If
+     * there is no timerfd, we just use the less precise epoll timeout.
+     */
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timer_fd >= 0) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &loop->timer_fd;
+        if (epoll_ctl(loop->epoll_fd,
+                      EPOLL_CTL_ADD,
+                      loop->timer_fd,
+                      &event) != 0) {
+            close(loop->timer_fd);
+            loop->timer_fd = -1;
+        }
+    }
+#endif
+#ifdef EVLOOP_WAKEUP
+    /*
+     * Without it, a wait would only end at its deadline.
+     */
+    open_wake_pipe(loop);
+#endif
+    return 0;
+}
+
+int evloop_add(struct evloop *loop, socket_t sockfd, void *data)
+{
+#ifdef EVLOOP_EPOLL
+    struct epoll_event event;
+#endif
+
+    if (loop->count >= EVLOOP_MAX_SOCKETS) {
+#ifdef _WIN32
+        WSASetLastError(WSAEMFILE);
+#else
+        errno = EMFILE;
+#endif
+        return -1;
+    }
+
+#ifdef EVLOOP_EPOLL
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = data;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, sockfd, &event) != 0) {
+        return -1;
+    }
+#endif
+
+    loop->fds[loop->count].fd = sockfd;
+    loop->fds[loop->count].events = POLLIN;
+    loop->data[loop->count] = data;
+    loop->count++;
+
+    return 0;
+}
+
+static int wait_events(struct evloop *loop,
+                       uint64_t deadline,
+                       int block,
+                       void **ready,
+                       int max_ready)
+{
+    int i;
+    int count;
+
+#ifdef EVLOOP_EPOLL
+    struct epoll_event events[EVLOOP_MAX_SOCKETS + 1];
+    int timeout;
+    int num_ready = 0;
+
+#ifdef EVLOOP_TIMERFD
+    timeout = arm_timer(loop, deadline, block);
+#else
+    timeout = timeout_to_ms(deadline);
+#endif
+    if (!block) {
+        timeout = 0;
+    }
+    loop->stats.waits++;
+    count = epoll_wait(loop->epoll_fd,
+                       events,
+                       EVLOOP_MAX_SOCKETS + 1,
+                       timeout);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (i = 0; i < count; i++) {
+#ifdef EVLOOP_TIMERFD
+        if (events[i].data.ptr == &loop->timer_fd) {
+            uint64_t expirations;
+            ssize_t n = read(loop->timer_fd,
+                             &expirations,
+                             sizeof(expirations));
+            (void)n; /* may fail if the timer was re-armed meanwhile */
+            loop->timer_deadline = 0;
+            continue;
+        }
+#endif
+#ifdef EVLOOP_WAKEUP
+        if (events[i].data.ptr == loop->wake_fds) {
+            drain_wake_pipe(loop);
+            continue;
+        }
+#endif
+        if (num_ready < max_ready) {
+            ready[num_ready] = events[i].data.ptr;
+        }
+        num_ready++;
+    }
+    return num_ready < max_ready ? num_ready : max_ready;
+#else /* EVLOOP_EPOLL */
+    int num_ready = 0;
+
+    loop->stats.waits++;
+#ifdef _WIN32
+    count = WSAPoll(loop->fds,
+                    (ULONG)loop->count,
+                    block ? timeout_to_ms(deadline) : 0);
+    if (count == SOCKET_ERROR) {
+        return -1;
+    }
+#else
+    count = poll(loop->fds,
+                 (nfds_t)loop->count,
+                 block ? timeout_to_ms(deadline) : 0);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+#endif
+    for (i = 0; i < loop->count && count > 0; i++) {
+        if (loop->fds[i].revents == 0) {
+            continue;
+        }
+        count--;
+#ifdef EVLOOP_WAKEUP
+        if (loop->data[i] == loop->wake_fds) {
+            drain_wake_pipe(loop);
+            continue;
+        }
+#endif
+        if (num_ready < max_ready) {
+            ready[num_ready] = loop->data[i];
+        }
+        num_ready++;
+    }
+    return num_ready;
+#endif /* !EVLOOP_EPOLL */
+}
+
+int evloop_wait(struct evloop *loop,
+                uint64_t deadline,
+                void **ready,
+                int max_ready)
+{
+    return wait_events(loop, deadline, 1, ready, max_ready);
+}
+
+int evloop_poll(struct evloop *loop,
+                uint64_t deadline,
+                void **ready,
+                int max_ready)
+{
+    return wait_events(loop, deadline, 0, ready, max_ready);
+}
+
+int evloop_fd(const struct evloop *loop)
+{
+#ifdef EVLOOP_EPOLL
+    return loop->epoll_fd;
+#else
+    (void)loop;
+    return -1;
+#endif
+}
+
+void evloop_wake(struct evloop *loop)
+{
+#ifdef EVLOOP_WAKEUP
+    if (loop->wake_fds[1] >= 0) {
+        char c = 0;
+        ssize_t n = write(loop->wake_fds[1], &c, 1);
+        (void)n; /* the pipe is full, so a wakeup is pending anyway */
+    }
+#else
+    (void)loop;
+#endif
+}
+
+void evloop_destroy(struct evloop *loop)
+{
+#ifdef EVLOOP_TIMERFD
+    if (loop->timer_fd >= 0) {
+        close(loop->timer_fd);
+        loop->timer_fd = -1;
+    }
+#endif
+#ifdef EVLOOP_WAKEUP
+    if (loop->wake_fds[0] >= 0) {
+        close(loop->wake_fds[0]);
+        close(loop->wake_fds[1]);
+        loop->wake_fds[0] = -1;
+        loop->wake_fds[1] = -1;
+    }
+#endif
+#ifdef EVLOOP_EPOLL
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+#endif
+    loop->count = 0;
+}
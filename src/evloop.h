@@ -0,0 +1,112 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include "platform.h"
+
+#if defined __linux__
+    #define EVLOOP_EPOLL
+#endif
+
+#ifdef EVLOOP_EPOLL
+    #define EVLOOP_TIMERFD /* precise wakeups with a timerfd */
+#endif
+
+#ifdef _WIN32
+    typedef WSAPOLLFD evloop_pollfd_t;
+#else
+    #include <poll.h>
+    typedef struct pollfd evloop_pollfd_t;
+#endif
+
+#ifndef _WIN32
+    #define EVLOOP_WAKEUP /* evloop_wake() through a self-pipe */
+#endif
+
+#define EVLOOP_MAX_SOCKETS 16
+
+struct evloop_stats {
+    unsigned long waits;     /* epoll_wait() or poll() calls */
+    unsigned long timer_updates; /* timerfd_settime() calls */
+};
+
+/*
+ * A minimal readiness-based event loop: a set of sockets that the caller
+ * can sleep on until one of them becomes readable or a deadline passes.
+ *
+ * epoll is used on Linux, poll() (WSAPoll() on Windows) everywhere else.
+ * Their timeouts have millisecond resolution, so on Linux deadlines are
+ * handled by an absolute timerfd instead, which is accurate to within
+ * a few microseconds.
+ */
+struct evloop {
+#ifdef EVLOOP_EPOLL
+    int epoll_fd;
+#endif
+#ifdef EVLOOP_TIMERFD
+    int timer_fd;
+    uint64_t timer_deadline; /* what the timer is armed for, 0 if not */
+#endif
+#ifdef EVLOOP_WAKEUP
+    int wake_fds[2];
+#endif
+    evloop_pollfd_t fds[EVLOOP_MAX_SOCKETS];
+    void *data[EVLOOP_MAX_SOCKETS];
+    int count;
+    struct evloop_stats stats;
+};
+
+/**
+ * Initializes an empty event loop. Returns 0 on success or -1 on error.
+ */
+int evloop_init(struct evloop *loop);
+
+/**
+ * Starts watching the socket for readability. The data pointer is returned
+ * by evloop_wait() when the socket becomes ready.
+ */
+int evloop_add(struct evloop *loop, socket_t sockfd, void *data);
+
+/**
+ * Waits until at least one socket is readable or ntime() reaches the
+ * deadline ((uint64_t)-1 means no deadline). Stores the data pointers of up
+ * to max_ready ready sockets in ready and returns their number: 0 means that
+ * the deadline has passed or the wait was interrupted by a signal. Returns
+ * -1 on error.
+ */
+int evloop_wait(struct evloop *loop,
+                uint64_t deadline,
+                void **ready,
+                int max_ready);
+
+/**
+ * Like evloop_wait(), but only checks which sockets are readable now,
+ * without waiting. The deadline still counts: see evloop_fd().
+ */
+int evloop_poll(struct evloop *loop,
+                uint64_t deadline,
+                void **ready,
+                int max_ready);
+
+/**
+ * Returns a descriptor that becomes readable when evloop_wait() would
+ * return: when a socket is readable, on evloop_wake() or when the deadline
+ * last passed to evloop_poll() arrives (if it wasn't already due then), so
+ * that the loop can be nested in another one. Only available with epoll;
+ * returns -1 elsewhere.
+ */
+int evloop_fd(const struct evloop *loop);
+
+/**
+ * Makes a concurrent or the next evloop_wait() return 0 immediately. Safe to
+ * call from another thread or a signal handler. Does nothing on Windows,
+ * where the wait only ends at the deadline.
+ */
+void evloop_wake(struct evloop *loop);
+
+/**
+ * Releases the resources held by the event loop. The sockets themselves are
+ * not closed.
+ */
+void evloop_destroy(struct evloop *loop);
+
+#endif /* EVLOOP_H */
@@ -0,0 +1,1612 @@
+#include "icmp_socket.h"
+#include "uring.h"
+#include "packet_ring.h"
+
+#if defined __linux__ && defined SO_TIMESTAMPING
+    #include <linux/errqueue.h>
+    #include <linux/net_tstamp.h>
+    #ifdef SO_EE_ORIGIN_TIMESTAMPING
+        #define HAVE_TX_TIMESTAMPS
+    #endif
+#endif
+
+#ifndef _WIN32
+    #include <netinet/icmp6.h>  /* ICMP6_FILTER */
+#endif
+
+#ifdef __linux__
+    #include <linux/filter.h>   /* SO_ATTACH_FILTER */
+    #ifndef ICMP_FILTER
+        #define ICMP_FILTER 1   /* from linux/icmp.h, which clashes with glibc */
+        struct icmp_filter {
+            uint32_t data;
+        };
+    #endif
+#endif
+
+#define ICMP_ECHO_REQUEST_TYPE 8
+#define ICMP_ECHO_REPLY_TYPE 0
+#define ICMP6_ECHO_REQUEST_TYPE 128
+#define ICMP6_ECHO_REPLY_TYPE 129
+
+#define MESSAGE_BUFFER_SIZE 1024
+#define CONTROL_BUFFER_SIZE 256
+#define SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define MAX_IP_HEADER_LENGTH 60
+
+#if defined HAVE_IO_URING && defined HAVE_MMSG
+
+#define URING_BUF_GROUP 0
+#define URING_RECV_BUFS 256
+#define URING_RECV_BUFS_LARGE 4096
+
+/*
+ * Sends and receives have separate rings, so that the completions of sends
+ * can be collected right away without getting in the way of receives.
+ */
+struct icmp_uring {
+    struct uring send_ring;
+    struct uring recv_ring;
+    struct uring_buf_ring bufs;
+    struct msghdr recv_msg;  /* how much room to leave for the address and
+                                control messages in each buffer */
+    int recv_armed;
+    uint16_t used_bufs[ICMP_SOCKET_BATCH_SIZE]; /* to give back next time */
+    size_t num_used_bufs;
+};
+
+#else
+    #undef HAVE_IO_URING
+#endif
+
+#ifdef HAVE_PACKET_RING
+
+#include <netinet/ip6.h>        /* struct ip6_hdr */
+#include <linux/if_ether.h>     /* ETH_P_IP, ETH_P_IPV6 */
+
+/*
+ * Blocks are handed over when full or after RING_RETIRE_TIMEOUT ms. The
+ * timeout delays our processing of replies, but not their timestamps.
+ */
+#define RING_BLOCK_SIZE (256 * 1024)
+#define RING_BLOCKS 8
+#define RING_BLOCKS_LARGE 64
+#define RING_RETIRE_TIMEOUT 1
+
+#endif
+
+static int would_block(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/*
+ * Errors that only mean that the send buffer is full, e.g. because we are
+ * sending to a lot of targets at once.
+ */
+static int send_buffer_full(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK
+        || WSAGetLastError() == WSAENOBUFS;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS;
+#endif
+}
+
+/*
+ * Sending failed because the packet is larger than the MTU and may not be
+ * fragmented.
+ */
+static int message_too_big(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEMSGSIZE;
+#else
+    return errno == EMSGSIZE;
+#endif
+}
+
+#ifndef _WIN32
+
+/*
+ * Returns the (wall clock) time stored in a timestamp control message or 0
+ * if the message is something else.
+ */
+static uint64_t cmsg_timestamp(const cmsghdr_t *cmsg)
+{
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+        return 0;
+    }
+#ifdef SO_TIMESTAMPING
+    if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+        /* The software timestamp comes first, see scm_timestamping. */
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+#ifdef SCM_TIMESTAMPNS
+    if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+#ifdef SCM_TIMESTAMP
+    if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+        struct timeval tv;
+        memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+        return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Asks the kernel to timestamp outgoing and incoming packets. Transmit
+ * timestamps are only available on Linux; elsewhere we settle for receive
+ * timestamps if possible. Failures are not fatal: we can always fall back to
+ * taking the time ourselves.
+ */
+static void enable_timestamps(struct icmp_socket *sock, int flags)
+{
+    int opt_value;
+
+#ifdef HAVE_TX_TIMESTAMPS
+    if ((flags & ICMP_SOCKET_NO_TX_TIMESTAMPS) == 0) {
+        sock->tx_keys = calloc(TX_KEY_RING_SIZE, sizeof(*sock->tx_keys));
+    }
+    if (sock->tx_keys != NULL) {
+        opt_value = SOF_TIMESTAMPING_TX_SOFTWARE
+            | SOF_TIMESTAMPING_RX_SOFTWARE
+            | SOF_TIMESTAMPING_SOFTWARE
+            | SOF_TIMESTAMPING_OPT_ID
+            | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(sock->fd,
+                       SOL_SOCKET,
+                       SO_TIMESTAMPING,
+                       &opt_value,
+                       sizeof(opt_value)) == 0) {
+            sock->timestamping = TIMESTAMPS_RX | TIMESTAMPS_TX;
+            return;
+        }
+        free(sock->tx_keys);
+        sock->tx_keys = NULL;
+    }
+#endif
+
+    opt_value = 1;
+#if defined SO_TIMESTAMPNS
+    if (setsockopt(sock->fd,
+                   SOL_SOCKET,
+                   SO_TIMESTAMPNS,
+                   &opt_value,
+                   sizeof(opt_value)) == 0) {
+        sock->timestamping = TIMESTAMPS_RX;
+    }
+#elif defined SO_TIMESTAMP
+    if (setsockopt(sock->fd,
+                   SOL_SOCKET,
+                   SO_TIMESTAMP,
+                   &opt_value,
+                   sizeof(opt_value)) == 0) {
+        sock->timestamping = TIMESTAMPS_RX;
+    }
+#else
+    (void)opt_value;
+#endif
+    (void)flags;
+}
+
+#endif /* !_WIN32 */
+
+/*
+ * Allocates the send queue and receive buffers. The receive buffers must be
+ * large enough for replies with the IP header and the whole payload.
+ */
+static int alloc_buffers(struct icmp_socket *sock,
+                         const char *template_packet)
+{
+    size_t i;
+
+    sock->recv_buf_size = MAX_IP_HEADER_LENGTH + sock->packet_size;
+    if (sock->recv_buf_size < MESSAGE_BUFFER_SIZE) {
+        sock->recv_buf_size = MESSAGE_BUFFER_SIZE;
+    }
+
+    sock->send_bufs = malloc(ICMP_SOCKET_BATCH_SIZE * sock->packet_size);
+    sock->queue = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->queue));
+    sock->recv_bufs = malloc(ICMP_SOCKET_BATCH_SIZE * sock->recv_buf_size);
+    sock->control_bufs = malloc(ICMP_SOCKET_BATCH_SIZE * CONTROL_BUFFER_SIZE);
+    sock->messages = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->messages));
+    if (sock->send_bufs == NULL
+        || sock->queue == NULL
+        || sock->recv_bufs == NULL
+        || sock->control_bufs == NULL
+        || sock->messages == NULL) {
+        return -1;
+    }
+
+#ifdef HAVE_MMSG
+    sock->send_msgs = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->send_msgs));
+    sock->send_iovs = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->send_iovs));
+    sock->recv_msgs = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->recv_msgs));
+    sock->recv_iovs = calloc(ICMP_SOCKET_BATCH_SIZE, sizeof(*sock->recv_iovs));
+    if (sock->send_msgs == NULL
+        || sock->send_iovs == NULL
+        || sock->recv_msgs == NULL
+        || sock->recv_iovs == NULL) {
+        return -1;
+    }
+#endif
+
+    for (i = 0; i < ICMP_SOCKET_BATCH_SIZE; i++) {
+        memcpy(sock->send_bufs + i * sock->packet_size,
+               template_packet,
+               sock->packet_size);
+#ifdef HAVE_MMSG
+        sock->send_iovs[i].iov_base = sock->send_bufs + i * sock->packet_size;
+        sock->send_iovs[i].iov_len = sock->packet_size;
+        sock->send_msgs[i].msg_hdr.msg_iov = &sock->send_iovs[i];
+        sock->send_msgs[i].msg_hdr.msg_iovlen = 1;
+        sock->recv_iovs[i].iov_base = sock->recv_bufs + i * sock->recv_buf_size;
+        sock->recv_iovs[i].iov_len = sock->recv_buf_size;
+        sock->recv_msgs[i].msg_hdr.msg_name = &sock->messages[i].from;
+        sock->recv_msgs[i].msg_hdr.msg_iov = &sock->recv_iovs[i];
+        sock->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        sock->recv_msgs[i].msg_hdr.msg_control =
+            sock->control_bufs + i * CONTROL_BUFFER_SIZE;
+#endif
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_PING_SOCKETS
+
+/*
+ * Tries to open a ping socket. This fails if the user is not in the range
+ * of groups allowed to use them (net.ipv4.ping_group_range), which is empty
+ * by default on many systems, so errors are silently ignored.
+ *
+ * The socket is bound right away to find out the ICMP ID that the kernel
+ * chooses for it.
+ */
+static socket_t open_ping_socket(int family, uint16_t *id)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    socket_t sockfd;
+
+    sockfd = socket(family,
+                    SOCK_DGRAM,
+                    family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP);
+    if ((int)sockfd < 0) {
+        return (socket_t)-1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.ss_family = family;
+    addr_len = family == AF_INET6
+        ? sizeof(struct sockaddr_in6)
+        : sizeof(struct sockaddr_in);
+    if (bind(sockfd, (struct sockaddr *)&addr, addr_len) != 0
+        || getsockname(sockfd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        close_socket(sockfd);
+        return (socket_t)-1;
+    }
+
+    *id = ntohs(family == AF_INET6
+                ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                : ((struct sockaddr_in *)&addr)->sin_port);
+    return sockfd;
+}
+
+#endif /* HAVE_PING_SOCKETS */
+
+#ifdef HAVE_IO_URING
+
+static int arm_uring_receive(struct icmp_socket *sock)
+{
+    struct icmp_uring *uring = sock->uring;
+    struct io_uring_sqe *sqe = uring_get_sqe(&uring->recv_ring);
+
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sock->stats.receive_syscalls++;
+    if (uring_submit(&uring->recv_ring, 0) < 0) {
+        return -1;
+    }
+    uring->recv_armed = 1;
+    return 0;
+}
+
+static void close_uring(struct icmp_socket *sock)
+{
+    if (sock->uring == NULL) {
+        return;
+    }
+    uring_destroy(&sock->uring->send_ring);
+    uring_destroy(&sock->uring->recv_ring);
+    uring_buf_ring_destroy(&sock->uring->bufs);
+    free(sock->uring);
+    sock->uring = NULL;
+}
+
+/*
+ * Switches the socket over to io_uring. Returns -1 if the kernel doesn't
+ * support everything that we need, in which case the socket is left as it
+ * was.
+ */
+static int open_uring(struct icmp_socket *sock, int flags)
+{
+    struct icmp_uring *uring;
+    unsigned int num_bufs = (flags & ICMP_SOCKET_LARGE_BUFFERS) != 0
+        ? URING_RECV_BUFS_LARGE
+        : URING_RECV_BUFS;
+    struct io_uring_cqe *cqe;
+
+    uring = calloc(1, sizeof(*uring));
+    if (uring == NULL) {
+        return -1;
+    }
+    uring->send_ring.fd = -1;
+    uring->recv_ring.fd = -1;
+    sock->uring = uring;
+
+    if (uring_init(&uring->send_ring,
+                   ICMP_SOCKET_BATCH_SIZE,
+                   2 * ICMP_SOCKET_BATCH_SIZE) != 0
+        || uring_init(&uring->recv_ring, 4, 2 * num_bufs) != 0
+        || uring_buf_ring_init(&uring->bufs,
+                               &uring->recv_ring,
+                               URING_BUF_GROUP,
+                               num_bufs,
+                               sizeof(struct io_uring_recvmsg_out)
+                                   + sizeof(struct sockaddr_storage)
+                                   + CONTROL_BUFFER_SIZE
+                                   + sock->recv_buf_size) != 0) {
+        goto error;
+    }
+
+    uring->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+    uring->recv_msg.msg_controllen = CONTROL_BUFFER_SIZE;
+    if (arm_uring_receive(sock) != 0) {
+        goto error;
+    }
+
+    /*
+     * Kernels older than 6.0 reject multishot receives right away.
+     */
+    cqe = uring_peek_cqe(&uring->recv_ring);
+    if (cqe != NULL && cqe->res < 0 && cqe->res != -ENOBUFS) {
+        goto error;
+    }
+
+#ifdef HAVE_TX_TIMESTAMPS
+    if ((sock->timestamping & TIMESTAMPS_TX) != 0) {
+        int opt_value = SOF_TIMESTAMPING_RX_SOFTWARE
+            | SOF_TIMESTAMPING_SOFTWARE;
+        sock->timestamping = setsockopt(sock->fd,
+                                        SOL_SOCKET,
+                                        SO_TIMESTAMPING,
+                                        &opt_value,
+                                        sizeof(opt_value)) == 0
+            ? TIMESTAMPS_RX
+            : 0;
+        free(sock->tx_keys);
+        sock->tx_keys = NULL;
+    }
+#endif
+
+    return 0;
+
+error:
+    close_uring(sock);
+    return -1;
+}
+
+#endif /* HAVE_IO_URING */
+
+#ifdef HAVE_PACKET_RING
+
+/*
+ * Attaches a classic BPF program to the packet ring that accepts only echo
+ * replies addressed to this host with an ID in [first_id, first_id +
+ * num_ids). Unlike a raw socket, the ring sees every IP packet, starting
+ * from the IP header for both address families.
+ */
+static int attach_ring_filter(struct icmp_socket *sock,
+                              uint16_t first_id,
+                              uint32_t num_ids)
+{
+    struct sock_filter filter4[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 0, 12),
+        /* protocol */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 10),
+        /* only the first fragment has the ICMP header */
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 8, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO_REPLY_TYPE, 0, 5),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, first_id),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, num_ids, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_filter filter6[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 0, 9),
+        /* next header, extension headers are not supported */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 7),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 40),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY_TYPE, 0, 5),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 44),
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, first_id),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, num_ids, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog program;
+
+    if (sock->family == AF_INET6) {
+        program.len = sizeof(filter6) / sizeof(filter6[0]);
+        program.filter = filter6;
+    } else {
+        program.len = sizeof(filter4) / sizeof(filter4[0]);
+        program.filter = filter4;
+    }
+
+    return setsockopt(sock->ring->fd,
+                      SOL_SOCKET,
+                      SO_ATTACH_FILTER,
+                      &program,
+                      sizeof(program));
+}
+
+static void close_ring(struct icmp_socket *sock)
+{
+    if (sock->ring == NULL) {
+        return;
+    }
+    packet_ring_close(sock->ring);
+    free(sock->ring);
+    sock->ring = NULL;
+}
+
+/*
+ * Moves receiving over to a packet ring. Returns -1 if it can't be set up,
+ * in which case the socket is left as it was.
+ */
+static int open_ring(struct icmp_socket *sock, int flags)
+{
+    struct sock_filter drop_all[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog program;
+
+    if (sock->type != SOCK_RAW) {
+        return -1;
+    }
+
+    sock->ring = malloc(sizeof(*sock->ring));
+    if (sock->ring == NULL) {
+        return -1;
+    }
+    if (packet_ring_open(sock->ring,
+                         sock->family == AF_INET6 ? ETH_P_IPV6 : ETH_P_IP,
+                         RING_BLOCK_SIZE,
+                         (flags & ICMP_SOCKET_LARGE_BUFFERS) != 0
+                             ? RING_BLOCKS_LARGE
+                             : RING_BLOCKS,
+                         RING_RETIRE_TIMEOUT) != 0) {
+        free(sock->ring);
+        sock->ring = NULL;
+        return -1;
+    }
+
+    /*
+     * Until icmp_socket_set_filter() narrows it down, accept any ID.
+     */
+    if (attach_ring_filter(sock, 0, 0x10000) != 0) {
+        goto error;
+    }
+
+    /*
+     * The socket would get its own copy of every reply, which nobody
+     * would read.
+     */
+    program.len = 1;
+    program.filter = drop_all;
+    if (setsockopt(sock->fd,
+                   SOL_SOCKET,
+                   SO_ATTACH_FILTER,
+                   &program,
+                   sizeof(program)) != 0) {
+        goto error;
+    }
+
+    /*
+     * Every frame in the ring is timestamped.
+     */
+    sock->timestamping |= TIMESTAMPS_RX;
+    return 0;
+
+error:
+    close_ring(sock);
+    return -1;
+}
+
+#endif /* HAVE_PACKET_RING */
+
+int icmp_socket_open(struct icmp_socket *sock,
+                     int family,
+                     const char *template_packet,
+                     size_t packet_size,
+                     int flags)
+{
+    socket_t sockfd = (socket_t)-1;
+    int opt_value;
+
+    memset(sock, 0, sizeof(*sock));
+    sock->fd = (socket_t)-1;
+    sock->family = family;
+    sock->packet_size = packet_size;
+    sock->send_size = packet_size;
+
+#ifdef HAVE_PING_SOCKETS
+    if ((flags & ICMP_SOCKET_RAW) == 0) {
+        sockfd = open_ping_socket(family, &sock->id);
+        sock->type = SOCK_DGRAM;
+    }
+#endif
+    if ((int)sockfd < 0) {
+        sockfd = socket(family,
+                        SOCK_RAW,
+                        family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP);
+        if ((int)sockfd < 0) {
+            psockerror("socket");
+            return -1;
+        }
+        sock->type = SOCK_RAW;
+    }
+    sock->fd = sockfd;
+
+#ifdef _WIN32
+    init_winsock_extensions(sockfd);
+#endif
+
+    /*
+     * Switch the socket to non-blocking I/O mode. This allows us to implement
+     * the timeout feature.
+     */
+#ifdef _WIN32
+    {
+        u_long opt_value = 1;
+        if (ioctlsocket(sockfd, FIONBIO, &opt_value) != 0) {
+            psockerror("ioctlsocket");
+            goto error;
+        }
+    }
+#else /* _WIN32 */
+    if (fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1) {
+        psockerror("fcntl");
+        goto error;
+    }
+#endif /* !_WIN32 */
+
+    if (family == AF_INET6) {
+        /*
+         * This allows us to receive IPv6 packet headers in incoming messages.
+         */
+        opt_value = 1;
+        if (setsockopt(sockfd,
+                       IPPROTO_IPV6,
+#if defined _WIN32 || defined __CYGWIN__
+                       IPV6_PKTINFO,
+#else
+                       IPV6_RECVPKTINFO,
+#endif
+                       (char *)&opt_value,
+                       sizeof(opt_value)) != 0) {
+            psockerror("setsockopt");
+            goto error;
+        }
+    }
+
+    /*
+     * Replies from many targets can arrive in bursts, make sure they don't
+     * overflow the receive buffer while we are busy. This is only a hint,
+     * so errors are ignored.
+     */
+    if ((flags & ICMP_SOCKET_LARGE_BUFFERS) != 0) {
+        opt_value = SOCKET_BUFFER_SIZE;
+        setsockopt(sockfd,
+                   SOL_SOCKET,
+                   SO_RCVBUF,
+                   (char *)&opt_value,
+                   sizeof(opt_value));
+        setsockopt(sockfd,
+                   SOL_SOCKET,
+                   SO_SNDBUF,
+                   (char *)&opt_value,
+                   sizeof(opt_value));
+    }
+
+    if (alloc_buffers(sock, template_packet) != 0) {
+        perror("malloc");
+        goto error;
+    }
+
+#ifndef _WIN32
+    enable_timestamps(sock, flags);
+#endif
+
+#ifdef HAVE_IO_URING
+    if ((flags & ICMP_SOCKET_URING) != 0) {
+        open_uring(sock, flags);
+    }
+#endif
+#ifdef HAVE_PACKET_RING
+    if ((flags & ICMP_SOCKET_PACKET_RING) != 0) {
+        open_ring(sock, flags);
+    }
+#endif
+
+    return 0;
+
+error:
+    icmp_socket_close(sock);
+    return -1;
+}
+
+#ifdef __linux__
+
+/*
+ * Attaches a classic BPF program that accepts only echo replies with an ID
+ * in [first_id, first_id + num_ids). Raw IPv4 sockets see packets starting
+ * from the IP header, raw IPv6 sockets from the ICMPv6 header.
+ */
+static int attach_id_filter(struct icmp_socket *sock,
+                            uint16_t first_id,
+                            uint16_t num_ids)
+{
+    struct sock_filter filter4[] = {
+        /* X = IP header length */
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO_REPLY_TYPE, 0, 5),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),
+        /* (id - first_id) mod 2^16 < num_ids */
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, first_id),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, num_ids, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_filter filter6[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY_TYPE, 0, 5),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, first_id),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, num_ids, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog program;
+
+    if (sock->family == AF_INET6) {
+        program.len = sizeof(filter6) / sizeof(filter6[0]);
+        program.filter = filter6;
+    } else {
+        program.len = sizeof(filter4) / sizeof(filter4[0]);
+        program.filter = filter4;
+    }
+
+    return setsockopt(sock->fd,
+                      SOL_SOCKET,
+                      SO_ATTACH_FILTER,
+                      &program,
+                      sizeof(program));
+}
+
+#endif /* __linux__ */
+
+int icmp_socket_set_filter(struct icmp_socket *sock,
+                           uint16_t first_id,
+                           uint16_t num_ids)
+{
+    int result = -1;
+
+    /*
+     * Ping sockets only receive our own replies anyway.
+     */
+    if (sock->type != SOCK_RAW || (int)sock->fd < 0) {
+        return 0;
+    }
+
+#ifdef HAVE_PACKET_RING
+    if (sock->ring != NULL) {
+        return attach_ring_filter(sock,
+                                  first_id,
+                                  num_ids > 0 ? num_ids : 0x10000);
+    }
+#endif
+
+    /*
+     * Cheap filters on the ICMP type alone, in case BPF is not available.
+     */
+#if defined ICMP_FILTER && defined SOL_RAW
+    if (sock->family == AF_INET) {
+        struct icmp_filter filter;
+        filter.data = ~(1u << ICMP_ECHO_REPLY_TYPE);
+        if (setsockopt(sock->fd,
+                       SOL_RAW,
+                       ICMP_FILTER,
+                       &filter,
+                       sizeof(filter)) == 0) {
+            result = 0;
+        }
+    }
+#endif
+#ifdef ICMP6_FILTER
+    if (sock->family == AF_INET6) {
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY_TYPE, &filter);
+        if (setsockopt(sock->fd,
+                       IPPROTO_ICMPV6,
+                       ICMP6_FILTER,
+                       &filter,
+                       sizeof(filter)) == 0) {
+            result = 0;
+        }
+    }
+#endif
+
+#ifdef __linux__
+    if (num_ids > 0 && attach_id_filter(sock, first_id, num_ids) == 0) {
+        result = 0;
+    }
+#else
+    (void)first_id;
+    (void)num_ids;
+#endif
+
+    return result;
+}
+
+int icmp_socket_set_request_filter(struct icmp_socket *sock)
+{
+    int result = -1;
+
+    if (sock->type != SOCK_RAW || (int)sock->fd < 0) {
+        return -1;
+    }
+
+#if defined ICMP_FILTER && defined SOL_RAW
+    if (sock->family == AF_INET) {
+        struct icmp_filter filter;
+        filter.data = ~(1u << ICMP_ECHO_REQUEST_TYPE);
+        if (setsockopt(sock->fd,
+                       SOL_RAW,
+                       ICMP_FILTER,
+                       &filter,
+                       sizeof(filter)) == 0) {
+            result = 0;
+        }
+    }
+#endif
+#ifdef ICMP6_FILTER
+    if (sock->family == AF_INET6) {
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REQUEST_TYPE, &filter);
+        if (setsockopt(sock->fd,
+                       IPPROTO_ICMPV6,
+                       ICMP6_FILTER,
+                       &filter,
+                       sizeof(filter)) == 0) {
+            result = 0;
+        }
+    }
+#endif
+
+    return result;
+}
+
+int icmp_socket_include_header(struct icmp_socket *sock)
+{
+    int opt_value = 1;
+
+    if (sock->type != SOCK_RAW || (int)sock->fd < 0) {
+        return -1;
+    }
+    if (sock->family == AF_INET6) {
+#ifdef IPV6_HDRINCL
+        return setsockopt(sock->fd,
+                          IPPROTO_IPV6,
+                          IPV6_HDRINCL,
+                          (char *)&opt_value,
+                          sizeof(opt_value));
+#else
+        return -1;
+#endif
+    }
+    return setsockopt(sock->fd,
+                      IPPROTO_IP,
+                      IP_HDRINCL,
+                      (char *)&opt_value,
+                      sizeof(opt_value));
+}
+
+void icmp_socket_close(struct icmp_socket *sock)
+{
+#ifdef HAVE_IO_URING
+    close_uring(sock);
+#endif
+#ifdef HAVE_PACKET_RING
+    close_ring(sock);
+#endif
+    if ((int)sock->fd >= 0) {
+        close_socket(sock->fd);
+    }
+    free(sock->tx_keys);
+    free(sock->send_bufs);
+    free(sock->queue);
+    free(sock->recv_bufs);
+    free(sock->control_bufs);
+    free(sock->messages);
+#ifdef HAVE_MMSG
+    free(sock->send_msgs);
+    free(sock->send_iovs);
+    free(sock->recv_msgs);
+    free(sock->recv_iovs);
+#endif
+    memset(sock, 0, sizeof(*sock));
+    sock->fd = (socket_t)-1;
+}
+
+socket_t icmp_socket_poll_fd(const struct icmp_socket *sock)
+{
+#ifdef HAVE_IO_URING
+    if (sock->uring != NULL) {
+        return sock->uring->recv_ring.fd;
+    }
+#endif
+#ifdef HAVE_PACKET_RING
+    if (sock->ring != NULL) {
+        return sock->ring->fd;
+    }
+#endif
+    return sock->fd;
+}
+
+void icmp_socket_set_send_size(struct icmp_socket *sock, size_t size)
+{
+    sock->send_size = size;
+}
+
+int icmp_socket_set_dont_fragment(struct icmp_socket *sock)
+{
+    int opt_value;
+    int result = -1;
+
+    if (sock->family == AF_INET6) {
+#if defined IPV6_MTU_DISCOVER && defined IPV6_PMTUDISC_DO
+        opt_value = IPV6_PMTUDISC_DO;
+        result = setsockopt(sock->fd,
+                            IPPROTO_IPV6,
+                            IPV6_MTU_DISCOVER,
+                            (char *)&opt_value,
+                            sizeof(opt_value));
+#endif
+#ifdef IPV6_DONTFRAG
+        opt_value = 1;
+        result = setsockopt(sock->fd,
+                            IPPROTO_IPV6,
+                            IPV6_DONTFRAG,
+                            (char *)&opt_value,
+                            sizeof(opt_value));
+#endif
+    } else {
+#if defined IP_MTU_DISCOVER && defined IP_PMTUDISC_DO
+        opt_value = IP_PMTUDISC_DO;
+        result = setsockopt(sock->fd,
+                            IPPROTO_IP,
+                            IP_MTU_DISCOVER,
+                            (char *)&opt_value,
+                            sizeof(opt_value));
+#elif defined IP_DONTFRAG
+        opt_value = 1;
+        result = setsockopt(sock->fd,
+                            IPPROTO_IP,
+                            IP_DONTFRAG,
+                            (char *)&opt_value,
+                            sizeof(opt_value));
+#elif defined IP_DONTFRAGMENT
+        opt_value = 1;
+        result = setsockopt(sock->fd,
+                            IPPROTO_IP,
+                            IP_DONTFRAGMENT,
+                            (char *)&opt_value,
+                            sizeof(opt_value));
+#endif
+    }
+
+    (void)opt_value;
+    return result == 0 ? 0 : -1;
+}
+
+char *icmp_socket_queue(struct icmp_socket *sock,
+                        void *owner,
+                        uint16_t seq,
+                        const struct sockaddr_storage *addr,
+                        socklen_t addr_len)
+{
+    struct queued_request *request;
+
+    if (sock->num_queued == ICMP_SOCKET_BATCH_SIZE
+        && icmp_socket_flush(sock) != 0) {
+        return NULL;
+    }
+
+    request = &sock->queue[sock->num_queued];
+    request->owner = owner;
+    request->seq = seq;
+    request->addr = addr;
+    request->addr_len = addr_len;
+    request->size = sock->send_size;
+
+    return sock->send_bufs + sock->num_queued++ * sock->packet_size;
+}
+
+void icmp_socket_trim(struct icmp_socket *sock, size_t size)
+{
+    if (sock->num_queued == 0) {
+        return;
+    }
+    if (size == 0) {
+        sock->num_queued--;
+    } else {
+        sock->queue[sock->num_queued - 1].size = size;
+    }
+}
+
+/*
+ * Sends the queued requests starting from the given one. Returns the number
+ * of requests sent or -1 on error.
+ */
+static int send_requests(struct icmp_socket *sock, size_t first)
+{
+#ifdef HAVE_MMSG
+    size_t i;
+
+    for (i = first; i < sock->num_queued; i++) {
+        struct msghdr *msg = &sock->send_msgs[i].msg_hdr;
+        msg->msg_name = (void *)sock->queue[i].addr;
+        msg->msg_namelen = sock->queue[i].addr_len;
+        sock->send_iovs[i].iov_len = sock->queue[i].size;
+    }
+    return sendmmsg(sock->fd,
+                    &sock->send_msgs[first],
+                    (unsigned int)(sock->num_queued - first),
+                    0);
+#else
+    const struct queued_request *request = &sock->queue[first];
+    int error;
+
+    error = (int)sendto(sock->fd,
+                        sock->send_bufs + first * sock->packet_size,
+                        (int)request->size,
+                        0,
+                        (const struct sockaddr *)request->addr,
+                        (int)request->addr_len);
+    return error < 0 ? -1 : 1;
+#endif
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * Submits all queued requests at once and collects their results, which
+ * are available as soon as the submission returns since sends never wait.
+ */
+static int flush_uring(struct icmp_socket *sock)
+{
+    struct icmp_uring *uring = sock->uring;
+    struct io_uring_cqe *cqe;
+    int error = 0;
+    size_t i;
+
+    for (i = 0; i < sock->num_queued; i++) {
+        struct msghdr *msg = &sock->send_msgs[i].msg_hdr;
+        struct io_uring_sqe *sqe = uring_get_sqe(&uring->send_ring);
+
+        msg->msg_name = (void *)sock->queue[i].addr;
+        msg->msg_namelen = sock->queue[i].addr_len;
+        sock->send_iovs[i].iov_len = sock->queue[i].size;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = sock->fd;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_DONTWAIT;
+        sqe->user_data = i;
+    }
+
+    sock->stats.send_calls++;
+    if (uring_submit(&uring->send_ring, (unsigned int)sock->num_queued) < 0) {
+        psockerror("io_uring_enter");
+        sock->num_queued = 0;
+        return -1;
+    }
+
+    while ((cqe = uring_peek_cqe(&uring->send_ring)) != NULL) {
+        if (cqe->res >= 0) {
+            sock->stats.packets_sent++;
+        } else if (cqe->res == -EMSGSIZE) {
+            sock->stats.too_big++;
+        } else if (cqe->res != -EAGAIN && cqe->res != -ENOBUFS) {
+            /* Otherwise the request is dropped and will time out. */
+            error = -cqe->res;
+        }
+        uring_cqe_seen(&uring->send_ring);
+    }
+
+    sock->num_queued = 0;
+    if (error != 0) {
+        errno = error;
+        psockerror("sendmsg");
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
+
+int icmp_socket_flush(struct icmp_socket *sock)
+{
+    size_t i = 0;
+
+#ifdef HAVE_IO_URING
+    if (sock->uring != NULL && sock->num_queued > 0) {
+        return flush_uring(sock);
+    }
+#endif
+
+    while (i < sock->num_queued) {
+        int count = send_requests(sock, i);
+
+        sock->stats.send_calls++;
+
+        if (count < 0) {
+            if (message_too_big()) {
+                sock->stats.too_big++;
+            } else if (!send_buffer_full()) {
+                psockerror("sendto");
+                sock->num_queued = 0;
+                return -1;
+            }
+            /*
+             * Drop the request that couldn't be sent, it will time out.
+             */
+            i++;
+            continue;
+        }
+
+        sock->stats.packets_sent += count;
+
+        if ((sock->timestamping & TIMESTAMPS_TX) != 0) {
+            size_t j;
+            for (j = i; j < i + count; j++) {
+                struct tx_key *tx_key =
+                    &sock->tx_keys[sock->next_tx_key % TX_KEY_RING_SIZE];
+                tx_key->owner = sock->queue[j].owner;
+                tx_key->seq = sock->queue[j].seq;
+                tx_key->key = sock->next_tx_key++;
+            }
+        }
+
+        i += count;
+    }
+
+    sock->num_queued = 0;
+    return 0;
+}
+
+/*
+ * Fills in the ICMP message from a packet read from the socket. If the packet
+ * is too short to be an ICMP message, data is set to NULL.
+ */
+static void parse_message(struct icmp_socket *sock,
+                         struct icmp_message *message,
+                         char *buf,
+                         size_t len,
+                         msghdr_t *msg)
+{
+    cmsghdr_t *cmsg;
+    size_t ip_hdr_len;
+
+    memset(&message->dst, 0, sizeof(message->dst));
+    message->kernel_time = 0;
+    message->data = NULL;
+    message->len = 0;
+
+    /*
+     * Extract the destination address from IPv6 packet info (this will be
+     * used to compute the checksum later) and the time when the kernel
+     * received the packet.
+     */
+    for (
+        cmsg = CMSG_FIRSTHDR(msg);
+        cmsg != NULL;
+        cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == IPPROTO_IPV6
+            && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *pktinfo = (void *)CMSG_DATA(cmsg);
+            memcpy(&message->dst,
+                   &pktinfo->ipi6_addr,
+                   sizeof(struct in6_addr));
+        }
+#ifndef _WIN32
+        else if (message->kernel_time == 0) {
+            message->kernel_time = cmsg_timestamp(cmsg);
+        }
+#endif
+    }
+
+    if (sock->family == AF_INET6 || sock->type == SOCK_DGRAM) {
+        /*
+         * The IP header is not included in the message, msg_buf points
+         * directly to the ICMP data.
+         */
+        ip_hdr_len = 0;
+    } else {
+        /*
+         * For IPv4, we must take the length of the IP header into
+         * account.
+         *
+         * Header length is stored in the lower 4 bits of the VHL field
+         * (VHL = Version + Header Length).
+         */
+        if (len < 1) {
+            return;
+        }
+        ip_hdr_len = ((*(uint8_t *)buf) & 0x0F) * 4;
+    }
+
+    if (len < ip_hdr_len + ICMP_HEADER_LENGTH) {
+        return;
+    }
+
+    message->data = buf + ip_hdr_len;
+    message->len = len - ip_hdr_len;
+    message->header_len = ip_hdr_len;
+}
+
+#ifdef HAVE_IO_URING
+
+static int receive_uring(struct icmp_socket *sock,
+                         struct icmp_message **messages)
+{
+    struct icmp_uring *uring = sock->uring;
+    struct io_uring_cqe *cqe;
+    int count = 0;
+
+    /*
+     * The messages of the last batch are no longer needed.
+     */
+    icmp_socket_release(sock);
+
+    sock->stats.receive_calls++;
+
+    while (count < ICMP_SOCKET_BATCH_SIZE
+           && (cqe = uring_peek_cqe(&uring->recv_ring)) != NULL) {
+        int res = cqe->res;
+        uint32_t cqe_flags = cqe->flags;
+        struct io_uring_recvmsg_out *out;
+        struct msghdr msg;
+        char *buf;
+        char *payload;
+        size_t payload_len;
+        uint16_t bid;
+
+        uring_cqe_seen(&uring->recv_ring);
+        if ((cqe_flags & IORING_CQE_F_MORE) == 0) {
+            uring->recv_armed = 0;
+        }
+        if (res < 0) {
+            /*
+             * Ran out of buffers: some replies were dropped, but we can
+             * carry on once the ones in use are given back.
+             */
+            if (res == -ENOBUFS) {
+                continue;
+            }
+            errno = -res;
+            psockerror("recvmsg");
+            return -1;
+        }
+        if ((cqe_flags & IORING_CQE_F_BUFFER) == 0) {
+            continue;
+        }
+
+        bid = (uint16_t)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+        buf = uring_buf(&uring->bufs, bid);
+        uring->used_bufs[uring->num_used_bufs++] = bid;
+
+        out = (struct io_uring_recvmsg_out *)buf;
+        payload = buf
+            + sizeof(*out)
+            + uring->recv_msg.msg_namelen
+            + uring->recv_msg.msg_controllen;
+        payload_len = (size_t)res - (size_t)(payload - buf);
+        if (out->payloadlen < payload_len) {
+            payload_len = out->payloadlen;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = buf + sizeof(*out) + uring->recv_msg.msg_namelen;
+        msg.msg_controllen = out->controllen;
+        memcpy(&sock->messages[count].from,
+               buf + sizeof(*out),
+               out->namelen < sizeof(struct sockaddr_storage)
+                   ? out->namelen
+                   : sizeof(struct sockaddr_storage));
+        parse_message(sock,
+                      &sock->messages[count],
+                      payload,
+                      payload_len,
+                      &msg);
+        count++;
+    }
+
+    /*
+     * The multishot receive may have ended, e.g. when it ran out of
+     * buffers. It will pick up the buffers given back on the next call.
+     */
+    if (!uring->recv_armed && arm_uring_receive(sock) != 0) {
+        psockerror("io_uring_enter");
+        return -1;
+    }
+
+    if (count == 0) {
+        sock->stats.empty_receives++;
+    }
+    sock->stats.packets_received += count;
+    *messages = sock->messages;
+    return count;
+}
+
+#endif /* HAVE_IO_URING */
+
+#ifdef HAVE_PACKET_RING
+
+/*
+ * Fills in the ICMP message from a packet in the ring, which starts at the
+ * IP header. The message points into the ring.
+ */
+static void parse_ring_packet(struct icmp_socket *sock,
+                              struct icmp_message *message,
+                              struct tpacket3_hdr *packet)
+{
+    char *buf = (char *)packet + packet->tp_net;
+    size_t len = packet->tp_snaplen;
+    size_t hdr_len;
+    size_t total_len;
+
+    memset(&message->from, 0, sizeof(message->from));
+    memset(&message->dst, 0, sizeof(message->dst));
+    message->kernel_time = (uint64_t)packet->tp_sec * 1000000000
+        + packet->tp_nsec;
+    message->data = NULL;
+    message->len = 0;
+
+    if (sock->family == AF_INET6) {
+        struct ip6_hdr *ip6 = (struct ip6_hdr *)buf;
+        struct sockaddr_in6 *from = (struct sockaddr_in6 *)&message->from;
+
+        hdr_len = sizeof(struct ip6_hdr);
+        if (len < hdr_len) {
+            return;
+        }
+        /*
+         * The ring sees all IP traffic, so this is not necessarily ICMP.
+         * Extension headers, including fragment headers, are not supported.
+         */
+        if (ip6->ip6_nxt != IPPROTO_ICMPV6) {
+            return;
+        }
+        total_len = hdr_len + ntohs(ip6->ip6_plen);
+        from->sin6_family = AF_INET6;
+        from->sin6_addr = ip6->ip6_src;
+        message->dst = ip6->ip6_dst;
+    } else {
+        struct ip *ip = (struct ip *)buf;
+        struct sockaddr_in *from = (struct sockaddr_in *)&message->from;
+
+        if (len < sizeof(struct ip)) {
+            return;
+        }
+        /*
+         * Only the first fragment starts with the ICMP header.
+         */
+        if (ip->ip_p != IPPROTO_ICMP
+            || (ntohs(ip->ip_off) & IP_OFFMASK) != 0) {
+            return;
+        }
+        hdr_len = ip->ip_hl * 4;
+        if (hdr_len < sizeof(struct ip)) {
+            return;
+        }
+        total_len = ntohs(ip->ip_len);
+        from->sin_family = AF_INET;
+        from->sin_addr = ip->ip_src;
+    }
+
+    /*
+     * Leave out the padding of short Ethernet frames.
+     */
+    if (total_len < len) {
+        len = total_len;
+    }
+    if (len < hdr_len + ICMP_HEADER_LENGTH) {
+        return;
+    }
+
+    message->data = buf + hdr_len;
+    message->len = len - hdr_len;
+    message->header_len = hdr_len;
+}
+
+static int receive_ring(struct icmp_socket *sock,
+                        struct icmp_message **messages)
+{
+    struct tpacket3_hdr *packet;
+    int count = 0;
+
+    icmp_socket_release(sock);
+
+    sock->stats.receive_calls++;
+    while (count < ICMP_SOCKET_BATCH_SIZE
+           && (packet = packet_ring_next(sock->ring)) != NULL) {
+        parse_ring_packet(sock, &sock->messages[count], packet);
+        count++;
+    }
+
+    if (count == 0) {
+        sock->stats.empty_receives++;
+    }
+    sock->stats.packets_received += count;
+    *messages = sock->messages;
+    return count;
+}
+
+#endif /* HAVE_PACKET_RING */
+
+int icmp_socket_receive(struct icmp_socket *sock,
+                        struct icmp_message **messages)
+{
+    int count;
+#ifdef HAVE_MMSG
+    int num_received;
+    int i;
+
+#ifdef HAVE_IO_URING
+    if (sock->uring != NULL) {
+        return receive_uring(sock, messages);
+    }
+#endif
+#ifdef HAVE_PACKET_RING
+    if (sock->ring != NULL) {
+        return receive_ring(sock, messages);
+    }
+#endif
+
+    for (i = 0; i < ICMP_SOCKET_BATCH_SIZE; i++) {
+        struct msghdr *msg = &sock->recv_msgs[i].msg_hdr;
+        msg->msg_namelen = sizeof(struct sockaddr_storage);
+        msg->msg_controllen = CONTROL_BUFFER_SIZE;
+        msg->msg_flags = 0;
+    }
+
+    num_received = recvmmsg(sock->fd,
+                            sock->recv_msgs,
+                            ICMP_SOCKET_BATCH_SIZE,
+                            0,
+                            NULL);
+    sock->stats.receive_calls++;
+    sock->stats.receive_syscalls++;
+    if (num_received < 0) {
+        if (would_block()) {
+            sock->stats.empty_receives++;
+            return 0;
+        }
+        psockerror("recvmmsg");
+        return -1;
+    }
+    sock->stats.packets_received += num_received;
+
+    for (i = 0; i < num_received; i++) {
+        parse_message(sock,
+                      &sock->messages[i],
+                      sock->recv_iovs[i].iov_base,
+                      sock->recv_msgs[i].msg_len,
+                      &sock->recv_msgs[i].msg_hdr);
+    }
+    count = num_received;
+#else /* HAVE_MMSG */
+    struct icmp_message *message = &sock->messages[0];
+#ifdef _WIN32
+    WSABUF msg_buf_struct = {
+        (ULONG)sock->recv_buf_size,
+        sock->recv_bufs
+    };
+    WSAMSG msg = {
+        (struct sockaddr *)&message->from,
+        sizeof(message->from),
+        &msg_buf_struct,
+        1,
+        {CONTROL_BUFFER_SIZE, sock->control_bufs},
+        0
+    };
+    DWORD msg_len = 0;
+#else /* _WIN32 */
+    struct iovec msg_buf_struct = {
+        sock->recv_bufs,
+        sock->recv_buf_size
+    };
+    struct msghdr msg = {
+        &message->from,
+        sizeof(message->from),
+        &msg_buf_struct,
+        1,
+        sock->control_bufs,
+        CONTROL_BUFFER_SIZE,
+        0
+    };
+    size_t msg_len;
+#endif /* !_WIN32 */
+    int error;
+
+#ifdef _WIN32
+    error = WSARecvMsg(sock->fd, &msg, &msg_len, NULL, NULL);
+#else
+    error = (int)recvmsg(sock->fd, &msg, 0);
+#endif
+    sock->stats.receive_calls++;
+    sock->stats.receive_syscalls++;
+    if (error < 0) {
+        if (would_block()) {
+            sock->stats.empty_receives++;
+            return 0;
+        }
+        psockerror("recvmsg");
+        return -1;
+    }
+    sock->stats.packets_received++;
+
+#ifndef _WIN32
+    msg_len = error;
+#endif
+
+    parse_message(sock, message, sock->recv_bufs, msg_len, &msg);
+    count = 1;
+#endif /* !HAVE_MMSG */
+
+    *messages = sock->messages;
+    return count;
+}
+
+void icmp_socket_release(struct icmp_socket *sock)
+{
+#ifdef HAVE_IO_URING
+    struct icmp_uring *uring = sock->uring;
+    if (uring != NULL && uring->num_used_bufs > 0) {
+        size_t i;
+        for (i = 0; i < uring->num_used_bufs; i++) {
+            uring_buf_ring_add(&uring->bufs, uring->used_bufs[i]);
+        }
+        uring_buf_ring_commit(&uring->bufs);
+        uring->num_used_bufs = 0;
+    }
+#endif
+#ifdef HAVE_PACKET_RING
+    if (sock->ring != NULL) {
+        packet_ring_release(sock->ring);
+    }
+#endif
+    (void)sock;
+}
+
+void icmp_socket_read_tx_timestamps(struct icmp_socket *sock,
+                                    tx_timestamp_handler handler,
+                                    void *arg)
+{
+#ifdef HAVE_TX_TIMESTAMPS
+    if ((sock->timestamping & TIMESTAMPS_TX) == 0) {
+        return;
+    }
+
+    for (;;) {
+        char control_buf[CONTROL_BUFFER_SIZE];
+        char data_buf[64];
+        struct iovec iov = {
+            data_buf,
+            sizeof(data_buf)
+        };
+        struct msghdr msg = {0};
+        struct cmsghdr *cmsg;
+        uint64_t kernel_time = 0;
+        uint32_t key = 0;
+        int have_key = 0;
+        struct tx_key *tx_key;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control_buf;
+        msg.msg_controllen = sizeof(control_buf);
+
+        sock->stats.timestamp_reads++;
+        if (recvmsg(sock->fd, &msg, MSG_ERRQUEUE) < 0) {
+            return;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level == IPPROTO_IP
+                 && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == IPPROTO_IPV6
+                    && cmsg->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG
+                    && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    key = err.ee_data;
+                    have_key = 1;
+                }
+            } else if (kernel_time == 0) {
+                kernel_time = cmsg_timestamp(cmsg);
+            }
+        }
+        if (!have_key || kernel_time == 0) {
+            continue;
+        }
+
+        tx_key = &sock->tx_keys[key % TX_KEY_RING_SIZE];
+        if (tx_key->owner == NULL || tx_key->key != key) {
+            continue;
+        }
+        handler(tx_key->owner, tx_key->seq, kernel_time, arg);
+        tx_key->owner = NULL;
+    }
+#else
+    (void)sock;
+    (void)handler;
+    (void)arg;
+#endif
+}
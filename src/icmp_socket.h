@@ -0,0 +1,266 @@
+#ifndef ICMP_SOCKET_H
+#define ICMP_SOCKET_H
+
+#include "platform.h"
+
+#if defined __linux__ || (defined __FreeBSD__ && __FreeBSD__ >= 11)
+    #define HAVE_MMSG /* sendmmsg() and recvmmsg() */
+#endif
+
+#if defined __linux__
+    #define HAVE_PING_SOCKETS /* unprivileged SOCK_DGRAM ICMP sockets */
+#endif
+
+#if defined _WIN32 || !defined HAVE_MMSG
+    #define ICMP_SOCKET_BATCH_SIZE 1
+#else
+    #define ICMP_SOCKET_BATCH_SIZE 64
+#endif
+
+#define ICMP_HEADER_LENGTH 8
+
+#define TX_KEY_RING_SIZE 4096
+
+#define ICMP_SOCKET_RAW 0x01            /* don't try a ping socket first */
+#define ICMP_SOCKET_LARGE_BUFFERS 0x02  /* expect a lot of traffic */
+#define ICMP_SOCKET_URING 0x04          /* use io_uring if available */
+#define ICMP_SOCKET_PACKET_RING 0x08    /* receive from a packet ring */
+#define ICMP_SOCKET_NO_TX_TIMESTAMPS 0x10 /* only timestamp what arrives */
+
+#define TIMESTAMPS_RX 0x01
+#define TIMESTAMPS_TX 0x02
+
+/*
+ * Identifies the request that a packet sent through the socket belongs to.
+ * The socket doesn't care what the owner is, it's only handed back to the
+ * caller along with the transmit timestamp.
+ */
+struct tx_key {
+    void *owner;
+    uint32_t key;
+    uint16_t seq;
+};
+
+/*
+ * A request waiting in the send queue.
+ */
+struct queued_request {
+    void *owner;
+    const struct sockaddr_storage *addr;
+    socklen_t addr_len;
+    uint16_t seq;
+    size_t size;             /* bytes to send */
+};
+
+/*
+ * A message read from the socket.
+ */
+struct icmp_message {
+    char *data;              /* points to the ICMP header or NULL */
+    size_t len;              /* length of the ICMP message */
+    size_t header_len;       /* IP header right before data, if included */
+    struct sockaddr_storage from;
+    struct in6_addr dst;     /* IPv6 only: where the packet was sent to */
+    uint64_t kernel_time;    /* wall clock time of arrival, 0 if unknown */
+};
+
+/*
+ * How many packets were handled by how many system calls. With io_uring or
+ * a packet ring a batch of replies is read from memory, so only some of
+ * the receive calls make system calls.
+ */
+struct icmp_socket_stats {
+    unsigned long send_calls;
+    unsigned long packets_sent;
+    unsigned long receive_calls; /* batches read */
+    unsigned long receive_syscalls; /* recvmmsg() or recvmsg(), or
+                                       io_uring_enter() to rearm */
+    unsigned long packets_received;
+    unsigned long empty_receives;
+    unsigned long too_big;   /* dropped for exceeding the (path) MTU */
+    unsigned long timestamp_reads; /* from the error queue, empty or not */
+};
+
+struct icmp_uring;
+struct packet_ring;
+
+/*
+ * An ICMP or ICMPv6 socket.
+ *
+ * Where possible this is a "ping socket" (SOCK_DGRAM): it can be opened
+ * without special privileges and only receives replies to our own requests,
+ * as the kernel demultiplexes them by ICMP ID. The kernel also chooses that
+ * ID (id below) and fills in the checksum of outgoing packets. Otherwise
+ * it's a raw socket, which gets a copy of every ICMP packet on the host.
+ *
+ * Outgoing packets are queued and sent in batches with sendmmsg(), incoming
+ * ones are read in batches with recvmmsg() into buffers preallocated when
+ * the socket is opened. Where these calls are not available batches consist
+ * of a single packet.
+ *
+ * The kernel tags transmit timestamps with a counter of packets sent through
+ * the socket, which is used as an index into tx_keys to find out what
+ * request they belong to.
+ *
+ * On Linux, io_uring can be used instead (ICMP_SOCKET_URING). A multishot
+ * receive stays posted and the kernel fills buffers from a registered ring
+ * as packets arrive, so reading them takes no system calls at all. Each
+ * batch of sends is one submission. Transmit timestamps are not available
+ * in this mode, since they would have to be read from the error queue with
+ * a system call per packet.
+ *
+ * Alternatively, raw sockets can read replies from a memory-mapped AF_PACKET
+ * ring (ICMP_SOCKET_PACKET_RING), still sending through the socket itself.
+ * The kernel delivers replies in blocks of thousands, each timestamped as
+ * it arrived, and they are parsed where they lie instead of being copied
+ * into our buffers. The kernel filter moves to the packet socket and the
+ * ICMP socket stops receiving anything.
+ */
+struct icmp_socket {
+    socket_t fd;
+    int family;
+    int type;                /* SOCK_DGRAM or SOCK_RAW */
+    uint16_t id;             /* ICMP ID assigned to a SOCK_DGRAM socket */
+    int timestamping;
+    uint32_t next_tx_key;
+    struct tx_key *tx_keys;
+    size_t packet_size;
+    size_t send_size;        /* bytes sent per request, <= packet_size */
+    char *send_bufs;
+    struct queued_request *queue;
+    size_t num_queued;
+    char *recv_bufs;
+    size_t recv_buf_size;
+    char *control_bufs;
+    struct icmp_message *messages;
+#ifdef HAVE_MMSG
+    struct mmsghdr *send_msgs;
+    struct iovec *send_iovs;
+    struct mmsghdr *recv_msgs;
+    struct iovec *recv_iovs;
+#endif
+    struct icmp_uring *uring; /* NULL unless io_uring is used */
+    struct packet_ring *ring; /* NULL unless replies come from a ring */
+    struct icmp_socket_stats stats;
+};
+
+typedef void (*tx_timestamp_handler)(void *owner,
+                                     uint16_t seq,
+                                     uint64_t kernel_time,
+                                     void *arg);
+
+/**
+ * Opens a non-blocking ICMP socket for the address family, trying a ping
+ * socket first unless ICMP_SOCKET_RAW is set in flags, and allocates buffers
+ * for packets of packet_size bytes. Every send buffer is initialized with
+ * a copy of the template packet. If ICMP_SOCKET_URING or
+ * ICMP_SOCKET_PACKET_RING is set (not both) but can't be used, the socket
+ * silently falls back to the usual system calls. A packet ring requires
+ * ICMP_SOCKET_RAW.
+ * Returns 0 on success or -1 on error.
+ */
+int icmp_socket_open(struct icmp_socket *sock,
+                     int family,
+                     const char *template_packet,
+                     size_t packet_size,
+                     int flags);
+
+void icmp_socket_close(struct icmp_socket *sock);
+
+/**
+ * Returns the descriptor to wait on for incoming messages: the socket
+ * itself or, with io_uring or a packet ring, the ring that receives them.
+ */
+socket_t icmp_socket_poll_fd(const struct icmp_socket *sock);
+
+/**
+ * Makes the kernel drop everything except echo replies with an ID in the
+ * range [first_id, first_id + num_ids) before it reaches a raw socket: by
+ * ICMP type where supported and, on Linux, by ID with a BPF program. Does
+ * nothing for ping sockets. With a packet ring the filter is attached to
+ * the ring instead; num_ids 0 means all IDs. Returns -1 if no filter
+ * could be installed, which only costs time since replies are checked
+ * again on receipt.
+ */
+int icmp_socket_set_filter(struct icmp_socket *sock,
+                           uint16_t first_id,
+                           uint16_t num_ids);
+
+/**
+ * Makes a raw socket drop everything except echo requests, for answering
+ * them. Returns -1 if no filter could be installed.
+ */
+int icmp_socket_set_request_filter(struct icmp_socket *sock);
+
+/**
+ * Makes a raw socket send whole IP packets, IP header included, rather
+ * than just ICMP messages. Checksums are then up to the caller, except
+ * that of the IPv4 header. Returns -1 if this is not supported.
+ */
+int icmp_socket_include_header(struct icmp_socket *sock);
+
+/**
+ * Changes how many bytes of each send buffer go out from now on, at most
+ * the packet_size the socket was opened with.
+ */
+void icmp_socket_set_send_size(struct icmp_socket *sock, size_t size);
+
+/**
+ * Sets the Don't Fragment bit on outgoing packets (or, for IPv6, stops the
+ * kernel from fragmenting them), so that requests larger than the path MTU
+ * are dropped instead of fragmented. On Linux the kernel also refuses to
+ * send requests larger than the path MTU that it knows about, and they are
+ * counted in stats.too_big. Returns -1 if this is not supported.
+ */
+int icmp_socket_set_dont_fragment(struct icmp_socket *sock);
+
+/**
+ * Adds a request to the send queue and returns a buffer of packet_size bytes
+ * for the caller to fill in. If the queue is full it's flushed first.
+ * Returns NULL on error.
+ */
+char *icmp_socket_queue(struct icmp_socket *sock,
+                        void *owner,
+                        uint16_t seq,
+                        const struct sockaddr_storage *addr,
+                        socklen_t addr_len);
+
+/**
+ * Changes how many bytes of the request queued last are sent, for callers
+ * whose packets vary in size. At most packet_size; 0 takes the request off
+ * the queue.
+ */
+void icmp_socket_trim(struct icmp_socket *sock, size_t size);
+
+/**
+ * Sends all queued requests. Requests that couldn't be sent because the
+ * send buffer is full or because they are too large are dropped. Returns
+ * -1 on any other error.
+ */
+int icmp_socket_flush(struct icmp_socket *sock);
+
+/**
+ * Reads a batch of messages from the socket. On success returns the number
+ * of messages, 0 if there is nothing to read, and points messages to them.
+ * Messages that are too short to contain an ICMP header have data set to
+ * NULL. The messages are valid until the next call. Returns -1 on error.
+ */
+int icmp_socket_receive(struct icmp_socket *sock,
+                        struct icmp_message **messages);
+
+/**
+ * Tells the socket that the messages returned by the last call to
+ * icmp_socket_receive() are no longer needed, so that buffers shared with
+ * the kernel can be given back right away rather than on the next call.
+ */
+void icmp_socket_release(struct icmp_socket *sock);
+
+/**
+ * Reads transmit timestamps from the socket's error queue and passes them
+ * to the handler.
+ */
+void icmp_socket_read_tx_timestamps(struct icmp_socket *sock,
+                                    tx_timestamp_handler handler,
+                                    void *arg);
+
+#endif /* ICMP_SOCKET_H */
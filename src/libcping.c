@@ -0,0 +1,179 @@
+#include "libcping.h"
+#include "platform.h"
+#include "prober.h"
+#include "resolver.h"
+
+/*
+ * Lookups of names added one by one rarely pile up.
+ */
+#define RESOLVER_THREADS 4
+
+struct cping {
+    struct prober prober;
+    struct resolver *resolver;
+    cping_callback callback;
+    void *arg;
+};
+
+void cping_config_init(struct cping_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->ip_version = IP_VERSION_ANY;
+    config->payload_size = ICMP_PAYLOAD_SIZE;
+    config->interval = REQUEST_INTERVAL;
+    config->timeout = REQUEST_TIMEOUT;
+}
+
+static void handle_event(const struct probe_event *event, void *arg)
+{
+    struct cping *cping = arg;
+    struct cping_event cping_event;
+
+    memset(&cping_event, 0, sizeof(cping_event));
+    switch (event->type) {
+        case PROBE_EVENT_REPLY:
+            cping_event.type = CPING_REPLY;
+            cping_event.rtt = event->rtt;
+            break;
+        case PROBE_EVENT_TIMEOUT:
+            cping_event.type = CPING_TIMEOUT;
+            break;
+        case PROBE_EVENT_RESOLVE:
+            cping_event.type = CPING_RESOLVED;
+            break;
+        case PROBE_EVENT_LATE:
+            cping_event.type = CPING_LATE;
+            cping_event.rtt = event->rtt;
+            break;
+        case PROBE_EVENT_DUPLICATE:
+            cping_event.type = CPING_DUPLICATE;
+            cping_event.rtt = event->rtt;
+            break;
+        default:
+            return;
+    }
+    cping_event.target = (int)event->target->index;
+    cping_event.name = event->target->name;
+    cping_event.addr = event->target->addr_str;
+    cping_event.seq = event->seq;
+    cping_event.user_data = event->target->user_data;
+    cping->callback(&cping_event, cping->arg);
+}
+
+struct cping *cping_create(const struct cping_config *config,
+                           cping_callback callback,
+                           void *arg)
+{
+    struct prober_config prober_config;
+    struct cping *cping;
+
+    if (config->interval == 0) {
+        fprintf(stderr, "The interval must be greater than 0\n");
+        return NULL;
+    }
+
+    cping = calloc(1, sizeof(*cping));
+    if (cping == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    cping->callback = callback;
+    cping->arg = arg;
+
+    memset(&prober_config, 0, sizeof(prober_config));
+    prober_config.ip_version = config->ip_version;
+    prober_config.payload_size = config->payload_size;
+    prober_config.interval = config->interval;
+    prober_config.timeout = config->timeout;
+    prober_config.min_timeout = config->min_timeout;
+    prober_config.raw_sockets = config->raw_sockets;
+    prober_config.dns_ttl = config->dns_ttl;
+    if (prober_init(&cping->prober, &prober_config) != 0) {
+        free(cping);
+        return NULL;
+    }
+
+    cping->resolver = resolver_create(RESOLVER_THREADS, config->dns_ttl);
+    if (cping->resolver == NULL) {
+        goto error;
+    }
+    cping->prober.resolver = cping->resolver;
+
+    /*
+     * Without any targets yet, this only sizes the window. The sockets are
+     * opened as targets are added.
+     */
+    if (prober_open_sockets(&cping->prober) != 0
+        || prober_start(&cping->prober) != 0) {
+        goto error;
+    }
+
+    return cping;
+
+error:
+    cping_destroy(cping);
+    return NULL;
+}
+
+int cping_add(struct cping *cping, const char *host, void *user_data)
+{
+    struct probe_target *target;
+
+    target = prober_add_target(&cping->prober, host);
+    if (target == NULL) {
+        return -1;
+    }
+    target->user_data = user_data;
+
+    /*
+     * The schedule has changed, have the caller come back to it.
+     */
+    evloop_wake(&cping->prober.loop);
+
+    return (int)target->index;
+}
+
+int cping_remove(struct cping *cping, int target)
+{
+    if (target < 0
+        || (size_t)target >= cping->prober.num_targets
+        || cping->prober.targets[target]->resolve_state == TARGET_REMOVED) {
+        return -1;
+    }
+    prober_remove_target(&cping->prober, cping->prober.targets[target]);
+    return 0;
+}
+
+int cping_fd(const struct cping *cping)
+{
+    return evloop_fd(&cping->prober.loop);
+}
+
+int cping_process(struct cping *cping)
+{
+    return prober_poll(&cping->prober, 0, handle_event, cping) < 0 ? -1 : 0;
+}
+
+int cping_run(struct cping *cping)
+{
+    int result = 0;
+
+    while (!cping->prober.stopped && result == 0) {
+        result = prober_poll(&cping->prober, 1, handle_event, cping);
+    }
+    return result < 0 ? -1 : 0;
+}
+
+void cping_stop(struct cping *cping)
+{
+    prober_stop(&cping->prober);
+}
+
+void cping_destroy(struct cping *cping)
+{
+    prober_destroy(&cping->prober);
+    if (cping->resolver != NULL) {
+        resolver_destroy(cping->resolver);
+    }
+    free(cping);
+}
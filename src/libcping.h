@@ -0,0 +1,107 @@
+#ifndef LIBCPING_H
+#define LIBCPING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The probing engine of cping as a library, for applications that want to
+ * ping hosts from their own event loop: targets are added and removed at
+ * any time, and replies and timeouts are delivered to a callback from
+ * cping_process(), which is to be called whenever cping_fd() is readable.
+ *
+ * A cping instance must only be used from one thread at a time, except for
+ * cping_stop(). Errors are reported to stderr, like the command line tool
+ * does.
+ */
+struct cping;
+
+struct cping_config {
+    int ip_version;          /* 4, 6 or 0 for any */
+    size_t payload_size;     /* bytes after the ICMP header */
+    uint64_t interval;       /* between two requests to the same target,
+                                in nanoseconds */
+    uint64_t timeout;        /* for each request, in nanoseconds */
+    uint64_t min_timeout;    /* if not 0, adapt the timeout to each
+                                target's RTTs between this and timeout */
+    int raw_sockets;         /* don't use unprivileged ping sockets */
+    uint64_t dns_ttl;        /* look host names up again this often, 0 =
+                                never */
+};
+
+#define CPING_REPLY 1
+#define CPING_TIMEOUT 2
+#define CPING_RESOLVED 3 /* the target's name resolved to a (new) address */
+#define CPING_LATE 4     /* a reply after the request timed out */
+#define CPING_DUPLICATE 5 /* another reply to the same request */
+
+struct cping_event {
+    int type;
+    int target;              /* as returned by cping_add() */
+    const char *name;        /* as passed to cping_add() */
+    const char *addr;        /* empty until the name is resolved */
+    uint16_t seq;
+    uint64_t rtt;            /* of a reply, late or not, in nanoseconds */
+    void *user_data;         /* as passed to cping_add() */
+};
+
+typedef void (*cping_callback)(const struct cping_event *event, void *arg);
+
+/**
+ * Fills in the defaults: any IP version, a 32 byte payload and a request
+ * per second with a 1 second timeout.
+ */
+void cping_config_init(struct cping_config *config);
+
+/**
+ * Creates an instance without targets that reports its events to the
+ * callback. Returns NULL on error.
+ *
+ * Sockets are opened as targets need them, so with raw sockets, add a
+ * target of each address family before dropping privileges.
+ */
+struct cping *cping_create(const struct cping_config *config,
+                           cping_callback callback,
+                           void *arg);
+
+/**
+ * Starts pinging a host, given by address or by name. Names are resolved in
+ * the background. Returns a handle for the target, or -1 on error. The
+ * handles of removed targets are reused.
+ */
+int cping_add(struct cping *cping, const char *host, void *user_data);
+
+/**
+ * Stops pinging a target. Requests in flight to it are forgotten. Returns
+ * -1 if there is no such target.
+ */
+int cping_remove(struct cping *cping, int target);
+
+/**
+ * Returns a descriptor to poll for readability, after which cping_process()
+ * should be called. It's only available on Linux; elsewhere -1 is returned
+ * and cping_process() has to be called at least every millisecond or so.
+ */
+int cping_fd(const struct cping *cping);
+
+/**
+ * Sends the requests that are due and reports the replies, timeouts and
+ * lookups that have come in, without blocking. Returns -1 on error.
+ */
+int cping_process(struct cping *cping);
+
+/**
+ * Keeps processing until cping_stop() is called or there are no targets
+ * left. Returns -1 on error.
+ */
+int cping_run(struct cping *cping);
+
+/**
+ * Makes cping_run() return. Safe to call from a signal handler or another
+ * thread.
+ */
+void cping_stop(struct cping *cping);
+
+void cping_destroy(struct cping *cping);
+
+#endif /* LIBCPING_H */
@@ -0,0 +1,201 @@
+#include "metrics.h"
+
+#ifdef HAVE_METRICS
+
+#include <sys/mman.h>
+
+static struct metrics_record *record_at(struct metrics *metrics,
+                                        size_t index)
+{
+    return (struct metrics_record *)(metrics->map
+        + sizeof(struct metrics_header)
+        + index * sizeof(struct metrics_record));
+}
+
+/*
+ * Makes the counter odd before anything else in the record changes...
+ */
+static void begin_update(struct metrics_record *record)
+{
+    uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * ...and even again after everything has.
+ */
+static void end_update(struct metrics_record *record)
+{
+    uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static void copy_string(char *dst, const char *src, size_t size)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+int metrics_open(struct metrics *metrics,
+                 const char *path,
+                 const struct prober *prober)
+{
+    struct metrics_header *header;
+    char *temp_path;
+    int fd;
+    size_t i;
+
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->num_records = prober->num_targets;
+    metrics->map_size = sizeof(struct metrics_header)
+        + prober->num_targets * sizeof(struct metrics_record);
+
+    temp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (temp_path == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    strcpy(temp_path, path);
+    strcat(temp_path, ".tmp");
+
+    fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(temp_path);
+        goto error;
+    }
+    if (ftruncate(fd, (off_t)metrics->map_size) != 0) {
+        perror(temp_path);
+        goto error;
+    }
+    metrics->map = mmap(NULL,
+                        metrics->map_size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED,
+                        fd,
+                        0);
+    if (metrics->map == MAP_FAILED) {
+        perror("mmap");
+        metrics->map = NULL;
+        goto error;
+    }
+    close(fd);
+    fd = -1;
+
+    header = (struct metrics_header *)metrics->map;
+    memcpy(header->magic, METRICS_MAGIC, sizeof(header->magic));
+    header->version = METRICS_VERSION;
+    header->header_size = (uint32_t)sizeof(struct metrics_header);
+    header->record_size = (uint32_t)sizeof(struct metrics_record);
+    header->num_records = (uint32_t)prober->num_targets;
+    header->histogram_size = HISTOGRAM_SIZE;
+    header->histogram_sub_bits = HISTOGRAM_SUB_BITS;
+    header->start_time = wtime();
+    header->pid = (uint64_t)getpid();
+
+    for (i = 0; i < prober->num_targets; i++) {
+        const struct probe_target *target = prober->targets[i];
+        struct metrics_record *record = record_at(metrics, i);
+        record->state = (uint32_t)target->resolve_state;
+        copy_string(record->name, target->name, sizeof(record->name));
+        copy_string(record->addr, target->addr_str, sizeof(record->addr));
+    }
+
+    if (rename(temp_path, path) != 0) {
+        perror(path);
+        goto error;
+    }
+    free(temp_path);
+    return 0;
+
+error:
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(temp_path);
+    free(temp_path);
+    metrics_close(metrics);
+    return -1;
+}
+
+void metrics_update(struct metrics *metrics, const struct probe_event *event)
+{
+    const struct probe_target *target = event->target;
+    const struct rtt_stats *stats;
+    struct metrics_record *record;
+
+    if (target == NULL || target->index >= metrics->num_records) {
+        return;
+    }
+    stats = &target->stats;
+    record = record_at(metrics, target->index);
+
+    begin_update(record);
+
+    /*
+     * The histogram is only ever counted up here, so it has to start over
+     * along with the statistics, which prober_reset() clears at every
+     * step of a sweep. Either the first reply or a drop in the replies
+     * received tells.
+     */
+    if (stats->received < record->received
+        || (event->type == PROBE_EVENT_REPLY && stats->received == 1)) {
+        memset(record->histogram, 0, sizeof(record->histogram));
+    }
+    record->state = (uint32_t)target->resolve_state;
+    record->update_time = wtime();
+    record->sent = target->sent;
+    record->received = stats->received;
+    record->lost = stats->lost;
+    record->min = stats->min;
+    record->max = stats->max;
+    record->last = stats->last;
+    record->mean = stats->mean;
+    record->m2 = stats->m2;
+    record->jitter = stats->jitter;
+    record->late = stats->late;
+    record->late_max = stats->late_max;
+    record->duplicates = stats->duplicates;
+    record->reordered = stats->reordered;
+    record->max_reorder = stats->max_reorder;
+    if (event->type == PROBE_EVENT_REPLY) {
+        record->histogram[stats_bucket_index(event->rtt)]++;
+    } else if (event->type == PROBE_EVENT_RESOLVE) {
+        copy_string(record->addr, target->addr_str, sizeof(record->addr));
+    }
+    end_update(record);
+}
+
+void metrics_close(struct metrics *metrics)
+{
+    if (metrics->map != NULL) {
+        munmap(metrics->map, metrics->map_size);
+    }
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+#else /* HAVE_METRICS */
+
+int metrics_open(struct metrics *metrics,
+                 const char *path,
+                 const struct prober *prober)
+{
+    (void)path;
+    (void)prober;
+    memset(metrics, 0, sizeof(*metrics));
+    fprintf(stderr, "Metrics files are not supported on this platform\n");
+    return -1;
+}
+
+void metrics_update(struct metrics *metrics, const struct probe_event *event)
+{
+    (void)metrics;
+    (void)event;
+}
+
+void metrics_close(struct metrics *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+#endif /* !HAVE_METRICS */
@@ -0,0 +1,144 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "platform.h"
+#include "prober.h"
+#include "stats.h"
+
+/*
+ * The metrics file is written through a shared mapping, with atomics for
+ * the sequence counters.
+ */
+#if !defined _WIN32 && (defined __GNUC__ || defined __clang__)
+    #define HAVE_METRICS
+#endif
+
+/*
+ * The metrics file holds the latest statistics of every target, for other
+ * processes to map and read at any time without disturbing the prober. It
+ * starts with a header:
+ *
+ *     offset  size  field
+ *     0       8     "CPINGMET"
+ *     8       4     format version (2)
+ *     12      4     header size (64)
+ *     16      4     record size
+ *     20      4     number of records
+ *     24      4     number of histogram buckets (HISTOGRAM_SIZE)
+ *     28      4     HISTOGRAM_SUB_BITS
+ *     32      8     when cping started, ns since the Unix epoch
+ *     40      8     process ID
+ *     48      16    reserved
+ *
+ * followed by one record per target, in the order they were given, at
+ * header size + index * record size:
+ *
+ *     0       4     sequence counter, odd while the record is updated
+ *     4       4     TARGET_* resolve state
+ *     8       8     time of the last update, ns since the Unix epoch
+ *     16      8     requests sent
+ *     24      8     replies received
+ *     32      8     requests lost
+ *     40      8     minimum RTT in ns
+ *     48      8     maximum RTT in ns
+ *     56      8     last RTT in ns
+ *     64      8     mean RTT in ns (double)
+ *     72      8     sum of squared differences from the mean (double),
+ *                   the standard deviation is sqrt(this / replies)
+ *     80      8     jitter in ns (double)
+ *     88      8     late replies, to requests already counted as lost
+ *     96      8     maximum RTT of those in ns
+ *     104     8     duplicate replies
+ *     112     8     replies that came after those to newer requests
+ *     120     8     maximum reorder distance, in sequence numbers
+ *     128     256   name, NUL-terminated (truncated if need be)
+ *     384     48    address as text, empty until resolved
+ *     432     4 * number of buckets   histogram of the RTTs
+ *
+ * Integers and doubles are in the byte order of the host. Bucket i counts
+ * RTTs of exactly i ns if i < 2^HISTOGRAM_SUB_BITS, and otherwise those in
+ * [(2^HISTOGRAM_SUB_BITS + i % 2^HISTOGRAM_SUB_BITS) << s, ... + 1 << s)
+ * with s = i / 2^HISTOGRAM_SUB_BITS - 1. "sent" only changes along with
+ * the other fields, when a reply, timeout or lookup is handled. Version 1
+ * had no late, duplicate or reordered counts.
+ *
+ * Each record is updated in place under its sequence counter (a seqlock),
+ * so that writers never wait for readers. To read a record consistently:
+ * load the counter (with acquire semantics) and start over while it's odd,
+ * copy the record, issue a read barrier and load the counter again. If it
+ * changed, the copy may be torn, start over.
+ *
+ * The file is created under a temporary name and renamed into place once
+ * the header and names are written, and left behind with the final
+ * statistics when cping exits. A file in /dev/shm never touches the disk.
+ */
+#define METRICS_MAGIC "CPINGMET"
+#define METRICS_VERSION 2
+#define METRICS_NAME_SIZE 256
+#define METRICS_ADDR_SIZE 48
+
+struct metrics_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t num_records;
+    uint32_t histogram_size;
+    uint32_t histogram_sub_bits;
+    uint64_t start_time;
+    uint64_t pid;
+    uint8_t reserved[16];
+};
+
+struct metrics_record {
+    uint32_t seq;
+    uint32_t state;
+    uint64_t update_time;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t min;
+    uint64_t max;
+    uint64_t last;
+    double mean;
+    double m2;
+    double jitter;
+    uint64_t late;
+    uint64_t late_max;
+    uint64_t duplicates;
+    uint64_t reordered;
+    uint64_t max_reorder;
+    char name[METRICS_NAME_SIZE];
+    char addr[METRICS_ADDR_SIZE];
+    uint32_t histogram[HISTOGRAM_SIZE];
+};
+
+struct metrics {
+    char *map;
+    size_t map_size;
+    size_t num_records;
+};
+
+/**
+ * Creates the metrics file at path with a record for each of the prober's
+ * targets. Returns 0 on success or -1 on error, after reporting it to
+ * stderr.
+ */
+int metrics_open(struct metrics *metrics,
+                 const char *path,
+                 const struct prober *prober);
+
+/**
+ * Publishes the target's statistics after a reply (late and duplicate ones
+ * included), timeout or lookup. Each
+ * target must only be updated from one thread at a time, which is the case
+ * for the handlers of prober_run() and shards.
+ */
+void metrics_update(struct metrics *metrics, const struct probe_event *event);
+
+/**
+ * Unmaps the file, leaving it in place.
+ */
+void metrics_close(struct metrics *metrics);
+
+#endif /* METRICS_H */
@@ -0,0 +1,205 @@
+#include "output.h"
+
+#include <stdarg.h>
+
+#ifdef _WIN32
+    #include <io.h> /* _isatty() */
+    #define isatty _isatty
+    #define fileno _fileno
+#endif
+
+int output_init(struct output_buffer *out,
+                FILE *file,
+                size_t size,
+                int flush_policy,
+                uint64_t flush_interval)
+{
+    memset(out, 0, sizeof(*out));
+
+    /* One more byte for the terminating null of vsnprintf(). */
+    out->data = malloc(size + 1);
+    if (out->data == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    out->file = file;
+    out->size = size;
+    out->flush_policy = flush_policy;
+    out->flush_interval = flush_interval;
+    out->last_flush = ntime();
+
+    if (flush_policy == OUTPUT_FLUSH_AUTO) {
+        out->flush_policy = output_is_terminal(out)
+            ? OUTPUT_FLUSH_LINE
+            : OUTPUT_FLUSH_INTERVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes out the whole records and moves the unfinished one to the front.
+ */
+static void flush_records(struct output_buffer *out)
+{
+    size_t len = out->record_end;
+
+    out->last_flush = ntime();
+    if (len == 0) {
+        return;
+    }
+    fwrite(out->data, 1, len, out->file);
+    memmove(out->data, out->data + len, out->len - len);
+    out->len -= len;
+    out->record_end = 0;
+}
+
+/*
+ * Makes room for len more bytes if it can, splitting the unfinished record
+ * only if that's the only way.
+ */
+static void make_room(struct output_buffer *out, size_t len)
+{
+    if (out->size - out->len >= len) {
+        return;
+    }
+    flush_records(out);
+    if (out->size - out->len < len) {
+        output_flush(out);
+    }
+}
+
+char *output_reserve(struct output_buffer *out, size_t len)
+{
+    make_room(out, len);
+    if (out->size - out->len < len) {
+        return NULL;
+    }
+    return out->data + out->len;
+}
+
+void output_commit(struct output_buffer *out, size_t len)
+{
+    out->len += len;
+}
+
+void output_write(struct output_buffer *out, const void *data, size_t len)
+{
+    make_room(out, len);
+    if (out->size - out->len < len) {
+        fwrite(data, 1, len, out->file);
+        return;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+void output_printf(struct output_buffer *out, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(out->data + out->len,
+                    out->size - out->len + 1,
+                    format,
+                    args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+
+    if ((size_t)len > out->size - out->len) {
+        /* Didn't fit, try again with more room. */
+        make_room(out, (size_t)len);
+        va_start(args, format);
+        len = vsnprintf(out->data + out->len,
+                        out->size - out->len + 1,
+                        format,
+                        args);
+        va_end(args);
+        if (len < 0) {
+            return;
+        }
+        if ((size_t)len > out->size - out->len) {
+            len = (int)(out->size - out->len);
+        }
+    }
+    out->len += (size_t)len;
+    if (len > 0 && out->data[out->len - 1] == '\n') {
+        out->record_end = out->len;
+    }
+}
+
+void output_end_record(struct output_buffer *out)
+{
+    out->record_end = out->len;
+    switch (out->flush_policy) {
+        case OUTPUT_FLUSH_LINE:
+            output_flush(out);
+            break;
+        case OUTPUT_FLUSH_INTERVAL:
+            if (ntime() - out->last_flush >= out->flush_interval) {
+                output_flush(out);
+            }
+            break;
+    }
+}
+
+int output_flush(struct output_buffer *out)
+{
+    size_t len = out->len;
+
+    out->last_flush = ntime();
+    if (len == 0) {
+        return 0;
+    }
+    out->len = 0;
+    out->record_end = 0;
+    return fwrite(out->data, 1, len, out->file) < len ? -1 : 0;
+}
+
+int output_is_terminal(const struct output_buffer *out)
+{
+    return isatty(fileno(out->file));
+}
+
+void output_destroy(struct output_buffer *out)
+{
+    if (out->data != NULL) {
+        output_flush(out);
+        free(out->data);
+    }
+    memset(out, 0, sizeof(*out));
+}
+
+void timestamp_init(struct timestamp_cache *cache, const char *format)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->format = format;
+    cache->second = (time_t)-1;
+}
+
+const char *timestamp_format(struct timestamp_cache *cache,
+                             uint64_t time,
+                             size_t *len)
+{
+    time_t second = (time_t)(time / 1000000000);
+
+    if (second != cache->second) {
+        struct tm tm;
+        /* localtime() isn't thread-safe. */
+#ifdef _WIN32
+        int ok = localtime_s(&tm, &second) == 0;
+#else
+        int ok = localtime_r(&second, &tm) != NULL;
+#endif
+        cache->len = ok
+            ? strftime(cache->text, sizeof(cache->text), cache->format, &tm)
+            : 0;
+        cache->text[cache->len] = '\0';
+        cache->second = second;
+    }
+    *len = cache->len;
+    return cache->text;
+}
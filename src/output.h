@@ -0,0 +1,105 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "platform.h"
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+#define OUTPUT_FLUSH_AUTO -1    /* line if writing to a terminal, else
+                                   interval */
+#define OUTPUT_FLUSH_LINE 0     /* after every record */
+#define OUTPUT_FLUSH_FULL 1     /* only when the buffer is full */
+#define OUTPUT_FLUSH_INTERVAL 2 /* when the buffer is full or at the end of
+                                   a record if flush_interval has passed */
+
+/*
+ * Output is collected in a large buffer and handed to the stream in big
+ * chunks, so that writing many small records doesn't take a system call
+ * for each of them. The stream's own buffering should be turned off.
+ *
+ * Several buffers can write to the same stream from different threads:
+ * each flush is a single fwrite() call, and when the buffer runs full only
+ * the records that are complete are written out, the unfinished one is
+ * kept. A record ends with output_end_record() or a line written by
+ * output_printf(). Only a record larger than the buffer is split.
+ */
+struct output_buffer {
+    FILE *file;
+    char *data;
+    size_t size;
+    size_t len;
+    size_t record_end;       /* everything before it is whole records */
+    int flush_policy;
+    uint64_t flush_interval;
+    uint64_t last_flush;
+};
+
+/*
+ * The strftime() result for the current second. Most records are written
+ * in the same second as the previous one, so it rarely needs to be redone.
+ */
+struct timestamp_cache {
+    const char *format;
+    time_t second;
+    size_t len;
+    char text[128];
+};
+
+/**
+ * Sets up a buffer of the given size for writing to file.
+ */
+int output_init(struct output_buffer *out,
+                FILE *file,
+                size_t size,
+                int flush_policy,
+                uint64_t flush_interval);
+
+/**
+ * Returns a pointer to at least len free bytes at the end of the buffer,
+ * flushing it first if needed, or NULL if len is larger than the buffer.
+ * Call output_commit() once they have been filled in.
+ */
+char *output_reserve(struct output_buffer *out, size_t len);
+
+void output_commit(struct output_buffer *out, size_t len);
+
+void output_write(struct output_buffer *out, const void *data, size_t len);
+
+/**
+ * Like fprintf(). Output longer than the buffer is truncated. Output that
+ * ends with a newline ends the record.
+ */
+void output_printf(struct output_buffer *out, const char *format, ...);
+
+/**
+ * Marks the end of a record and flushes the buffer if the flush policy
+ * says so.
+ */
+void output_end_record(struct output_buffer *out);
+
+/**
+ * Writes out everything in the buffer, finished records or not.
+ */
+int output_flush(struct output_buffer *out);
+
+/**
+ * Returns 1 if the output goes to a terminal.
+ */
+int output_is_terminal(const struct output_buffer *out);
+
+/**
+ * Flushes and frees the buffer.
+ */
+void output_destroy(struct output_buffer *out);
+
+void timestamp_init(struct timestamp_cache *cache, const char *format);
+
+/**
+ * Returns the local time of a wall clock timestamp (in nanoseconds) as
+ * formatted by strftime(), and stores the length of the text in len.
+ */
+const char *timestamp_format(struct timestamp_cache *cache,
+                             uint64_t time,
+                             size_t *len);
+
+#endif /* OUTPUT_H */
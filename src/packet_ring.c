@@ -0,0 +1,168 @@
+#include "packet_ring.h"
+
+#ifdef HAVE_PACKET_RING
+
+#include <sys/mman.h>
+
+/*
+ * Block status words are shared with the kernel.
+ */
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#define RING_FRAME_SIZE 2048
+
+static struct tpacket_block_desc *block_desc(const struct packet_ring *ring,
+                                             unsigned long block)
+{
+    return (struct tpacket_block_desc *)(ring->map
+        + (block % ring->num_blocks) * ring->block_size);
+}
+
+int packet_ring_open(struct packet_ring *ring,
+                     uint16_t protocol,
+                     size_t block_size,
+                     unsigned int num_blocks,
+                     unsigned int retire_timeout_ms)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int opt_value;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->block_size = block_size;
+    ring->num_blocks = num_blocks;
+
+    /*
+     * Bind to the protocol only after the ring is set up, so that nothing
+     * is queued the old way in between.
+     */
+    ring->fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    opt_value = TPACKET_V3;
+    if (setsockopt(ring->fd,
+                   SOL_PACKET,
+                   PACKET_VERSION,
+                   &opt_value,
+                   sizeof(opt_value)) != 0) {
+        goto error;
+    }
+
+#ifdef PACKET_IGNORE_OUTGOING
+    /*
+     * Since Linux 4.20. Older kernels also capture what we send, which is
+     * left to the caller's filter.
+     */
+    opt_value = 1;
+    setsockopt(ring->fd,
+               SOL_PACKET,
+               PACKET_IGNORE_OUTGOING,
+               &opt_value,
+               sizeof(opt_value));
+#endif
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = (unsigned int)block_size;
+    req.tp_block_nr = num_blocks;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = (unsigned int)(block_size / RING_FRAME_SIZE)
+        * num_blocks;
+    req.tp_retire_blk_tov = retire_timeout_ms;
+    if (setsockopt(ring->fd,
+                   SOL_PACKET,
+                   PACKET_RX_RING,
+                   &req,
+                   sizeof(req)) != 0) {
+        goto error;
+    }
+
+    ring->map_size = block_size * num_blocks;
+    ring->map = mmap(NULL,
+                     ring->map_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     ring->fd,
+                     0);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        goto error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(protocol);
+    addr.sll_ifindex = 0;
+    if (bind(ring->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    packet_ring_close(ring);
+    return -1;
+}
+
+void packet_ring_close(struct packet_ring *ring)
+{
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct tpacket3_hdr *packet_ring_next(struct packet_ring *ring)
+{
+    struct tpacket3_hdr *packet;
+
+    while (!ring->reading) {
+        struct tpacket_block_desc *desc = block_desc(ring, ring->block);
+
+        /*
+         * Every block is either being read or waiting to be released.
+         */
+        if (ring->block - ring->head >= ring->num_blocks) {
+            return NULL;
+        }
+        if ((load_acquire(&desc->hdr.bh1.block_status) & TP_STATUS_USER)
+            == 0) {
+            return NULL;
+        }
+        if (desc->hdr.bh1.num_pkts == 0) {
+            ring->block++;
+            continue;
+        }
+        ring->reading = 1;
+        ring->num_left = desc->hdr.bh1.num_pkts;
+        ring->next = (struct tpacket3_hdr *)((char *)desc
+            + desc->hdr.bh1.offset_to_first_pkt);
+    }
+
+    packet = ring->next;
+    if (--ring->num_left == 0) {
+        ring->reading = 0;
+        ring->block++;
+    } else {
+        ring->next = (struct tpacket3_hdr *)((char *)packet
+            + packet->tp_next_offset);
+    }
+    return packet;
+}
+
+void packet_ring_release(struct packet_ring *ring)
+{
+    while (ring->head != ring->block) {
+        struct tpacket_block_desc *desc = block_desc(ring, ring->head);
+        store_release(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL);
+        ring->head++;
+    }
+}
+
+#endif /* HAVE_PACKET_RING */
@@ -0,0 +1,73 @@
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include "platform.h"
+
+/*
+ * HAVE_PACKET_RING is defined where the kernel can share received packets
+ * with us through a TPACKET_V3 ring (Linux 3.2 and later).
+ */
+#ifdef __linux__
+    #include <linux/if_packet.h>
+    #if defined TPACKET3_HDRLEN && defined PACKET_RX_RING
+        #define HAVE_PACKET_RING
+    #endif
+#endif
+
+#ifdef HAVE_PACKET_RING
+
+/*
+ * An AF_PACKET socket with a receive ring mapped into our memory.
+ *
+ * The ring is made of blocks that are owned either by the kernel, which
+ * fills them with packets, or by us. The kernel hands a block over once it's
+ * full or once it's been open for a while (the retire timeout), so a single
+ * poll() can cover thousands of packets. Packets are read where the kernel
+ * put them and stay valid until their block is given back with
+ * packet_ring_release().
+ */
+struct packet_ring {
+    int fd;
+    char *map;
+    size_t map_size;
+    size_t block_size;
+    unsigned int num_blocks;
+    unsigned long head;      /* oldest block not given back yet */
+    unsigned long block;     /* block being read; both count up forever */
+    int reading;             /* started reading the current block */
+    uint32_t num_left;       /* packets left in it */
+    struct tpacket3_hdr *next;
+};
+
+/**
+ * Opens a SOCK_DGRAM packet socket that receives packets of the given
+ * ethertype (e.g. ETH_P_IP) from all interfaces, starting at the network
+ * header, and maps a ring of num_blocks blocks of block_size bytes each.
+ * block_size must be a multiple of the page size. Packets that we send
+ * ourselves are not captured. Returns -1 and sets errno on error, e.g.
+ * without CAP_NET_RAW.
+ */
+int packet_ring_open(struct packet_ring *ring,
+                     uint16_t protocol,
+                     size_t block_size,
+                     unsigned int num_blocks,
+                     unsigned int retire_timeout_ms);
+
+void packet_ring_close(struct packet_ring *ring);
+
+/**
+ * Returns the next packet in the ring, or NULL if the kernel hasn't handed
+ * over any more. Its network header is at tp_net bytes from the start, and
+ * tp_sec and tp_nsec tell when it was received by the kernel.
+ */
+struct tpacket3_hdr *packet_ring_next(struct packet_ring *ring);
+
+/**
+ * Gives the blocks that have been read completely back to the kernel. The
+ * packets in them must not be used after this.
+ */
+void packet_ring_release(struct packet_ring *ring);
+
+#endif /* HAVE_PACKET_RING */
+
+#endif /* PACKET_RING_H */
@@ -1,350 +1,519 @@
-#ifndef _GNU_SOURCE
-    #define _GNU_SOURCE /* for additional type definitions */
-#endif
-
-#ifndef _WIN32_WINNT
-    #define _WIN32_WINNT 0x0601 /* for inet_XtoY functions on MinGW */
-#endif
+#include "platform.h"
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
 #include <getopt.h>
-
-#ifdef _WIN32
-
-#include <process.h>  /* _getpid() */
-#include <winsock2.h>
-#include <ws2tcpip.h> /* getaddrinfo() */
-#include <mswsock.h>  /* WSARecvMsg() */
-
-#undef CMSG_SPACE
-#define CMSG_SPACE WSA_CMSG_SPACE
-#undef CMSG_FIRSTHDR
-#define CMSG_FIRSTHDR WSA_CMSG_FIRSTHDR
-#undef CMSG_NXTHDR
-#define CMSG_NXTHDR WSA_CMSG_NXTHDR
-#undef CMSG_DATA
-#define CMSG_DATA WSA_CMSG_DATA
-
-typedef SOCKET socket_t;
-typedef WSAMSG msghdr_t;
-typedef WSACMSGHDR cmsghdr_t;
-
-/*
- * Pointer to the WSARecvMsg() function. It must be obtained at runtime...
- */
-static LPFN_WSARECVMSG WSARecvMsg;
-
-#else /* _WIN32 */
-
-#ifdef __APPLE__
-    #define __APPLE_USE_RFC_3542 /* for IPv6 definitions on Apple platforms */
-#endif
-
-#include <errno.h>
-#include <fcntl.h>            /* fcntl() */
-#include <netdb.h>            /* getaddrinfo() */
-#include <stdint.h>
-#include <unistd.h>
-#include <arpa/inet.h>        /* inet_XtoY() */
-#include <netinet/in.h>       /* IPPROTO_ICMP */
-#include <netinet/in_systm.h>
-#include <netinet/ip.h>
-#include <netinet/ip_icmp.h>  /* struct icmp */
-//#include <netinet/icmp6.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-
+#include <signal.h>
+
+#include "metrics.h"
+#include "prober.h"
+#include "reflector.h"
+#include "report.h"
+#include "shard.h"
+#include "sweep.h"
 #include "cping.h"
 
-typedef int socket_t;
-typedef struct msghdr msghdr_t;
-typedef struct cmsghdr cmsghdr_t;
-
-#endif /* !_WIN32 */
+#define MAX_LINE_LENGTH 1024
+
+#define OPT_FLUSH 256
+#define OPT_IO 257
+#define OPT_DNS_TTL 258
+#define OPT_SWEEP 259
+#define OPT_REFLECT 260
+#define OPT_REFLECT_TIMESTAMPS 261
+#define OPT_METRICS_FILE 262
+#define OPT_MIN_TIMEOUT 263
+
+#define RESOLVER_THREADS 32
+#define DNS_TTL 300 /* seconds */
+#define SWEEP_STEP 64
+#define SWEEP_COUNT 5
+#define MAX_PAYLOAD_SIZE 65507 /* the most that fits into an IPv4 packet */
+
+static struct prober prober;
+static struct shard_set shards;
+static struct resolver *resolver;
+static struct reflector reflector;
+static struct metrics metrics;
+static int all_addresses;
 
-#define IP_VERSION_ANY 0
-#define IP_V4 4
-#define IP_V6 6
+void help(char **argv){
+    //printf("Usage: %s [-4] [-6] [-n num] [-l size] [-S srcaddr] [-t[format]] hostname\n", argv[0]);
+    printf("Usage: %s [-4] [-6] [-A] [-q] [-P period] [-r] [-F] [-T threads] [-n num] [-i interval] [-R rate] [-l size] [-W timeout] [--min-timeout seconds] [-w window] [-t[format]] [-o format] [--flush when] [--io backend] [--dns-ttl seconds] [--sweep min:max[:step]] [--reflect raw|tun:name [--reflect-timestamps]] [--metrics-file path] [-f file] hostname...\n", argv[0]);
+    printf("\t [-n num]     Number of echo requests to send (without this option, it will ping continue)\n");
+    printf("\t [-i interval]     Time between requests to the same host, in seconds (default: 1)\n");
+    printf("\t [-R rate]     Send this many requests per second in total, spread over all hosts\n");
+    printf("\t [-F]     Flood: send the next request as soon as a reply comes back\n");
+    printf("\t [-l size]     Send buffer size\n");
+    printf("\t [-W timeout]     Time to wait for a reply, in seconds (default: 1)\n");
+    printf("\t [--min-timeout seconds]     Adapt the time to wait for a reply to each host's round-trip times (smoothed RTT plus 4 times its variation, as in RFC 6298), but not below this; -W is then the most it waits\n");
+    printf("\t [-w window]     Maximum number of requests in flight to each host (default: enough to cover the timeout)\n");
+    printf("\t [-f file]     Read the list of targets from a file ('-' for stdin), one per line\n");
+    printf("\t [-q]     Quiet, only print the summary for each target\n");
+    printf("\t [-P period]     Print the summary every period seconds as well as at the end\n");
+    printf("\t [-T threads]     Split the targets between this many threads, each with its own sockets (0: one per CPU, default: 1)\n");
+    printf("\t [-r]     Always use raw sockets, even where unprivileged ping sockets are available\n");
+    //printf("\t [-S srcaddr]     Source address to use\n");
+    printf("\t [-A]     Ping every IPv4 and IPv6 address that each hostname resolves to and compare them\n");
+    printf("\t [-4]     Force using IPv4\n");
+    printf("\t [-6]     Force using IPv6\n");
+    printf("\t [-t]     show timestemp, default format: '%%Y%%m%%d_%%H:%%M:%%S'\n");
+    printf("\t [-o format]     Output format: human (default), json, csv or binary\n");
+    printf("\t [--flush when]     Write output out after every line ('line'), only when the buffer is full ('full') or every so many seconds (default: 'line' on a terminal, 1 otherwise)\n");
+    printf("\t [--io backend]     How to send and receive: 'syscall' (default), 'uring' to batch through io_uring where the kernel supports it, or 'packet' to read replies from a packet ring (implies -r)\n");
+    printf("\t [--sweep min:max[:step]]     Ping a single host with payload sizes from min to max (default step: %d) with the Don't Fragment bit set, -n requests per size (default: %d), then search for the path MTU and estimate the time per byte\n", SWEEP_STEP, SWEEP_COUNT);
+    printf("\t [--dns-ttl seconds]     Look host names up again this often (default: %d, 0: never)\n", DNS_TTL);
+    printf("\t [--reflect raw|tun:name]     Instead of pinging, answer echo requests from raw sockets (-4/-6 to pick one family; the kernel should be told to ignore them) or on an existing TUN device\n");
+    printf("\t [--reflect-timestamps]     When answering, put the time the request arrived and the reply left into the payload, so that ping can tell the delays of both directions apart\n");
+    printf("\t [--metrics-file path]     Keep the latest statistics of every host in a memory-mapped file that other programs can read at any time (format in src/metrics.h)\n");
+}
 
-#define ICMP_HEADER_LENGTH 8
-#define MESSAGE_BUFFER_SIZE 1024
-#define ICMP_PAYLOAD_SIZE 32  // Define the size of the ICMP payload buffer
+static void handle_interrupt(int signum)
+{
+    (void)signum;
+    prober_stop(&prober);
+    shards_stop(&shards);
+}
 
-#ifndef ICMP_ECHO
-    #define ICMP_ECHO 8
-#endif
-#ifndef ICMP_ECHO6
-    #define ICMP6_ECHO 128
-#endif
-#ifndef ICMP_ECHO_REPLY
-    #define ICMP_ECHO_REPLY 0
-#endif
-#ifndef ICMP_ECHO_REPLY6
-    #define ICMP6_ECHO_REPLY 129
-#endif
+#ifdef SIGUSR1
 
-#define REQUEST_TIMEOUT 1000000  //microsecond, us => 1sec
-#define REQUEST_INTERVAL 1000000  //microsecond, us => 1sec
+static void handle_stats_request(int signum)
+{
+    (void)signum;
+    prober_request_stats(&prober);
+    shards_request_stats(&shards);
+}
 
-#ifdef _WIN32
-    #define socket(af, type, protocol) \
-        WSASocketW(af, type, protocol, NULL, 0, 0)
-    #define close_socket closesocket
-    #define getpid _getpid
-    #define usleep(usec) Sleep((DWORD)((usec) / 1000))
-#else
-    #define close_socket close
 #endif
 
-#pragma pack(push, 1)
-
-#if defined _WIN32 || defined __CYGWIN__
+static void handle_reflector_interrupt(int signum)
+{
+    (void)signum;
+    reflector_stop(&reflector);
+}
 
-#if defined _MSC_VER || defined __MINGW32__
-    typedef unsigned __int8 uint8_t;
-    typedef unsigned __int16 uint16_t;
-    typedef unsigned __int32 uint32_t;
-    typedef unsigned __int64 uint64_t;
-    #ifndef EAI_SYSTEM
-        #define EAI_SYSTEM	  -11
-    #endif
+/*
+ * As opening raw sockets usually requires superuser privileges, we should
+ * drop them as soon as possible for security reasons. Ping sockets don't
+ * need them at all.
+ */
+static int drop_privileges(void)
+{
+#if !defined _WIN32
+    /* Note: group ID must be set before user ID! */
+    if (setgid(getgid()) != 0) {
+        perror("setgid");
+        return -1;
+    }
+    if (setuid(getuid()) != 0) {
+        perror("setuid");
+        return -1;
+    }
 #endif
+    return 0;
+}
 
-struct icmp {
-    uint8_t icmp_type;
-    uint8_t icmp_code;
-    uint16_t icmp_cksum;
-    uint16_t icmp_id;
-    uint16_t icmp_seq;
-};
+/*
+ * Answers echo requests until interrupted.
+ */
+static int run_reflector(const struct reflector_config *config)
+{
+    int result;
 
-#endif /* _WIN32 || __CYGWIN__ */
+    if (reflector_init(&reflector, config) != 0) {
+        return -1;
+    }
+    if (drop_privileges() != 0) {
+        reflector_destroy(&reflector);
+        return -1;
+    }
 
-struct ip6_pseudo_hdr {
-    struct in6_addr src;
-    struct in6_addr dst;
-    uint8_t unused1[2];
-    uint16_t plen;
-    uint8_t unused2[3];
-    uint8_t nxt;
-};
+    signal(SIGINT, handle_reflector_interrupt);
+    signal(SIGTERM, handle_reflector_interrupt);
 
-struct icmp6_packet {
-    struct ip6_pseudo_hdr ip6_hdr;
-    struct icmp icmp;
-};
+    if (config->tun_name != NULL) {
+        printf("Answering echo requests on %s\n", config->tun_name);
+    } else {
+        printf("Answering echo requests on raw sockets\n");
+    }
+    fflush(stdout);
 
-#pragma pack(pop)
+    result = reflector_run(&reflector);
 
-#ifdef _WIN32
+    printf("%lu packets received, %lu echo requests answered\n",
+           reflector.stats.received,
+           reflector.stats.replied);
+    reflector_destroy(&reflector);
+    return result;
+}
 
-/**
- * psockerror() is like perror() but for the Windows Sockets API.
+/*
+ * Returns non-zero if at least one of the targets has an address.
  */
-static void psockerror(const char *s)
+static int any_resolved(void)
 {
-    char *message = NULL;
-    DWORD format_flags = FORMAT_MESSAGE_FROM_SYSTEM
-        | FORMAT_MESSAGE_IGNORE_INSERTS
-        | FORMAT_MESSAGE_ALLOCATE_BUFFER
-        | FORMAT_MESSAGE_MAX_WIDTH_MASK;
-    DWORD result;
-
-    result = FormatMessageA(format_flags,
-                            NULL,
-                            WSAGetLastError(),
-                            0,
-                            (char *)&message,
-                            0,
-                            NULL);
-    if (result > 0) {
-        fprintf(stderr, "%s: %s\n", s, message);
-        LocalFree(message);
-    } else {
-        fprintf(stderr, "%s: Unknown error\n", s);
+    size_t i;
+
+    for (i = 0; i < prober.num_targets; i++) {
+        if (prober.targets[i]->resolve_state == TARGET_RESOLVED) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-#else /* _WIN32 */
-
-#define psockerror perror
-
-#endif /* !_WIN32 */
+static void report_step(const struct sweep *sweep,
+                        const struct sweep_step *step,
+                        void *arg)
+{
+    report_sweep_step(arg, sweep, step);
+}
 
-/**
- * Returns a timestamp with microsecond resolution.
+/*
+ * Pings the only target with a range of payload sizes. Fails if none of
+ * them got through.
  */
-static uint64_t utime(void)
+static int run_sweep(struct report *report,
+                     const struct sweep_config *config)
 {
-#ifdef _WIN32
-    LARGE_INTEGER count;
-    LARGE_INTEGER frequency;
-    if (QueryPerformanceCounter(&count) == 0
-        || QueryPerformanceFrequency(&frequency) == 0) {
-        return 0;
+    struct sweep sweep;
+    int result;
+
+    result = sweep_run(&sweep,
+                       config,
+                       &prober,
+                       report_event,
+                       report_step,
+                       report);
+    if (result == 0) {
+        report_sweep_result(report, &sweep);
+        if (!sweep.passed) {
+            result = -1;
+        }
     }
-    return count.QuadPart * 1000000 / frequency.QuadPart;
-#else
-    struct timeval now;
-    return gettimeofday(&now, NULL) != 0
-        ? 0
-        : now.tv_sec * 1000000 + now.tv_usec;
-#endif
+    sweep_destroy(&sweep);
+    return result;
 }
 
-#ifdef _WIN32
-
-static void init_winsock_lib(void)
+/*
+ * Runs the shards, each of them reporting through its own copy of the
+ * report.
+ */
+static int run_shards(const struct report *report)
 {
-    int error;
-    WSADATA wsa_data;
+    struct report *reports;
+    size_t num_reports = 0;
+    int result = -1;
+
+    reports = calloc(shards.count, sizeof(*reports));
+    if (reports == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (; num_reports < shards.count; num_reports++) {
+        if (report_clone(&reports[num_reports],
+                         report,
+                         &shards.shards[num_reports].prober) != 0) {
+            goto cleanup;
+        }
+        shards_set_handler(&shards,
+                           num_reports,
+                           report_event,
+                           &reports[num_reports]);
+    }
+
+    result = shards_run(&shards);
 
-    error = WSAStartup(MAKEWORD(2, 2), &wsa_data);
-    if (error != 0) {
-        fprintf(stderr, "Failed to initialize WinSock: %d\n", error);
-        exit(EXIT_FAILURE);
+cleanup:
+    while (num_reports > 0) {
+        report_destroy(&reports[--num_reports]);
     }
+    free(reports);
+    return result;
 }
 
-static void init_winsock_extensions(socket_t sockfd)
+static void add_target(const char *name)
 {
-    int error;
-    GUID recvmsg_id = WSAID_WSARECVMSG;
-    DWORD size;
-
-    /*
-     * Obtain a pointer to the WSARecvMsg (recvmsg) function.
-     */
-    error = WSAIoctl(sockfd,
-                     SIO_GET_EXTENSION_FUNCTION_POINTER,
-                     &recvmsg_id,
-                     sizeof(recvmsg_id),
-                     &WSARecvMsg,
-                     sizeof(WSARecvMsg),
-                     &size,
-                     NULL,
-                     NULL);
-    if (error == SOCKET_ERROR) {
-        psockerror("WSAIoctl");
-        exit(EXIT_FAILURE);
+    if (all_addresses) {
+        prober_add_all_addresses(&prober, name);
+    } else {
+        prober_add_target(&prober, name);
     }
 }
 
-#endif /* _WIN32 */
-
-static uint16_t compute_checksum(const char *buf, size_t size)
+/*
+ * Adds every non-empty line of the file as a target. Lines starting with '#'
+ * are ignored.
+ */
+static int add_targets_from_file(const char *path)
 {
-    /* RFC 1071 - http://tools.ietf.org/html/rfc1071 */
-
-    size_t i;
-    uint64_t sum = 0;
+    FILE *file;
+    char line[MAX_LINE_LENGTH];
 
-    for (i = 0; i < size; i += 2) {
-        sum += *(uint16_t *)buf;
-        buf += 2;
+    if (strcmp(path, "-") == 0) {
+        file = stdin;
+    } else {
+        file = fopen(path, "r");
+        if (file == NULL) {
+            perror(path);
+            return -1;
+        }
     }
-    if (size - i > 0)
-        sum += *(uint8_t *)buf;
 
-    while ((sum >> 16) != 0)
-        sum = (sum & 0xffff) + (sum >> 16);
-
-    return (uint16_t)~sum;
-}
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *name = line;
+        size_t len;
 
-void current_time(char *timestempformat) {
-    time_t rawtime;
-    struct tm *timeinfo;
-    char buffer[80];
+        while (*name == ' ' || *name == '\t') {
+            name++;
+        }
+        len = strlen(name);
+        while (len > 0 && (name[len - 1] == '\n'
+                           || name[len - 1] == '\r'
+                           || name[len - 1] == ' '
+                           || name[len - 1] == '\t')) {
+            name[--len] = '\0';
+        }
+        if (len == 0 || name[0] == '#') {
+            continue;
+        }
+        add_target(name);
+    }
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    if (file != stdin) {
+        fclose(file);
+    }
 
-    strftime(buffer, sizeof(buffer), "%Y%m%d_%H:%M:%S ", timeinfo);
-    //strftime(buffer, sizeof(buffer), &timestempformat, timeinfo);
-    printf("%s", buffer);
-}
-
-void help(char **argv){
-    //printf("Usage: %s [-4] [-6] [-n num] [-l size] [-S srcaddr] [-t[format]] hostname\n", argv[0]);
-    printf("Usage: %s [-4] [-6] [-n num] [-l size] [-t[format]] hostname\n", argv[0]);
-    printf("\t [-n num]     Number of echo requests to send (without this option, it will ping continue)\n");
-    printf("\t [-l size]     Send buffer size\n");
-    //printf("\t [-S srcaddr]     Source address to use\n");
-    printf("\t [-4]     Force using IPv4\n");
-    printf("\t [-6]     Force using IPv6\n");
-    printf("\t [-t]     show timestemp, default format: '%%Y%%m%%d_%%H:%%M:%%S'\n");
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-    int i;
-    char *hostname = NULL;
     // char *srcaddr = NULL;
-    int ip_version = IP_VERSION_ANY;
-    // Allocate space for the ICMP payload buffer
-    // char icmp_payload[ICMP_PAYLOAD_SIZE];
-    int icmp_payload_size=ICMP_PAYLOAD_SIZE;
-    int showtimestemp = 0;
-    char *timestempformat = NULL;
-    int error;
-    socket_t sockfd = -1;
-    struct addrinfo *addrinfo_list = NULL;
-    struct addrinfo *addrinfo;
-    char addr_str[INET6_ADDRSTRLEN] = "<unknown>";
-    struct sockaddr_storage addr;
-    socklen_t dst_addr_len;
-    uint16_t id = (uint16_t)getpid();
-    uint16_t seq;
-    uint64_t start_time;
-    uint64_t delay;
+    struct prober_config config = {0};
+    struct report report;
+    int format = REPORT_HUMAN;
+    int flush_policy = OUTPUT_FLUSH_AUTO;
+    uint64_t flush_interval = 1000000000;
+    char *timestamp_format = NULL;
+    int quiet = 0;
+    int num_threads = 1;
+    char *target_file = NULL;
+    int num_names = 0;
+    struct sweep_config sweep_config = {0};
+    int sweep = 0;
+    struct reflector_config reflector_config = {0};
+    int reflect = 0;
+    char *metrics_path = NULL;
+    char *min_timeout = NULL;
     int opt;
-    int max_num=0; // number of echo request
-    
+
     static struct option long_options[] = {
-        {"num", no_argument, 0, 'n'},
-        {"size", no_argument, 0, 'l'},
+        {"num", required_argument, 0, 'n'},
+        {"size", required_argument, 0, 'l'},
+        {"interval", required_argument, 0, 'i'},
+        {"rate", required_argument, 0, 'R'},
+        {"flood", no_argument, 0, 'F'},
         //{"srcaddr", no_argument, 0, 'S'},
         {"ipv4", no_argument, 0, '4'},
         {"ipv6", no_argument, 0, '6'},
+        {"all-addresses", no_argument, 0, 'A'},
+        {"timeout", required_argument, 0, 'W'},
+        {"window", required_argument, 0, 'w'},
+        {"file", required_argument, 0, 'f'},
+        {"quiet", no_argument, 0, 'q'},
+        {"period", required_argument, 0, 'P'},
+        {"format", required_argument, 0, 'o'},
+        {"threads", required_argument, 0, 'T'},
+        {"flush", required_argument, 0, OPT_FLUSH},
+        {"io", required_argument, 0, OPT_IO},
+        {"dns-ttl", required_argument, 0, OPT_DNS_TTL},
+        {"sweep", required_argument, 0, OPT_SWEEP},
+        {"reflect", required_argument, 0, OPT_REFLECT},
+        {"reflect-timestamps", no_argument, 0, OPT_REFLECT_TIMESTAMPS},
+        {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
+        {"min-timeout", required_argument, 0, OPT_MIN_TIMEOUT},
+        {"raw", no_argument, 0, 'r'},
         {"hostname", required_argument, 0, 'h'},
         {"timestemp", required_argument, 0, 't'},
         {"version", required_argument, 0, 'v'},
         {0, 0, 0, 0}
     };
 
+    config.ip_version = IP_VERSION_ANY;
+    config.payload_size = ICMP_PAYLOAD_SIZE;
+    config.interval = REQUEST_INTERVAL;
+    config.timeout = REQUEST_TIMEOUT;
+    config.count = 0;
+    config.dns_ttl = (uint64_t)DNS_TTL * 1000000000;
+
 // Parse command-line options
     //while ((opt = getopt(argc, argv, "46ht::")) != -1) {
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "vn:l:46ht::", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vn:l:i:R:FW:w:f:qP:o:T:r46Aht::", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'n': //num of echo request
-                max_num = atoi(optarg);
+                config.count = (unsigned long)atol(optarg);
                 break;
-            case 'l':
-                icmp_payload_size = atoi(optarg);
+            case 'l': {
+                char *end;
+                long size = strtol(optarg, &end, 10);
+                if (end == optarg
+                    || *end != '\0'
+                    || size < 0
+                    || size > MAX_PAYLOAD_SIZE) {
+                    fprintf(stderr, "Invalid payload size: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                config.payload_size = (size_t)size;
                 break;
+            }
             // case 'S':
             //     srcaddr = optarg;
             //     printf("srcaddr : %s\n",  srcaddr);
             //     break;
+            case 'i': {
+                double ns = atof(optarg) * 1000000000.0;
+                if (!(ns >= 1.0) || ns >= 18446744073709551616.0) {
+                    fprintf(stderr, "Invalid interval: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                config.interval = (uint64_t)ns;
+                break;
+            }
+            case 'R':
+                config.rate = (uint64_t)atof(optarg);
+                if (config.rate == 0) {
+                    fprintf(stderr, "Invalid rate: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'F':
+                config.flood = 1;
+                break;
+            case 'W': {
+                double ns = atof(optarg) * 1000000000.0;
+                if (!(ns >= 1.0) || ns >= 18446744073709551616.0) {
+                    fprintf(stderr, "Invalid timeout: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                config.timeout = (uint64_t)ns;
+                break;
+            }
+            case OPT_MIN_TIMEOUT:
+                /* checked against -W once all options are known */
+                min_timeout = optarg;
+                break;
+            case 'w':
+                config.window = (unsigned int)atoi(optarg);
+                break;
+            case 'f':
+                target_file = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'P':
+                config.tick_interval =
+                    (uint64_t)(atof(optarg) * 1000000000.0);
+                if (config.tick_interval == 0) {
+                    fprintf(stderr, "Invalid period: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                format = report_parse_format(optarg);
+                if (format < 0) {
+                    fprintf(stderr, "Invalid output format: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'T':
+                num_threads = atoi(optarg);
+                if (num_threads < 0) {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                if (num_threads == 0) {
+                    num_threads = shard_cpu_count();
+                }
+                break;
+            case OPT_FLUSH:
+                if (strcmp(optarg, "line") == 0) {
+                    flush_policy = OUTPUT_FLUSH_LINE;
+                } else if (strcmp(optarg, "full") == 0) {
+                    flush_policy = OUTPUT_FLUSH_FULL;
+                } else {
+                    flush_policy = OUTPUT_FLUSH_INTERVAL;
+                    flush_interval = (uint64_t)(atof(optarg) * 1000000000.0);
+                    if (flush_interval == 0) {
+                        fprintf(stderr, "Invalid flush policy: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case OPT_IO:
+                config.io_uring = strcmp(optarg, "uring") == 0;
+                config.packet_ring = strcmp(optarg, "packet") == 0;
+                if (!config.io_uring
+                    && !config.packet_ring
+                    && strcmp(optarg, "syscall") != 0) {
+                    fprintf(stderr, "Invalid I/O backend: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_DNS_TTL:
+                config.dns_ttl = (uint64_t)(atof(optarg) * 1000000000.0);
+                break;
+            case OPT_SWEEP: {
+                unsigned long min_size = 0;
+                unsigned long max_size = 0;
+                unsigned long step = SWEEP_STEP;
+                if (sscanf(optarg, "%lu:%lu:%lu", &min_size, &max_size, &step)
+                        < 2
+                    || min_size > max_size
+                    || max_size > MAX_PAYLOAD_SIZE
+                    || step == 0) {
+                    fprintf(stderr, "Invalid sweep range: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                sweep_config.min_size = min_size;
+                sweep_config.max_size = max_size;
+                sweep_config.step = step;
+                sweep = 1;
+                break;
+            }
+            case OPT_REFLECT:
+                if (strncmp(optarg, "tun:", 4) == 0 && optarg[4] != '\0') {
+                    reflector_config.tun_name = optarg + 4;
+                } else if (strcmp(optarg, "raw") != 0) {
+                    fprintf(stderr, "Invalid reflector: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                reflect = 1;
+                break;
+            case OPT_REFLECT_TIMESTAMPS:
+                reflector_config.timestamps = 1;
+                break;
+            case OPT_METRICS_FILE:
+                metrics_path = optarg;
+                break;
+            case 'r':
+                config.raw_sockets = 1;
+                break;
             case 't':
-                showtimestemp=1;
-                timestempformat = optarg;
-                if (timestempformat== NULL){
+                timestamp_format = optarg;
+                if (timestamp_format == NULL) {
                     //# default format
-                    timestempformat="%Y-%m-%d_%H:%M:%S";
+                    timestamp_format = "%Y%m%d_%H:%M:%S";
                 }
                 break;
             case '4':
-                ip_version = IP_V4;
+                config.ip_version = IP_V4;
                 break;
             case '6':
-                ip_version = IP_V6;
+                config.ip_version = IP_V6;
+                break;
+            case 'A':
+                all_addresses = 1;
                 break;
             case 'h':
                 // Print usage information
@@ -361,454 +530,164 @@ int main(int argc, char **argv)
                 help(argv);
         }
     }
-    // Process non-option arguments
-    for (; optind < argc; optind++) {
-        // Assuming only one hostname argument is expected
-        if (hostname == NULL) {
-            hostname = argv[optind];
-        } else {
-            fprintf(stderr, "Error: Only one hostname argument is expected.\n");
-            return 1;
+
+    if (min_timeout != NULL) {
+        double ns = atof(min_timeout) * 1000000000.0;
+        if (!(ns >= 1.0) || ns >= (double)config.timeout) {
+            fprintf(stderr, "Invalid minimum timeout: %s\n", min_timeout);
+            return EXIT_FAILURE;
         }
+        config.min_timeout = (uint64_t)ns;
     }
 
-    if (hostname == NULL) {
+    if (reflect) {
+        reflector_config.family = config.ip_version == IP_V4
+            ? AF_INET
+            : config.ip_version == IP_V6 ? AF_INET6 : AF_UNSPEC;
+        return run_reflector(&reflector_config) == 0
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE;
+    }
+
+    num_names = argc - optind;
+    if (num_names == 0 && target_file == NULL) {
         help(argv);
-        goto exit_error;
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * The buffers are made for the largest payload and the sweep sends only
+     * part of them.
+     */
+    if (sweep) {
+        sweep_config.count = config.count > 0 ? config.count : SWEEP_COUNT;
+        config.payload_size = sweep_config.max_size;
+        config.dont_fragment = 1;
+        num_threads = 1;
     }
 
 #ifdef _WIN32
     init_winsock_lib();
 #endif
 
-    if (ip_version == IP_V4 || ip_version == IP_VERSION_ANY) {
-        struct addrinfo hints = {0};
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_RAW;
-        hints.ai_protocol = IPPROTO_ICMP;
-        error = getaddrinfo(hostname,
-                            NULL,
-                            &hints,
-                            &addrinfo_list);
+    if (report_init(&report,
+                    format,
+                    timestamp_format,
+                    flush_policy,
+                    flush_interval) != 0) {
+        return EXIT_FAILURE;
     }
-    if (ip_version == IP_V6
-        || (ip_version == IP_VERSION_ANY && error != 0)) {
-        struct addrinfo hints = {0};
-        hints.ai_family = AF_INET6;
-        hints.ai_socktype = SOCK_RAW;
-        hints.ai_protocol = IPPROTO_ICMPV6;
-        error = getaddrinfo(hostname,
-                            NULL,
-                            &hints,
-                            &addrinfo_list);
+    report.quiet = quiet;
+
+    if (prober_init(&prober, &config) != 0) {
+        report_destroy(&report);
+        return EXIT_FAILURE;
     }
-    if (error != 0) {
-        if (error == EAI_SYSTEM){
-            fprintf(stderr, "getaddrinfo: %s\n", strerror(errno));
-        }else{
-            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(error));
-        }
+
+    /*
+     * Host names are looked up in the background, so that we can start
+     * pinging the ones that resolve quickly while the rest are pending.
+     */
+    resolver = resolver_create(RESOLVER_THREADS, config.dns_ttl);
+    if (resolver == NULL) {
         goto exit_error;
     }
+    if (!sweep) {
+        prober.resolver = resolver;
+    }
 
-    for (addrinfo = addrinfo_list;
-        addrinfo != NULL;
-        addrinfo = addrinfo->ai_next) {
-        sockfd = socket(addrinfo->ai_family,
-                        addrinfo->ai_socktype,
-                        addrinfo->ai_protocol);
-        if (sockfd >= 0) {
-            break;
-        }
+    // Process non-option arguments
+    for (; optind < argc; optind++) {
+        add_target(argv[optind]);
     }
-    if ((int)sockfd < 0) {
-        psockerror("socket");
+    if (target_file != NULL && add_targets_from_file(target_file) != 0) {
         goto exit_error;
     }
-    // char icmp_payload[icmp_payload_size];
-    // Allocate space for the ICMP payload buffer
-    char *icmp_payload = (char *)malloc(icmp_payload_size);
-    // Fill the ICMP payload buffer with some data (if needed)
-    // For example, you might fill it with zeros or some specific data
-    memset(icmp_payload, 255, icmp_payload_size);
-
-    memcpy(&addr, addrinfo->ai_addr, addrinfo->ai_addrlen);
-    dst_addr_len = (socklen_t)addrinfo->ai_addrlen;
-
-    freeaddrinfo(addrinfo_list);
-    addrinfo = NULL;
-    addrinfo_list = NULL;
-
-#ifdef _WIN32
-    init_winsock_extensions(sockfd);
-#endif
-
-    /*
-     * Switch the socket to non-blocking I/O mode. This allows us to implement
-     * the timeout feature.
-     */
-#ifdef _WIN32
-    {
-        u_long opt_value = 1;
-        if (ioctlsocket(sockfd, FIONBIO, &opt_value) != 0) {
-            psockerror("ioctlsocket");
-            goto exit_error;
-        }
-    }
-#else /* _WIN32 */
-    if (fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1) {
-        psockerror("fcntl");
+    if (prober.num_targets == 0) {
         goto exit_error;
     }
-#endif /* !_WIN32 */
-
-    if (addr.ss_family == AF_INET6) {
-        /*
-         * This allows us to receive IPv6 packet headers in incoming messages.
-         */
-        int opt_value = 1;
-        error = setsockopt(sockfd,
-                           IPPROTO_IPV6,
-#if defined _WIN32 || defined __CYGWIN__
-                           IPV6_PKTINFO,
-#else
-                           IPV6_RECVPKTINFO,
-#endif
-                           (char *)&opt_value,
-                           sizeof(opt_value));
-        if (error != 0) {
-            psockerror("setsockopt");
-            goto exit_error;
-        }
+    if (sweep && prober.num_targets > 1) {
+        fprintf(stderr, "Only a single host can be swept\n");
+        goto exit_error;
     }
 
     /*
-     * As opening raw sockets usually requires superuser privileges, we should
-     * drop them as soon as possible for security reasons.
+     * With more than one target (or a list of them) we print the address of
+     * the target in every message.
      */
-#if !defined _WIN32
-    /* Note: group ID must be set before user ID! */
-    if (setgid(getgid() != 0)) {
-        perror("setgid");
+    report.multi_target = target_file != NULL
+        || num_names > 1
+        || prober.num_targets > 1;
+    report.compare_addresses = all_addresses;
+
+    if (num_threads > 1 && prober.num_targets > 1) {
+        if (shards_init(&shards, &prober, (size_t)num_threads) != 0) {
+            goto exit_error;
+        }
+    } else if (prober_open_sockets(&prober) != 0) {
         goto exit_error;
     }
-    if (setuid(getuid()) != 0) {
-        perror("setuid");
+
+    if (drop_privileges() != 0) {
         goto exit_error;
     }
-#endif
 
     /*
-     * Convert the destination IP-address to a string.
+     * Created only now, so that it belongs to the user.
      */
-    inet_ntop(addr.ss_family,
-              addr.ss_family == AF_INET6
-                  ? (void *)&((struct sockaddr_in6 *)&addr)->sin6_addr
-                  : (void *)&((struct sockaddr_in *)&addr)->sin_addr,
-              addr_str,
-              sizeof(addr_str));
-
-    printf("Pinging %s (%s)\n", hostname, addr_str);
-    fflush(stdout);
-    for (seq = 0; ; seq++) {
-        if (max_num>0){
-            if (seq>=max_num){
-                break;
-            }
-        }
-        
-        struct icmp request;
-
-        request.icmp_type =
-                addr.ss_family == AF_INET6 ? ICMP6_ECHO : ICMP_ECHO;
-        request.icmp_code = 0;
-        request.icmp_cksum = 0;
-        request.icmp_id = htons(id);
-        request.icmp_seq = htons(seq);
-#if !defined _WIN32
-    //TODO: mingw64 how to add payload?
-        // Copy the ICMP payload into the request packet
-        memcpy(request.icmp_data, icmp_payload, icmp_payload_size);
-#endif
-        
-    //    // Allocate space for the ICMP packet
-    //    unsigned long icmphdr_size;
-    //     if (addr.ss_family == AF_INET6) {
-    //         icmphdr_size = sizeof(struct icmp6_hdr);
-    //     } else{
-    //         icmphdr_size = sizeof(struct icmphdr);
-    //     }
-    //     char icmp_packet[icmp_payload_size + icmphdr_size];
-    //     if (addr.ss_family == AF_INET6) {
-    //         struct icmp6_hdr *request = (struct icmp6_hdr *)icmp_packet;
-    //         // Fill the ICMPv6 header
-    //         request->icmp6_type = ICMP6_ECHO;
-    //         request->icmp6_code = 0;
-    //         request->icmp6_cksum = 0;
-    //         request->icmp6_dataun.icmp6_un_data16[0] = htons(id);
-    //         request->icmp6_dataun.icmp6_un_data16[1] = htons(seq);
-    //     } else {
-    //         struct icmphdr *request = (struct icmphdr *)icmp_packet;
-    //         // Fill the ICMP header
-    //         request->type = ICMP_ECHO;
-    //         request->code = 0;
-    //         request->checksum = 0;
-    //         request->un.echo.id = htons(id);
-    //         request->un.echo.sequence = htons(seq);
-    //     }
-    //     // Fill the ICMP payload with some data (if needed)
-    //     // For example, you might fill it with zeros or some specific data
-    //     memset(icmp_packet + icmphdr_size, 0, icmp_payload_size);
-
-        if (addr.ss_family == AF_INET6) {
-            /*
-             * Checksum is calculated from the ICMPv6 packet prepended
-             * with an IPv6 "pseudo-header".
-             *
-             * https://tools.ietf.org/html/rfc2463#section-2.3
-             * https://tools.ietf.org/html/rfc2460#section-8.1
-             */
-            struct icmp6_packet request_packet = {0};
-
-            request_packet.ip6_hdr.src = in6addr_loopback;
-            request_packet.ip6_hdr.dst =
-                ((struct sockaddr_in6 *)&addr)->sin6_addr;
-            request_packet.ip6_hdr.plen = htons((uint16_t)ICMP_HEADER_LENGTH);
-            request_packet.ip6_hdr.nxt = IPPROTO_ICMPV6;
-            request_packet.icmp = request;
-
-            request.icmp_cksum = compute_checksum((char *)&request_packet,
-                                                   sizeof(request_packet));
-            // request->checksum = compute_checksum((char *)&request_packet,
-            //                                       sizeof(request_packet));                                                  
-        } else {
-            request.icmp_cksum = compute_checksum((char *)&request,
-                                                  sizeof(request)+ icmp_payload_size);
-            // request->checksum = compute_checksum((char *)&request,
-            //                                       sizeof(request)+ icmp_payload_size);
-        }
-        
-        // if (srcaddr != NULL) {
-        //     // Initialize sockaddr_in structure
-        //     int local_port = 12345; // Example port number
-        //     struct sockaddr_in local_addr;
-        //     memset(&local_addr, 0, sizeof(local_addr));
-        //     local_addr.sin_family = AF_INET;
-        //     local_addr.sin_addr.s_addr = inet_addr(srcaddr);
-        //     local_addr.sin_port = htons(local_port);
-        //     // Bind the socket to a specific local address (source address)
-        //     if (bind(sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
-        //         perror("bind");
-        //         // Error handling if binding fails
-        //         goto exit_error;
-        //     }
-        // }
-        error = (int)sendto(sockfd,
-                            (char *)&request,
-                            sizeof(request)+ icmp_payload_size,
-                            0,
-                            (struct sockaddr *)&addr,
-                            (int)dst_addr_len);
-        if (error < 0) {
-            psockerror("sendto");
+    if (metrics_path != NULL) {
+        if (metrics_open(&metrics, metrics_path, &prober) != 0) {
             goto exit_error;
         }
+        report.metrics = &metrics;
+    }
 
-        start_time = utime();
-
-        for (;;) {
-            char msg_buf[MESSAGE_BUFFER_SIZE];
-            char packet_info_buf[MESSAGE_BUFFER_SIZE];
-            struct in6_addr msg_addr = {0};
-#ifdef _WIN32
-            WSABUF msg_buf_struct = {
-                sizeof(msg_buf),
-                msg_buf
-            };
-            WSAMSG msg = {
-                NULL,
-                0,
-                &msg_buf_struct,
-                1,
-                {sizeof(packet_info_buf), packet_info_buf},
-                0
-            };
-            DWORD msg_len = 0;
-#else /* _WIN32 */
-            struct iovec msg_buf_struct = {
-                msg_buf,
-                sizeof(msg_buf)
-            };
-            struct msghdr msg = {
-                NULL,
-                0,
-                &msg_buf_struct,
-                1,
-                packet_info_buf,
-                sizeof(packet_info_buf),
-                0
-            };
-            size_t msg_len;
-#endif /* !_WIN32 */
-            cmsghdr_t *cmsg;
-            size_t ip_hdr_len;
-            struct icmp *reply;
-            int reply_id;
-            int reply_seq;
-            uint16_t reply_checksum;
-            uint16_t checksum;
-
-#ifdef _WIN32
-            error = WSARecvMsg(sockfd, &msg, &msg_len, NULL, NULL);
-#else
-            error = (int)recvmsg(sockfd, &msg, 0);
-#endif
-
-            delay = utime() - start_time;
-
-            if (error < 0) {
-#ifdef _WIN32
-                if (WSAGetLastError() == WSAEWOULDBLOCK) {
-#else
-                if (errno == EAGAIN) {
-#endif
-                    if (delay > REQUEST_TIMEOUT) {
-                        if (showtimestemp){
-                            current_time(timestempformat);
-                        }
-                        printf("Request timed out: seq=%d\n", seq);
-                        fflush(stdout);
-                        goto next;
-                    } else {
-                        /* No data available yet, try to receive again. */
-                        continue;
-                    }
-                } else {
-                    psockerror("recvmsg");
-                    goto next;
-                }
-            }
+    report_start(&report, &prober);
 
-#ifndef _WIN32
-            msg_len = error;
+    /*
+     * Output is buffered, so make sure that it gets written out when we are
+     * told to stop.
+     */
+    signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+#ifdef SIGUSR1
+    signal(SIGUSR1, handle_stats_request);
 #endif
 
-            if (addr.ss_family == AF_INET6) {
-                /*
-                 * The IP header is not included in the message, msg_buf points
-                 * directly to the ICMP data.
-                 */
-                ip_hdr_len = 0;
-
-                /*
-                 * Extract the destination address from IPv6 packet info. This
-                 * will be used to compute the checksum later.
-                 */
-                for (
-                    cmsg = CMSG_FIRSTHDR(&msg);
-                    cmsg != NULL;
-                    cmsg = CMSG_NXTHDR(&msg, cmsg))
-                {
-                    if (cmsg->cmsg_level == IPPROTO_IPV6
-                        && cmsg->cmsg_type == IPV6_PKTINFO) {
-                        struct in6_pktinfo *pktinfo = (void *)CMSG_DATA(cmsg);
-                        memcpy(&msg_addr,
-                               &pktinfo->ipi6_addr,
-                               sizeof(struct in6_addr));
-                    }
-                }
-            } else {
-                /*
-                 * For IPv4, we must take the length of the IP header into
-                 * account.
-                 *
-                 * Header length is stored in the lower 4 bits of the VHL field
-                 * (VHL = Version + Header Length).
-                 */
-                ip_hdr_len = ((*(uint8_t *)msg_buf) & 0x0F) * 4;
-            }
-
-            reply = (struct icmp *)(msg_buf + ip_hdr_len);
-            reply_id = ntohs(reply->icmp_id);
-            reply_seq = ntohs(reply->icmp_seq);
-
-            /*
-             * Verify that this is indeed an echo reply packet.
-             */
-            if (!(addr.ss_family == AF_INET
-                  && reply->icmp_type == ICMP_ECHO_REPLY)
-                && !(addr.ss_family == AF_INET6
-                     && reply->icmp_type == ICMP6_ECHO_REPLY)) {
-                continue;
-            }
-
-            /*
-             * Verify the ID and sequence number to make sure that the reply
-             * is associated with the current request.
-             */
-            if (reply_id != id || reply_seq != seq) {
-                continue;
-            }
-
-            reply_checksum = reply->icmp_cksum;
-            reply->icmp_cksum = 0;
-
-            /*
-             * Verify the checksum.
-             */
-            if (addr.ss_family == AF_INET6) {
-                size_t size = sizeof(struct ip6_pseudo_hdr) + msg_len;
-                struct icmp6_packet *reply_packet = calloc(1, size);
-
-                if (reply_packet == NULL) {
-                    psockerror("malloc");
-                    goto exit_error;
-                }
-
-                memcpy(&reply_packet->ip6_hdr.src,
-                       &((struct sockaddr_in6 *)&addr)->sin6_addr,
-                       sizeof(struct in6_addr));
-                reply_packet->ip6_hdr.dst = msg_addr;
-                reply_packet->ip6_hdr.plen = htons((uint16_t)msg_len);
-                reply_packet->ip6_hdr.nxt = IPPROTO_ICMPV6;
-                memcpy(&reply_packet->icmp,
-                       msg_buf + ip_hdr_len,
-                       msg_len - ip_hdr_len);
-
-                checksum = compute_checksum((char *)reply_packet, size);
-            } else {
-                checksum = compute_checksum(msg_buf + ip_hdr_len,
-                                            msg_len - ip_hdr_len);
-            }
-            if (showtimestemp){
-                current_time(timestempformat);
+    if (sweep) {
+        if (run_sweep(&report, &sweep_config) != 0) {
+            goto exit_error;
+        }
+    } else {
+        if (shards.count > 0) {
+            if (run_shards(&report) != 0) {
+                goto exit_error;
             }
-            printf("Reply from %s: seq=%d, time=%.3f ms%s\n",
-                   addr_str,
-                   seq,
-                   (double)delay / 1000.0,
-                   reply_checksum != checksum ? " (bad checksum)" : "");
-            fflush(stdout);
-            break;
+        } else if (prober_run(&prober, report_event, &report) != 0) {
+            goto exit_error;
         }
 
-next:
-        if (delay < REQUEST_INTERVAL) {
-            usleep(REQUEST_INTERVAL - delay);
+        report_summary(&report, 1);
+        if (!any_resolved()) {
+            goto exit_error;
         }
     }
 
-    close_socket(sockfd);
+    shards_destroy(&shards);
+    prober_destroy(&prober);
+    resolver_destroy(resolver);
+    metrics_close(&metrics);
+    report_destroy(&report);
 
     return EXIT_SUCCESS;
 
 exit_error:
 
-    if (addrinfo_list != NULL) {
-        freeaddrinfo(addrinfo_list);
-    }
-
-    close_socket(sockfd);
+    shards_destroy(&shards);
+    prober_destroy(&prober);
+    resolver_destroy(resolver);
+    metrics_close(&metrics);
+    report_destroy(&report);
 
     return EXIT_FAILURE;
 }
@@ -0,0 +1,122 @@
+#include "platform.h"
+
+#ifdef _WIN32
+
+/*
+ * Pointer to the WSARecvMsg() function. It must be obtained at runtime...
+ */
+LPFN_WSARECVMSG WSARecvMsg;
+
+/**
+ * psockerror() is like perror() but for the Windows Sockets API.
+ */
+void psockerror(const char *s)
+{
+    char *message = NULL;
+    DWORD format_flags = FORMAT_MESSAGE_FROM_SYSTEM
+        | FORMAT_MESSAGE_IGNORE_INSERTS
+        | FORMAT_MESSAGE_ALLOCATE_BUFFER
+        | FORMAT_MESSAGE_MAX_WIDTH_MASK;
+    DWORD result;
+
+    result = FormatMessageA(format_flags,
+                            NULL,
+                            WSAGetLastError(),
+                            0,
+                            (char *)&message,
+                            0,
+                            NULL);
+    if (result > 0) {
+        fprintf(stderr, "%s: %s\n", s, message);
+        LocalFree(message);
+    } else {
+        fprintf(stderr, "%s: Unknown error\n", s);
+    }
+}
+
+void init_winsock_lib(void)
+{
+    int error;
+    WSADATA wsa_data;
+
+    error = WSAStartup(MAKEWORD(2, 2), &wsa_data);
+    if (error != 0) {
+        fprintf(stderr, "Failed to initialize WinSock: %d\n", error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void init_winsock_extensions(socket_t sockfd)
+{
+    int error;
+    GUID recvmsg_id = WSAID_WSARECVMSG;
+    DWORD size;
+
+    /*
+     * Obtain a pointer to the WSARecvMsg (recvmsg) function.
+     */
+    error = WSAIoctl(sockfd,
+                     SIO_GET_EXTENSION_FUNCTION_POINTER,
+                     &recvmsg_id,
+                     sizeof(recvmsg_id),
+                     &WSARecvMsg,
+                     sizeof(WSARecvMsg),
+                     &size,
+                     NULL,
+                     NULL);
+    if (error == SOCKET_ERROR) {
+        psockerror("WSAIoctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif /* _WIN32 */
+
+uint64_t ntime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count;
+    LARGE_INTEGER frequency;
+    if (QueryPerformanceCounter(&count) == 0
+        || QueryPerformanceFrequency(&frequency) == 0) {
+        return 0;
+    }
+    /* Split the division to avoid overflowing 64 bits. */
+    return (uint64_t)(count.QuadPart / frequency.QuadPart) * 1000000000
+        + (uint64_t)(count.QuadPart % frequency.QuadPart) * 1000000000
+            / frequency.QuadPart;
+#elif defined CLOCK_MONOTONIC
+    struct timespec now;
+    return clock_gettime(CLOCK_MONOTONIC, &now) != 0
+        ? 0
+        : (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+    struct timeval now;
+    return gettimeofday(&now, NULL) != 0
+        ? 0
+        : (uint64_t)now.tv_sec * 1000000000 + now.tv_usec * 1000;
+#endif
+}
+
+uint64_t wtime(void)
+{
+#ifdef _WIN32
+    FILETIME now;
+    ULARGE_INTEGER ticks;
+    GetSystemTimeAsFileTime(&now);
+    ticks.LowPart = now.dwLowDateTime;
+    ticks.HighPart = now.dwHighDateTime;
+    /* 100 ns intervals since 1601-01-01. */
+    return (ticks.QuadPart - 116444736000000000) * 100;
+#elif defined CLOCK_REALTIME
+    struct timespec now;
+    return clock_gettime(CLOCK_REALTIME, &now) != 0
+        ? 0
+        : (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+    struct timeval now;
+    return gettimeofday(&now, NULL) != 0
+        ? 0
+        : (uint64_t)now.tv_sec * 1000000000 + now.tv_usec * 1000;
+#endif
+}
@@ -0,0 +1,112 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE /* for additional type definitions */
+#endif
+
+#ifndef _WIN32_WINNT
+    #define _WIN32_WINNT 0x0601 /* for inet_XtoY functions on MinGW */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+
+#include <process.h>  /* _getpid() */
+#include <winsock2.h>
+#include <ws2tcpip.h> /* getaddrinfo() */
+#include <mswsock.h>  /* WSARecvMsg() */
+
+#undef CMSG_SPACE
+#define CMSG_SPACE WSA_CMSG_SPACE
+#undef CMSG_FIRSTHDR
+#define CMSG_FIRSTHDR WSA_CMSG_FIRSTHDR
+#undef CMSG_NXTHDR
+#define CMSG_NXTHDR WSA_CMSG_NXTHDR
+#undef CMSG_DATA
+#define CMSG_DATA WSA_CMSG_DATA
+
+typedef SOCKET socket_t;
+typedef WSAMSG msghdr_t;
+typedef WSACMSGHDR cmsghdr_t;
+
+#else /* _WIN32 */
+
+#ifdef __APPLE__
+    #define __APPLE_USE_RFC_3542 /* for IPv6 definitions on Apple platforms */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>            /* fcntl() */
+#include <netdb.h>            /* getaddrinfo() */
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>        /* inet_XtoY() */
+#include <netinet/in.h>       /* IPPROTO_ICMP */
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>  /* struct icmp */
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+typedef int socket_t;
+typedef struct msghdr msghdr_t;
+typedef struct cmsghdr cmsghdr_t;
+
+#endif /* !_WIN32 */
+
+#ifdef _WIN32
+    #define socket(af, type, protocol) \
+        WSASocketW(af, type, protocol, NULL, 0, 0)
+    #define close_socket closesocket
+    #define getpid _getpid
+    #define usleep(usec) Sleep((DWORD)((usec) / 1000))
+#else
+    #define close_socket close
+#endif
+
+#if defined _MSC_VER || defined __MINGW32__
+    typedef unsigned __int8 uint8_t;
+    typedef unsigned __int16 uint16_t;
+    typedef unsigned __int32 uint32_t;
+    typedef unsigned __int64 uint64_t;
+    #ifndef EAI_SYSTEM
+        #define EAI_SYSTEM	  -11
+    #endif
+#endif
+
+#ifdef _WIN32
+
+extern LPFN_WSARECVMSG WSARecvMsg;
+
+/**
+ * psockerror() is like perror() but for the Windows Sockets API.
+ */
+void psockerror(const char *s);
+
+void init_winsock_lib(void);
+void init_winsock_extensions(socket_t sockfd);
+
+#else /* _WIN32 */
+
+#define psockerror perror
+
+#endif /* !_WIN32 */
+
+/**
+ * Returns a monotonic timestamp in nanoseconds. Unlike the wall clock it
+ * never jumps, e.g. when NTP adjusts the system time.
+ */
+uint64_t ntime(void);
+
+/**
+ * Returns the wall clock time in nanoseconds since the Unix epoch.
+ */
+uint64_t wtime(void);
+
+#endif /* PLATFORM_H */
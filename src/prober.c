@@ -0,0 +1,2239 @@
+#include "prober.h"
+#include "checksum.h"
+#include "reflector.h"
+
+/*
+ * Maximum number of requests sent in one go before checking for replies.
+ */
+#define MAX_SEND_BURST 256
+
+/*
+ * How many passes prober_poll() makes at most when it doesn't wait, so
+ * that it returns even while replies keep coming in.
+ */
+#define MAX_POLL_PASSES 16
+
+/*
+ * Kernel timestamps older than this are considered bogus.
+ */
+#define MAX_TIMESTAMP_AGE 10000000000ull
+
+/*
+ * How often to check for completed lookups where the event loop can't be
+ * woken up.
+ */
+#define RESOLVE_POLL_INTERVAL 10000000
+
+/*
+ * Large anycast and CDN names rarely return more than a handful.
+ */
+#define MAX_ADDRESSES_PER_NAME 64
+
+#ifndef ICMP_ECHO
+    #define ICMP_ECHO 8
+#endif
+#ifndef ICMP_ECHO6
+    #define ICMP6_ECHO 128
+#endif
+#ifndef ICMP_ECHO_REPLY
+    #define ICMP_ECHO_REPLY 0
+#endif
+#ifndef ICMP_ECHO_REPLY6
+    #define ICMP6_ECHO_REPLY 129
+#endif
+
+#pragma pack(push, 1)
+
+#if defined _WIN32 || defined __CYGWIN__
+
+struct icmp {
+    uint8_t icmp_type;
+    uint8_t icmp_code;
+    uint16_t icmp_cksum;
+    uint16_t icmp_id;
+    uint16_t icmp_seq;
+};
+
+#endif /* _WIN32 || __CYGWIN__ */
+
+struct ip6_pseudo_hdr {
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint8_t unused1[2];
+    uint16_t plen;
+    uint8_t unused2[3];
+    uint8_t nxt;
+};
+
+#pragma pack(pop)
+
+#ifndef _WIN32
+
+/*
+ * Kernel timestamps are taken from the wall clock, which may jump at any
+ * time. Convert them to our monotonic clock by looking at how long ago they
+ * were taken instead. Returns 0 if the timestamp doesn't make sense.
+ */
+static uint64_t kernel_time_to_mono(uint64_t kernel_time,
+                                    uint64_t mono_now,
+                                    uint64_t wall_now)
+{
+    uint64_t age;
+
+    if (kernel_time == 0 || kernel_time > wall_now) {
+        return 0;
+    }
+    age = wall_now - kernel_time;
+    if (age > MAX_TIMESTAMP_AGE || age > mono_now) {
+        return 0;
+    }
+    return mono_now - age;
+}
+
+#endif /* !_WIN32 */
+
+/*
+ * Uses the kernel's transmit timestamp as the send time of the request.
+ */
+static void handle_tx_timestamp(void *owner,
+                                uint16_t seq,
+                                uint64_t kernel_time,
+                                void *arg)
+{
+#ifndef _WIN32
+    struct probe_target *target = owner;
+    struct probe_slot *slot = &target->slots[seq & target->slot_mask];
+    uint64_t send_time;
+
+    (void)arg;
+
+    if (!slot->in_use || slot->seq != seq) {
+        return;
+    }
+    send_time = kernel_time_to_mono(kernel_time, ntime(), wtime());
+    if (send_time != 0
+        && send_time >= slot->send_time
+        && send_time - slot->send_time <= 0xffffffff) {
+        slot->tx_delay = (uint32_t)(send_time - slot->send_time);
+        slot->flags |= PROBE_FLAG_KERNEL_TX;
+    }
+#else
+    (void)owner;
+    (void)seq;
+    (void)kernel_time;
+    (void)arg;
+#endif
+}
+
+static const void *sockaddr_ip(const struct sockaddr_storage *addr)
+{
+    return addr->ss_family == AF_INET6
+        ? (const void *)&((const struct sockaddr_in6 *)addr)->sin6_addr
+        : (const void *)&((const struct sockaddr_in *)addr)->sin_addr;
+}
+
+static size_t sockaddr_ip_len(const struct sockaddr_storage *addr)
+{
+    return addr->ss_family == AF_INET6
+        ? sizeof(struct in6_addr)
+        : sizeof(struct in_addr);
+}
+
+/*
+ * Replies are matched to targets by ICMP ID and source address, so that is
+ * what we hash on (FNV-1a).
+ */
+static size_t target_hash(uint16_t id, const struct sockaddr_storage *addr)
+{
+    const uint8_t *ip = sockaddr_ip(addr);
+    size_t len = sockaddr_ip_len(addr);
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    hash = (hash ^ (id & 0xff)) * 16777619u;
+    hash = (hash ^ (id >> 8)) * 16777619u;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ ip[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int hash_insert(struct prober *prober, struct probe_target *target)
+{
+    size_t index;
+
+    if (prober->num_targets * 2 > prober->hash_size) {
+        size_t new_size = prober->hash_size > 0 ? prober->hash_size * 2 : 64;
+        struct probe_target **new_table;
+        size_t i;
+
+        new_table = calloc(new_size, sizeof(*new_table));
+        if (new_table == NULL) {
+            return -1;
+        }
+        for (i = 0; i < prober->hash_size; i++) {
+            struct probe_target *t = prober->hash_table[i];
+            while (t != NULL) {
+                struct probe_target *next = t->hash_next;
+                index = target_hash(t->id, &t->addr) & (new_size - 1);
+                t->hash_next = new_table[index];
+                new_table[index] = t;
+                t = next;
+            }
+        }
+        free(prober->hash_table);
+        prober->hash_table = new_table;
+        prober->hash_size = new_size;
+    }
+
+    index = target_hash(target->id, &target->addr) & (prober->hash_size - 1);
+    target->hash_next = prober->hash_table[index];
+    prober->hash_table[index] = target;
+
+    return 0;
+}
+
+static void hash_remove(struct prober *prober, struct probe_target *target)
+{
+    struct probe_target **link;
+
+    link = &prober->hash_table[target_hash(target->id, &target->addr)
+                               & (prober->hash_size - 1)];
+    while (*link != NULL) {
+        if (*link == target) {
+            *link = target->hash_next;
+            return;
+        }
+        link = &(*link)->hash_next;
+    }
+}
+
+/*
+ * Tells whether the slot for seq holds that request and it was sent
+ * recently enough to still be there: still in flight, or no longer.
+ */
+static int holds_request(const struct probe_target *target,
+                         uint16_t seq,
+                         int in_flight)
+{
+    const struct probe_slot *slot = &target->slots[seq & target->slot_mask];
+    uint16_t age = (uint16_t)(target->seq - 1 - seq);
+
+    if (slot->seq != seq) {
+        return 0;
+    }
+    if (in_flight) {
+        return slot->in_use;
+    }
+    return !slot->in_use && age <= target->slot_mask && age < target->sent;
+}
+
+/*
+ * Finds the target that sent the request with the given ID and sequence
+ * number to addr, among those waiting for a reply to it (in_flight) or
+ * those that have stopped waiting.
+ *
+ * Several targets may share the same ID and address when they are pinged
+ * through a ping socket, since the kernel uses the same ID for everything
+ * sent through it. Identical requests get identical replies though, so it
+ * doesn't matter which of them gets which reply.
+ */
+static struct probe_target *hash_lookup(struct prober *prober,
+                                        uint16_t id,
+                                        const struct sockaddr_storage *addr,
+                                        uint16_t seq,
+                                        int in_flight)
+{
+    struct probe_target *target;
+    size_t index;
+
+    if (prober->hash_size == 0) {
+        return NULL;
+    }
+
+    index = target_hash(id, addr) & (prober->hash_size - 1);
+    for (target = prober->hash_table[index];
+         target != NULL;
+         target = target->hash_next) {
+        if (target->id == id
+            && target->addr.ss_family == addr->ss_family
+            && memcmp(sockaddr_ip(&target->addr),
+                      sockaddr_ip(addr),
+                      sockaddr_ip_len(addr)) == 0
+            && holds_request(target, seq, in_flight)) {
+            return target;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Finds a target with the given ID and address, whether or not it's
+ * waiting for a reply.
+ */
+static struct probe_target *hash_find(struct prober *prober,
+                                      uint16_t id,
+                                      const struct sockaddr_storage *addr)
+{
+    struct probe_target *target;
+    size_t index;
+
+    if (prober->hash_size == 0) {
+        return NULL;
+    }
+
+    index = target_hash(id, addr) & (prober->hash_size - 1);
+    for (target = prober->hash_table[index];
+         target != NULL;
+         target = target->hash_next) {
+        if (target->id == id
+            && target->addr.ss_family == addr->ss_family
+            && memcmp(sockaddr_ip(&target->addr),
+                      sockaddr_ip(addr),
+                      sockaddr_ip_len(addr)) == 0) {
+            return target;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Rebuilds the hash table after target IDs have changed.
+ */
+static void rehash_targets(struct prober *prober)
+{
+    size_t i;
+
+    memset(prober->hash_table,
+           0,
+           prober->hash_size * sizeof(*prober->hash_table));
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        size_t index;
+        if (target->resolve_state == TARGET_REMOVED) {
+            continue;
+        }
+        index = target_hash(target->id, &target->addr)
+            & (prober->hash_size - 1);
+        target->hash_next = prober->hash_table[index];
+        prober->hash_table[index] = target;
+    }
+}
+
+/*
+ * Returns the number of requests that may be in flight to the same target.
+ * Unless it's set explicitly, it's enough to cover the timeout so that
+ * requests are only considered lost when they time out. In flood mode the
+ * next request is only sent after a reply to the previous one by default.
+ */
+static unsigned int window_size(const struct prober_config *config,
+                                size_t num_targets)
+{
+    uint64_t window = config->window;
+    uint64_t interval = config->interval;
+    unsigned int size = 1;
+
+    if (config->rate > 0) {
+        interval = (uint64_t)num_targets * 1000000000 / config->rate;
+    }
+    if (window == 0) {
+        if (config->flood) {
+            window = 1;
+        } else {
+            window = interval > 0
+                ? (config->timeout + interval - 1) / interval
+                : MAX_WINDOW;
+        }
+    }
+    if (window > MAX_WINDOW) {
+        window = MAX_WINDOW;
+    }
+
+    /*
+     * The table of requests in flight is indexed by the lower bits of the
+     * sequence number.
+     */
+    while (size < window) {
+        size <<= 1;
+    }
+    return size;
+}
+
+int prober_init(struct prober *prober, const struct prober_config *config)
+{
+    memset(prober, 0, sizeof(*prober));
+    prober->config = *config;
+    prober->sock4.fd = -1;
+    prober->sock6.fd = -1;
+    prober->base_id = (uint16_t)getpid();
+
+    if (config->payload_size > (size_t)-1 - ICMP_HEADER_LENGTH) {
+        fprintf(stderr, "Payload size too large\n");
+        return -1;
+    }
+    prober->packet = malloc(ICMP_HEADER_LENGTH + config->payload_size);
+    if (prober->packet == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    prober->max_payload_size = config->payload_size;
+
+    /*
+     * Fill the ICMP payload with some data.
+     */
+    memset(prober->packet + ICMP_HEADER_LENGTH, 255, config->payload_size);
+    prober->payload_sum = checksum_add(0,
+                                       prober->packet + ICMP_HEADER_LENGTH,
+                                       config->payload_size);
+
+    if (evloop_init(&prober->loop) != 0) {
+        psockerror("evloop_init");
+        free(prober->packet);
+        prober->packet = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the address family to resolve names into (AF_UNSPEC for IPv4
+ * with a fall back to IPv6, see resolver_lookup()).
+ */
+static int ip_family(int ip_version)
+{
+    switch (ip_version) {
+        case IP_V4:
+            return AF_INET;
+        case IP_V6:
+            return AF_INET6;
+        default:
+            return AF_UNSPEC;
+    }
+}
+
+int prober_init_shard(struct prober *shard,
+                      const struct prober *parent,
+                      size_t first,
+                      size_t count)
+{
+    struct prober_config config = parent->config;
+    size_t i;
+
+    /*
+     * Each shard sends its share of the requests.
+     */
+    if (config.rate > 0) {
+        config.rate = config.rate * count / parent->num_targets;
+        if (config.rate == 0) {
+            config.rate = 1;
+        }
+    }
+
+    if (prober_init(shard, &config) != 0) {
+        return -1;
+    }
+    shard->shared_targets = 1;
+    shard->base_id = (uint16_t)(parent->base_id + first);
+    shard->resolver = parent->resolver;
+
+    shard->targets = malloc(count * sizeof(*shard->targets));
+    if (shard->targets == NULL) {
+        perror("malloc");
+        goto error;
+    }
+    shard->max_targets = count;
+    for (i = 0; i < count; i++) {
+        struct probe_target *target = parent->targets[first + i];
+        shard->targets[i] = target;
+        shard->num_targets++;
+        if (hash_insert(shard, target) != 0) {
+            perror("calloc");
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    prober_destroy(shard);
+    return -1;
+}
+
+static int open_socket(struct prober *prober,
+                       struct icmp_socket *sock,
+                       int family)
+{
+    int flags = 0;
+
+    if (prober->config.raw_sockets) {
+        flags |= ICMP_SOCKET_RAW;
+    }
+    /*
+     * Replies from many targets can arrive in bursts, ask for larger socket
+     * buffers in that case.
+     */
+    if (prober->num_targets > 1) {
+        flags |= ICMP_SOCKET_LARGE_BUFFERS;
+    }
+    if (prober->config.io_uring) {
+        flags |= ICMP_SOCKET_URING;
+    }
+    if (prober->config.packet_ring) {
+        flags |= ICMP_SOCKET_PACKET_RING | ICMP_SOCKET_RAW;
+    }
+    if (icmp_socket_open(sock,
+                         family,
+                         prober->packet,
+                         ICMP_HEADER_LENGTH + prober->config.payload_size,
+                         flags) != 0) {
+        return -1;
+    }
+    if (prober->config.dont_fragment
+        && icmp_socket_set_dont_fragment(sock) != 0) {
+        psockerror("Can't set the Don't Fragment bit");
+        icmp_socket_close(sock);
+        return -1;
+    }
+    if (prober->config.io_uring && sock->uring == NULL) {
+        fprintf(stderr, "io_uring is not available, using system calls\n");
+        prober->config.io_uring = 0;
+    }
+    if (prober->config.packet_ring && sock->ring == NULL) {
+        fprintf(stderr, "Packet ring is not available, using system calls\n");
+        prober->config.packet_ring = 0;
+    }
+
+    if (evloop_add(&prober->loop, icmp_socket_poll_fd(sock), sock) != 0) {
+        psockerror("evloop_add");
+        icmp_socket_close(sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Builds the echo request header that all requests to the target start from.
+ * Only the sequence number changes from one request to the next, so the
+ * checksum can be updated incrementally rather than recomputed over the
+ * whole packet each time.
+ */
+static void build_request(struct prober *prober,
+                          struct probe_target *target,
+                          const struct icmp_socket *sock)
+{
+    struct icmp *request = (struct icmp *)target->request;
+
+    memset(target->request, 0, sizeof(target->request));
+    request->icmp_type =
+        target->addr.ss_family == AF_INET6 ? ICMP6_ECHO : ICMP_ECHO;
+    request->icmp_code = 0;
+    request->icmp_id = htons(target->id);
+    request->icmp_seq = 0;
+
+    /*
+     * For ICMPv6 the checksum includes an IPv6 "pseudo-header" with the
+     * source address that we don't know in advance, but the kernel computes
+     * it for us on raw ICMPv6 sockets anyway (RFC 3542, section 3.1). Ping
+     * sockets always compute it themselves.
+     */
+    if (target->addr.ss_family != AF_INET6 && sock->type == SOCK_RAW) {
+        request->icmp_cksum = checksum_finish(
+            checksum_add(prober->payload_sum,
+                         target->request,
+                         ICMP_HEADER_LENGTH));
+    }
+}
+
+/*
+ * Gives the target a new address once its name has been resolved. Requests
+ * in flight to the old address, if any, will time out.
+ */
+static void set_target_address(struct prober *prober,
+                               struct probe_target *target,
+                               const struct sockaddr_storage *addr,
+                               socklen_t addr_len)
+{
+    const struct icmp_socket *sock = addr->ss_family == AF_INET6
+        ? &prober->sock6
+        : &prober->sock4;
+    size_t index;
+
+    hash_remove(prober, target);
+
+    memset(&target->addr, 0, sizeof(target->addr));
+    memcpy(&target->addr, addr, addr_len);
+    target->addr_len = addr_len;
+    inet_ntop(target->addr.ss_family,
+              sockaddr_ip(&target->addr),
+              target->addr_str,
+              sizeof(target->addr_str));
+    if (sock->type == SOCK_DGRAM) {
+        target->id = sock->id;
+    }
+    build_request(prober, target, sock);
+
+    /*
+     * A new address may well be on a different path.
+     */
+    target->srtt = 0;
+    target->rttvar = 0;
+    target->timeout = 0;
+
+    index = target_hash(target->id, &target->addr) & (prober->hash_size - 1);
+    target->hash_next = prober->hash_table[index];
+    prober->hash_table[index] = target;
+}
+
+/*
+ * Tells which sockets the target needs. Names that are still to be
+ * resolved may end up in either family.
+ */
+static void needed_sockets(const struct prober *prober,
+                           const struct probe_target *target,
+                           int *need4,
+                           int *need6)
+{
+    if (target->resolve_state == TARGET_RESOLVING) {
+        *need4 |= prober->config.ip_version != IP_V6;
+        *need6 |= prober->config.ip_version != IP_V4;
+    } else if (target->addr.ss_family == AF_INET6) {
+        *need6 = 1;
+    } else {
+        *need4 = 1;
+    }
+}
+
+/*
+ * Copies the entries of a ring buffer of targets into a larger one, with
+ * the oldest first.
+ */
+static int resize_ring(struct probe_target ***ring,
+                       size_t *head,
+                       size_t count,
+                       size_t old_size,
+                       size_t new_size)
+{
+    struct probe_target **new_ring;
+    size_t i;
+
+    new_ring = malloc(new_size * sizeof(*new_ring));
+    if (new_ring == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        new_ring[i] = (*ring)[(*head + i) % old_size];
+    }
+    free(*ring);
+    *ring = new_ring;
+    *head = 0;
+    return 0;
+}
+
+/*
+ * Makes room for every target in the flood and refresh queues, in which
+ * they appear at most once each.
+ */
+static int resize_queues(struct prober *prober, size_t size)
+{
+    if (prober->config.flood
+        && resize_ring(&prober->flood_queue,
+                       &prober->flood_head,
+                       prober->flood_count,
+                       prober->queue_size,
+                       size) != 0) {
+        return -1;
+    }
+    if (prober->resolver != NULL
+        && prober->config.dns_ttl > 0
+        && resize_ring(&prober->refresh_queue,
+                       &prober->refresh_head,
+                       prober->refresh_count,
+                       prober->queue_size,
+                       size) != 0) {
+        return -1;
+    }
+    prober->queue_size = size;
+    return 0;
+}
+
+static void update_filters(struct prober *prober)
+{
+    /*
+     * Targets use consecutive IDs starting from base_id, unless there are
+     * too many of them to fit into 16 bits and every ID may be in use.
+     */
+    uint16_t num_ids = prober->num_targets <= 0xffff
+        ? (uint16_t)prober->num_targets
+        : 0;
+
+    icmp_socket_set_filter(&prober->sock4, prober->base_id, num_ids);
+    icmp_socket_set_filter(&prober->sock6, prober->base_id, num_ids);
+}
+
+/*
+ * Allocates the table of requests in flight and the bitmap of answered
+ * ones, both for a window's worth of sequence numbers.
+ */
+static int alloc_slots(struct prober *prober, struct probe_target *target)
+{
+    target->slots = calloc(prober->config.window, sizeof(*target->slots));
+    target->answered = calloc((prober->config.window + 31) / 32,
+                              sizeof(*target->answered));
+    if (target->slots == NULL || target->answered == NULL) {
+        perror("calloc");
+        free(target->slots);
+        free(target->answered);
+        target->slots = NULL;
+        target->answered = NULL;
+        return -1;
+    }
+    target->slot_mask = (uint16_t)(prober->config.window - 1);
+    return 0;
+}
+
+int prober_open_sockets(struct prober *prober)
+{
+    size_t i;
+    int need4 = 0;
+    int need6 = 0;
+
+    for (i = 0; i < prober->num_targets; i++) {
+        needed_sockets(prober, prober->targets[i], &need4, &need6);
+    }
+
+    if (need4 && open_socket(prober, &prober->sock4, AF_INET) != 0) {
+        return -1;
+    }
+    if (need6 && open_socket(prober, &prober->sock6, AF_INET6) != 0) {
+        return -1;
+    }
+
+    /*
+     * The window depends on the interval, which depends on the number of
+     * targets when requests are sent at a fixed rate.
+     */
+    prober->config.window = window_size(&prober->config, prober->num_targets);
+    for (i = 0; i < prober->num_targets; i++) {
+        if (alloc_slots(prober, prober->targets[i]) != 0) {
+            return -1;
+        }
+    }
+
+    if (prober->num_targets > 0
+        && resize_queues(prober, prober->num_targets) != 0) {
+        return -1;
+    }
+    update_filters(prober);
+
+    /*
+     * The kernel replaces the ID of requests sent through a ping socket with
+     * its own, so that is what replies will come back with.
+     */
+    if (prober->sock4.type == SOCK_DGRAM || prober->sock6.type == SOCK_DGRAM) {
+        for (i = 0; i < prober->num_targets; i++) {
+            struct probe_target *target = prober->targets[i];
+            const struct icmp_socket *sock =
+                target->addr.ss_family == AF_INET6
+                    ? &prober->sock6
+                    : &prober->sock4;
+            if (sock->type == SOCK_DGRAM
+                && target->resolve_state == TARGET_RESOLVED) {
+                target->id = sock->id;
+            }
+        }
+        rehash_targets(prober);
+    }
+
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        if (target->resolve_state != TARGET_RESOLVED) {
+            continue;
+        }
+        build_request(prober,
+                      target,
+                      target->addr.ss_family == AF_INET6
+                          ? &prober->sock6
+                          : &prober->sock4);
+    }
+
+    prober->sockets_open = 1;
+    return 0;
+}
+
+/*
+ * The requests in flight form a binary min-heap on their deadlines, so that
+ * the first one to expire is always at the top. With a fixed timeout they
+ * are pushed in the order of their deadlines and never move up.
+ */
+static int push_pending(struct prober *prober,
+                        struct probe_target *target,
+                        uint16_t seq,
+                        uint64_t deadline)
+{
+    struct pending_probe *pending = prober->pending;
+    size_t i;
+
+    if (prober->pending_count == prober->pending_size) {
+        size_t new_size = prober->pending_size > 0
+            ? prober->pending_size * 2
+            : 16;
+        struct pending_probe *new_pending =
+            realloc(prober->pending, new_size * sizeof(*new_pending));
+
+        if (new_pending == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        pending = prober->pending = new_pending;
+        prober->pending_size = new_size;
+    }
+
+    i = prober->pending_count++;
+    while (i > 0 && pending[(i - 1) / 2].deadline > deadline) {
+        pending[i] = pending[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    pending[i].target = target;
+    pending[i].seq = seq;
+    pending[i].deadline = deadline;
+
+    return 0;
+}
+
+/*
+ * Removes the request at the top of the heap.
+ */
+static void pop_pending(struct prober *prober)
+{
+    struct pending_probe *pending = prober->pending;
+    struct pending_probe last = pending[--prober->pending_count];
+    size_t count = prober->pending_count;
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count
+            && pending[child + 1].deadline < pending[child].deadline) {
+            child++;
+        }
+        if (pending[child].deadline >= last.deadline) {
+            break;
+        }
+        pending[i] = pending[child];
+        i = child;
+    }
+    pending[i] = last;
+}
+
+/*
+ * How long to wait for a reply to the next request to the target. Adaptive
+ * timeouts follow RFC 6298: the smoothed RTT plus four times its variation,
+ * doubled after every timeout until the next reply, and kept between the
+ * floor and the ceiling. Until the first reply the ceiling is used.
+ */
+static uint64_t target_timeout(const struct prober *prober,
+                               const struct probe_target *target)
+{
+    if (prober->config.min_timeout == 0 || target->timeout == 0) {
+        return prober->config.timeout;
+    }
+    return target->timeout;
+}
+
+static uint64_t clamp_timeout(const struct prober_config *config,
+                              uint64_t timeout)
+{
+    if (timeout < config->min_timeout) {
+        timeout = config->min_timeout;
+    }
+    if (timeout > config->timeout) {
+        timeout = config->timeout;
+    }
+    return timeout;
+}
+
+static void update_timeout(struct prober *prober,
+                           struct probe_target *target,
+                           uint64_t rtt)
+{
+    if (prober->config.min_timeout == 0) {
+        return;
+    }
+    if (target->srtt == 0) {
+        target->srtt = rtt;
+        target->rttvar = rtt / 2;
+    } else {
+        uint64_t delta = target->srtt > rtt
+            ? target->srtt - rtt
+            : rtt - target->srtt;
+        target->rttvar = (3 * target->rttvar + delta) / 4;
+        target->srtt = (7 * target->srtt + rtt) / 8;
+    }
+    target->timeout = clamp_timeout(&prober->config,
+                                    target->srtt + 4 * target->rttvar);
+}
+
+static void back_off_timeout(struct prober *prober,
+                             struct probe_target *target)
+{
+    if (prober->config.min_timeout == 0 || target->timeout == 0) {
+        return;
+    }
+    target->timeout = clamp_timeout(&prober->config, 2 * target->timeout);
+}
+
+/*
+ * In flood mode, a target can be sent the next request once the slot for
+ * its sequence number is free.
+ */
+static void flood_push(struct prober *prober, struct probe_target *target)
+{
+    if (target->flood_queued
+        || target->resolve_state != TARGET_RESOLVED
+        || target->slots[target->seq & target->slot_mask].in_use
+        || (prober->config.count > 0
+            && target->sent >= prober->config.count)) {
+        return;
+    }
+    prober->flood_queue[(prober->flood_head + prober->flood_count)
+                        % prober->queue_size] = target;
+    prober->flood_count++;
+    target->flood_queued = 1;
+}
+
+static struct probe_target *flood_pop(struct prober *prober)
+{
+    struct probe_target *target = prober->flood_queue[prober->flood_head];
+
+    prober->flood_head = (prober->flood_head + 1) % prober->queue_size;
+    prober->flood_count--;
+    target->flood_queued = 0;
+    return target;
+}
+
+static int is_answered(const struct probe_target *target, uint16_t seq)
+{
+    unsigned int bit = seq & target->slot_mask;
+    return (target->answered[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void set_answered(struct probe_target *target,
+                         uint16_t seq,
+                         int answered)
+{
+    unsigned int bit = seq & target->slot_mask;
+
+    if (answered) {
+        target->answered[bit / 32] |= (uint32_t)1 << (bit % 32);
+    } else {
+        target->answered[bit / 32] &= ~((uint32_t)1 << (bit % 32));
+    }
+}
+
+/*
+ * Marks the request as no longer in flight, either because it has been
+ * answered or because it's considered lost.
+ */
+static void release_slot(struct prober *prober,
+                         struct probe_target *target,
+                         struct probe_slot *slot)
+{
+    slot->in_use = 0;
+    prober->num_outstanding--;
+    if (prober->config.flood) {
+        flood_push(prober, target);
+    }
+}
+
+/*
+ * Passes an event on to the handler, keeping track of how long it takes.
+ */
+static void dispatch(struct prober *prober,
+                     const struct probe_event *event,
+                     probe_event_handler handler,
+                     void *arg)
+{
+    uint64_t start = ntime();
+
+    handler(event, arg);
+    prober->hot_path.handler_calls++;
+    prober->hot_path.handler_time += ntime() - start;
+}
+
+static void report_timeout(struct prober *prober,
+                           struct probe_target *target,
+                           struct probe_slot *slot,
+                           probe_event_handler handler,
+                           void *arg)
+{
+    struct probe_event event = {0};
+
+    stats_add_loss(&target->stats);
+    back_off_timeout(prober, target);
+
+    event.type = PROBE_EVENT_TIMEOUT;
+    event.target = target;
+    event.seq = slot->seq;
+    event.lateness = slot->lateness;
+    dispatch(prober, &event, handler, arg);
+}
+
+/*
+ * Sends the next request to the target. scheduled_time is when it should
+ * have been sent.
+ */
+static int send_probe(struct prober *prober,
+                      struct probe_target *target,
+                      uint64_t now,
+                      uint64_t scheduled_time,
+                      probe_event_handler handler,
+                      void *arg)
+{
+    struct probe_slot *slot = &target->slots[target->seq & target->slot_mask];
+    struct icmp_socket *sock;
+    struct icmp *request;
+    uint64_t lateness = now > scheduled_time ? now - scheduled_time : 0;
+
+    /*
+     * The window is full: the oldest request is still unanswered, consider
+     * it lost to make room for the new one.
+     */
+    if (slot->in_use) {
+        release_slot(prober, target, slot);
+        report_timeout(prober, target, slot, handler, arg);
+    }
+
+    sock = target->addr.ss_family == AF_INET6
+        ? &prober->sock6
+        : &prober->sock4;
+
+    /*
+     * The request is only queued here and actually sent when the socket is
+     * flushed. Requests that don't make it into the send buffer are treated
+     * as lost.
+     */
+    request = (struct icmp *)icmp_socket_queue(sock,
+                                               target,
+                                               target->seq,
+                                               &target->addr,
+                                               target->addr_len);
+    if (request == NULL) {
+        return -1;
+    }
+
+    /*
+     * The payload is already in the buffer, only the header needs to be
+     * filled in.
+     */
+    memcpy(request, target->request, ICMP_HEADER_LENGTH);
+    request->icmp_seq = htons(target->seq);
+    if (target->addr.ss_family != AF_INET6 && sock->type == SOCK_RAW) {
+        request->icmp_cksum = checksum_update(request->icmp_cksum,
+                                              0,
+                                              request->icmp_seq);
+    }
+
+    slot->send_time = now;
+    slot->tx_delay = 0;
+    slot->lateness = lateness < 0xffffffff ? (uint32_t)lateness : 0xffffffff;
+    slot->seq = target->seq;
+    slot->in_use = 1;
+    slot->flags = 0;
+    set_answered(target, target->seq, 0);
+    prober->num_outstanding++;
+
+    prober->schedule.sends++;
+    prober->schedule.lateness_sum += lateness;
+    if (lateness > prober->schedule.lateness_max) {
+        prober->schedule.lateness_max = lateness;
+    }
+
+    target->seq++;
+    target->sent++;
+    if (prober->config.count > 0 && target->sent == prober->config.count) {
+        prober->num_unfinished--;
+    }
+
+    return push_pending(prober,
+                        target,
+                        (uint16_t)(target->seq - 1),
+                        now + target_timeout(prober, target));
+}
+
+static void expire_probes(struct prober *prober,
+                          uint64_t now,
+                          probe_event_handler handler,
+                          void *arg)
+{
+    while (prober->pending_count > 0) {
+        struct probe_target *target = prober->pending[0].target;
+        uint16_t seq = prober->pending[0].seq;
+        struct probe_slot *slot;
+
+        if (prober->pending[0].deadline > now) {
+            break;
+        }
+        pop_pending(prober);
+
+        slot = &target->slots[seq & target->slot_mask];
+        if (slot->in_use && slot->seq == seq) {
+            release_slot(prober, target, slot);
+            report_timeout(prober, target, slot, handler, arg);
+        }
+    }
+}
+
+/*
+ * Handles a message read from the socket and reports it if it's a reply to
+ * one of our outstanding requests.
+ */
+static void handle_message(struct prober *prober,
+                           int family,
+                           struct icmp_message *message,
+                           uint64_t now,
+                           uint64_t wall_now,
+                           probe_event_handler handler,
+                           void *arg)
+{
+    struct icmp *reply = (struct icmp *)message->data;
+    struct probe_target *target;
+    struct probe_slot *slot;
+    struct probe_event event = {0};
+    uint16_t reply_id;
+    uint16_t reply_seq;
+    uint16_t reply_checksum;
+    uint16_t checksum;
+    uint64_t send_time;
+    uint64_t receive_time;
+    uint64_t remote_receive_time;
+    uint64_t remote_send_time;
+    uint64_t checksum_start;
+
+    if (reply == NULL) {
+        return;
+    }
+
+    reply_id = ntohs(reply->icmp_id);
+    reply_seq = ntohs(reply->icmp_seq);
+
+    /*
+     * Verify that this is indeed an echo reply packet.
+     */
+    if (!(family == AF_INET
+          && reply->icmp_type == ICMP_ECHO_REPLY)
+        && !(family == AF_INET6
+             && reply->icmp_type == ICMP6_ECHO_REPLY)) {
+        prober->hot_path.not_replies++;
+        return;
+    }
+
+    /*
+     * Find out which target the reply came from and make sure that it
+     * is associated with one of the requests that we're waiting for.
+     */
+    target = hash_lookup(prober, reply_id, &message->from, reply_seq, 1);
+    if (target != NULL) {
+        event.type = PROBE_EVENT_REPLY;
+    } else {
+        /*
+         * The request is no longer in flight, but it's still recent enough
+         * to tell whether this is its first reply.
+         */
+        target = hash_lookup(prober, reply_id, &message->from, reply_seq, 0);
+        if (target == NULL) {
+            if (hash_find(prober, reply_id, &message->from) != NULL) {
+                prober->hot_path.stale++;
+            } else {
+                prober->hot_path.unknown++;
+            }
+            return;
+        }
+        event.type = is_answered(target, reply_seq)
+            ? PROBE_EVENT_DUPLICATE
+            : PROBE_EVENT_LATE;
+    }
+    slot = &target->slots[reply_seq & target->slot_mask];
+
+    reply_checksum = reply->icmp_cksum;
+    reply->icmp_cksum = 0;
+
+    /*
+     * Verify the checksum.
+     */
+    checksum_start = ntime();
+    if (family == AF_INET6) {
+        struct ip6_pseudo_hdr pseudo_hdr = {0};
+
+        memcpy(&pseudo_hdr.src,
+               &((struct sockaddr_in6 *)&target->addr)->sin6_addr,
+               sizeof(struct in6_addr));
+        pseudo_hdr.dst = message->dst;
+        pseudo_hdr.plen = htons((uint16_t)message->len);
+        pseudo_hdr.nxt = IPPROTO_ICMPV6;
+
+        checksum = checksum_finish(
+            checksum_add(checksum_add(0, &pseudo_hdr, sizeof(pseudo_hdr)),
+                         message->data,
+                         message->len));
+    } else {
+        checksum = compute_checksum(message->data, message->len);
+    }
+    prober->hot_path.checksums++;
+    prober->hot_path.checksum_time += ntime() - checksum_start;
+
+    if (event.type == PROBE_EVENT_REPLY) {
+        release_slot(prober, target, slot);
+    }
+    set_answered(target, reply_seq, 1);
+
+    event.target = target;
+    event.seq = reply_seq;
+    event.lateness = slot->lateness;
+    event.flags = slot->flags;
+    if (reply_checksum != checksum) {
+        event.flags |= PROBE_FLAG_BAD_CHECKSUM;
+        prober->hot_path.bad_checksums++;
+    }
+
+    /*
+     * Prefer the kernel's timestamps to our own: they don't include the
+     * time it took us to send the request, or to wake up and read the
+     * reply.
+     */
+    send_time = slot->send_time + slot->tx_delay;
+#ifndef _WIN32
+    receive_time = kernel_time_to_mono(message->kernel_time, now, wall_now);
+#else
+    receive_time = 0;
+#endif
+    if (receive_time != 0 && receive_time >= send_time) {
+        event.flags |= PROBE_FLAG_KERNEL_RX;
+        prober->hot_path.receive_delays++;
+        prober->hot_path.receive_delay_sum += now - receive_time;
+        if (now - receive_time > prober->hot_path.receive_delay_max) {
+            prober->hot_path.receive_delay_max = now - receive_time;
+        }
+    } else {
+        receive_time = now;
+    }
+    if (receive_time < send_time) {
+        send_time = slot->send_time;
+        event.flags &= ~PROBE_FLAG_KERNEL_TX;
+    }
+    event.rtt = receive_time - send_time;
+    event.user_rtt = now - slot->send_time;
+
+    /*
+     * The timeout is measured by our clock, so it has to allow for our own
+     * delays as well. A late reply shows that it was too short.
+     */
+    if (event.type != PROBE_EVENT_DUPLICATE) {
+        update_timeout(prober, target, event.user_rtt);
+    }
+
+    if ((event.flags & (PROBE_FLAG_KERNEL_TX | PROBE_FLAG_KERNEL_RX)) != 0) {
+        uint64_t added = event.user_rtt - event.rtt;
+        prober->overhead.replies++;
+        prober->overhead.sum += added;
+        if (added > prober->overhead.max) {
+            prober->overhead.max = added;
+        }
+    }
+
+    /*
+     * A reflector tells us when the request arrived and when the reply left
+     * by its wall clock, which splits the RTT into the two directions.
+     */
+    if (reflector_read_timestamps(message->data,
+                                  message->len,
+                                  &remote_receive_time,
+                                  &remote_send_time) == 0) {
+        uint64_t wall_offset = (wall_now != 0 ? wall_now : wtime()) - now;
+        uint64_t wall_send_time = send_time + wall_offset;
+        uint64_t wall_receive_time = receive_time + wall_offset;
+
+        if (remote_receive_time >= wall_send_time
+            && remote_send_time >= remote_receive_time
+            && wall_receive_time >= remote_send_time) {
+            event.flags |= PROBE_FLAG_ONE_WAY;
+            event.forward_delay = remote_receive_time - wall_send_time;
+            event.return_delay = wall_receive_time - remote_send_time;
+        }
+    }
+
+    if (event.type == PROBE_EVENT_LATE) {
+        /*
+         * Already counted as lost.
+         */
+        target->stats.late++;
+        if (event.rtt > target->stats.late_max) {
+            target->stats.late_max = event.rtt;
+        }
+    } else if (event.type == PROBE_EVENT_DUPLICATE) {
+        target->stats.duplicates++;
+    } else {
+        /*
+         * Requests sent after this one that were answered first tell how
+         * far the replies got out of order.
+         */
+        uint16_t reorder = (uint16_t)(target->newest_reply - reply_seq);
+        if (target->stats.received > 0
+            && reorder > 0
+            && reorder <= target->slot_mask) {
+            event.flags |= PROBE_FLAG_REORDERED;
+            event.reorder = reorder;
+            target->stats.reordered++;
+            if (reorder > target->stats.max_reorder) {
+                target->stats.max_reorder = reorder;
+            }
+        } else {
+            target->newest_reply = reply_seq;
+        }
+
+        /*
+         * If the histogram can't be allocated, we can live without
+         * percentiles.
+         */
+        stats_add(&target->stats, event.rtt);
+    }
+
+    dispatch(prober, &event, handler, arg);
+}
+
+/*
+ * Reads all pending messages from the socket in batches and reports those
+ * that are replies to our outstanding requests. Returns -1 on a fatal error.
+ */
+static int receive_replies(struct prober *prober,
+                           struct icmp_socket *sock,
+                           probe_event_handler handler,
+                           void *arg)
+{
+    icmp_socket_read_tx_timestamps(sock, handle_tx_timestamp, NULL);
+
+    for (;;) {
+        struct icmp_message *messages;
+        uint64_t now;
+        uint64_t wall_now = 0;
+        int count;
+        int i;
+
+        count = icmp_socket_receive(sock, &messages);
+        if (count < 0) {
+            return -1;
+        }
+
+        /*
+         * All messages in a batch were read at the same time.
+         */
+        now = ntime();
+#ifndef _WIN32
+        if ((sock->timestamping & TIMESTAMPS_RX) != 0) {
+            wall_now = wtime();
+        }
+#endif
+
+        for (i = 0; i < count; i++) {
+            handle_message(prober,
+                           sock->family,
+                           &messages[i],
+                           now,
+                           wall_now,
+                           handler,
+                           arg);
+        }
+        icmp_socket_release(sock);
+
+        /*
+         * A short batch means that the socket has been drained.
+         */
+        if (count < ICMP_SOCKET_BATCH_SIZE) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Returns the time when the request with the given index in the schedule
+ * should be sent.
+ */
+static uint64_t scheduled_time(const struct prober *prober,
+                               unsigned long round,
+                               size_t cursor)
+{
+    uint64_t interval = prober->config.interval;
+    uint64_t rate = prober->config.rate;
+
+    if (rate > 0) {
+        /*
+         * Split the multiplication so that it doesn't overflow even after
+         * billions of requests.
+         */
+        uint64_t index = (uint64_t)round * prober->num_targets + cursor;
+        return prober->start_time
+            + index / rate * 1000000000
+            + index % rate * 1000000000 / rate;
+    }
+
+    /*
+     * Requests to different targets are spread evenly over the interval.
+     */
+    return prober->start_time
+        + round * interval
+        + cursor * interval / prober->num_targets;
+}
+
+/*
+ * Sends the requests that are due. Returns the time when the next one is
+ * due, now if there are more to send right away, or (uint64_t)-1 if there
+ * is nothing left to send.
+ */
+static uint64_t send_scheduled(struct prober *prober,
+                               uint64_t now,
+                               probe_event_handler handler,
+                               void *arg,
+                               int *error)
+{
+    unsigned long count = prober->config.count;
+    uint64_t next_send_time;
+    int burst = 0;
+
+    for (;;) {
+        struct probe_target *target;
+
+        if (prober->num_unfinished == 0) {
+            return (uint64_t)-1;
+        }
+        /*
+         * Hold the schedule while none of the remaining targets has an
+         * address, so that the first one to resolve doesn't have to wait
+         * a whole interval for its turn.
+         */
+        if (prober->num_resolving == prober->num_unfinished) {
+            prober->start_time = now;
+            prober->round = 0;
+            prober->cursor = 0;
+            return (uint64_t)-1;
+        }
+        next_send_time = scheduled_time(prober,
+                                        prober->round,
+                                        prober->cursor);
+        if (next_send_time > now) {
+            return next_send_time;
+        }
+        /*
+         * Don't starve the receive side when we are behind schedule.
+         */
+        if (burst++ == MAX_SEND_BURST) {
+            return now;
+        }
+        /*
+         * Targets that are not resolved yet or have been sent all of their
+         * requests sit their turn out.
+         */
+        target = prober->targets[prober->cursor];
+        if (target->resolve_state == TARGET_RESOLVED
+            && (count == 0 || target->sent < count)
+            && send_probe(prober,
+                          target,
+                          now,
+                          next_send_time,
+                          handler,
+                          arg) != 0) {
+            *error = 1;
+            return (uint64_t)-1;
+        }
+        if (++prober->cursor == prober->num_targets) {
+            prober->cursor = 0;
+            prober->round++;
+        }
+    }
+}
+
+/*
+ * Sends a request to every target that has room for it in its window.
+ * Returns now if there are more to send right away or (uint64_t)-1 if
+ * we have to wait for replies first.
+ */
+static uint64_t send_flood(struct prober *prober,
+                           uint64_t now,
+                           probe_event_handler handler,
+                           void *arg,
+                           int *error)
+{
+    int burst;
+
+    for (burst = 0; burst < MAX_SEND_BURST; burst++) {
+        struct probe_target *target;
+
+        if (prober->flood_count == 0) {
+            return (uint64_t)-1;
+        }
+        /*
+         * Targets that have been removed (or removed and added again with
+         * a name) since they were queued are skipped.
+         */
+        target = flood_pop(prober);
+        if (target->resolve_state != TARGET_RESOLVED) {
+            continue;
+        }
+        if (send_probe(prober, target, now, now, handler, arg) != 0) {
+            *error = 1;
+            return (uint64_t)-1;
+        }
+        flood_push(prober, target);
+    }
+
+    return now;
+}
+
+static void wake_prober(void *arg)
+{
+    struct prober *prober = arg;
+    evloop_wake(&prober->loop);
+}
+
+static void schedule_refresh(struct prober *prober,
+                             struct probe_target *target,
+                             uint64_t now)
+{
+    if (!target->dynamic || prober->refresh_queue == NULL) {
+        return;
+    }
+    target->resolve_due = now + prober->config.dns_ttl;
+    prober->refresh_queue[(prober->refresh_head + prober->refresh_count)
+                          % prober->queue_size] = target;
+    prober->refresh_count++;
+    target->refresh_queued = 1;
+}
+
+/*
+ * Asks for the names whose cached addresses have expired to be resolved
+ * again. As all of them live equally long, the queue is in the order in
+ * which they expire.
+ */
+static int refresh_names(struct prober *prober, uint64_t now)
+{
+    while (prober->refresh_count > 0) {
+        struct probe_target *target =
+            prober->refresh_queue[prober->refresh_head];
+
+        if (target->resolve_due > now) {
+            break;
+        }
+        prober->refresh_head =
+            (prober->refresh_head + 1) % prober->queue_size;
+        prober->refresh_count--;
+        target->refresh_queued = 0;
+        if (target->resolve_state == TARGET_REMOVED) {
+            continue;
+        }
+        if (resolver_request(&prober->resolver_client,
+                             target->name,
+                             ip_family(prober->config.ip_version),
+                             target) != 0) {
+            return -1;
+        }
+        target->lookup_pending = 1;
+    }
+    return 0;
+}
+
+/*
+ * Applies the result of a lookup to its target and reports the address if
+ * it's new.
+ */
+static void handle_lookup(struct prober *prober,
+                          const struct resolve_result *result,
+                          uint64_t now,
+                          probe_event_handler handler,
+                          void *arg)
+{
+    struct probe_target *target = result->owner;
+    int first = target->resolve_state == TARGET_RESOLVING;
+    struct probe_event event = {0};
+
+    target->lookup_pending = 0;
+    if (!result->cached) {
+        prober->resolve.lookups++;
+        prober->resolve.time_sum += result->latency;
+        if (result->latency > prober->resolve.time_max) {
+            prober->resolve.time_max = result->latency;
+        }
+    }
+    if (target->resolve_state == TARGET_REMOVED) {
+        return;
+    }
+
+    if (result->error != 0) {
+        prober->resolve.failures++;
+        resolver_print_error(target->name, result->error, result->sys_errno);
+        if (first) {
+            target->resolve_state = TARGET_UNRESOLVABLE;
+            prober->num_resolving--;
+            prober->num_unfinished--;
+        } else {
+            /*
+             * Keep pinging the old address.
+             */
+            schedule_refresh(prober, target, now);
+        }
+        return;
+    }
+
+    if (!result->cached) {
+        target->resolve_time = result->latency;
+    }
+    if (first
+        || result->addr.ss_family != target->addr.ss_family
+        || memcmp(sockaddr_ip(&result->addr),
+                  sockaddr_ip(&target->addr),
+                  sockaddr_ip_len(&result->addr)) != 0) {
+        set_target_address(prober, target, &result->addr, result->addr_len);
+        event.type = PROBE_EVENT_RESOLVE;
+        event.target = target;
+        event.flags = result->cached ? PROBE_FLAG_CACHED : 0;
+        dispatch(prober, &event, handler, arg);
+    }
+    if (first) {
+        target->resolve_state = TARGET_RESOLVED;
+        prober->num_resolving--;
+        if (prober->config.flood) {
+            flood_push(prober, target);
+        }
+    }
+    schedule_refresh(prober, target, now);
+}
+
+static void handle_lookups(struct prober *prober,
+                           uint64_t now,
+                           probe_event_handler handler,
+                           void *arg)
+{
+    struct resolve_result *result;
+
+    result = resolver_take(&prober->resolver_client);
+    while (result != NULL) {
+        struct resolve_result *next = result->next;
+        handle_lookup(prober, result, now, handler, arg);
+        free(result);
+        result = next;
+    }
+}
+
+/*
+ * Starts looking up the names of the targets that don't have an address
+ * yet.
+ */
+static int start_resolving(struct prober *prober)
+{
+    size_t i;
+
+    if (prober->resolver == NULL) {
+        return 0;
+    }
+    resolver_client_init(&prober->resolver_client,
+                         prober->resolver,
+                         wake_prober,
+                         prober);
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        if (target->resolve_state != TARGET_RESOLVING) {
+            continue;
+        }
+        if (resolver_request(&prober->resolver_client,
+                             target->name,
+                             ip_family(prober->config.ip_version),
+                             target) != 0) {
+            return -1;
+        }
+        target->lookup_pending = 1;
+        prober->num_resolving++;
+    }
+    return 0;
+}
+
+/*
+ * Starts the schedule over from the current round, before the number of
+ * targets that it goes through changes.
+ */
+static void rebase_schedule(struct prober *prober)
+{
+    if (prober->num_unfinished == 0) {
+        prober->start_time = ntime();
+        prober->cursor = 0;
+    } else {
+        prober->start_time = scheduled_time(prober, prober->round, 0);
+    }
+    prober->round = 0;
+}
+
+/*
+ * Prepares a target that is added after the sockets have been opened, and
+ * schedules it if the prober is running.
+ */
+static int setup_target(struct prober *prober, struct probe_target *target)
+{
+    int need4 = 0;
+    int need6 = 0;
+
+    needed_sockets(prober, target, &need4, &need6);
+    if (need4
+        && (int)prober->sock4.fd < 0
+        && open_socket(prober, &prober->sock4, AF_INET) != 0) {
+        return -1;
+    }
+    if (need6
+        && (int)prober->sock6.fd < 0
+        && open_socket(prober, &prober->sock6, AF_INET6) != 0) {
+        return -1;
+    }
+
+    if (target->slots == NULL && alloc_slots(prober, target) != 0) {
+        return -1;
+    }
+    if (prober->num_targets > prober->queue_size
+        && resize_queues(prober,
+                         prober->queue_size > 0
+                             ? prober->queue_size * 2
+                             : 16) != 0) {
+        return -1;
+    }
+    update_filters(prober);
+
+    if (target->resolve_state == TARGET_RESOLVED) {
+        struct sockaddr_storage addr = target->addr;
+        set_target_address(prober, target, &addr, target->addr_len);
+    }
+
+    if (!prober->running) {
+        return 0;
+    }
+    if (target->resolve_state == TARGET_RESOLVING) {
+        if (resolver_request(&prober->resolver_client,
+                             target->name,
+                             ip_family(prober->config.ip_version),
+                             target) != 0) {
+            return -1;
+        }
+        target->lookup_pending = 1;
+        prober->num_resolving++;
+    }
+    prober->num_unfinished++;
+    if (prober->config.flood) {
+        flood_push(prober, target);
+    }
+    return 0;
+}
+
+/*
+ * Gives a new or reused target its name and address, or no address yet if
+ * addr is NULL.
+ */
+static int init_target(struct probe_target *target,
+                       const char *name,
+                       const struct sockaddr_storage *addr,
+                       socklen_t addr_len)
+{
+    char *new_name = malloc(strlen(name) + 1);
+
+    if (new_name == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    strcpy(new_name, name);
+    free(target->name);
+    target->name = new_name;
+
+    memset(&target->addr, 0, sizeof(target->addr));
+    target->addr_str[0] = '\0';
+    if (addr != NULL) {
+        target->resolve_state = TARGET_RESOLVED;
+        target->dynamic = 0;
+        memcpy(&target->addr, addr, addr_len);
+        target->addr_len = addr_len;
+
+        /*
+         * Convert the destination IP-address to a string.
+         */
+        inet_ntop(target->addr.ss_family,
+                  sockaddr_ip(&target->addr),
+                  target->addr_str,
+                  sizeof(target->addr_str));
+    } else {
+        target->resolve_state = TARGET_RESOLVING;
+        target->dynamic = 1;
+        target->addr_len = 0;
+    }
+    return 0;
+}
+
+/*
+ * Finds a removed target that nothing refers to anymore, apart from
+ * requests that have been forgotten.
+ */
+static struct probe_target *find_removed_target(struct prober *prober)
+{
+    size_t i;
+
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        if (target->resolve_state == TARGET_REMOVED
+            && !target->lookup_pending
+            && !target->refresh_queued) {
+            return target;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Reuses a removed target or appends a new one, with the given address or
+ * with none yet if addr is NULL.
+ */
+static struct probe_target *add_target(struct prober *prober,
+                                       const char *name,
+                                       const struct sockaddr_storage *addr,
+                                       socklen_t addr_len)
+{
+    struct probe_target *target = NULL;
+
+    if (prober->running) {
+        rebase_schedule(prober);
+    }
+
+    if (prober->num_removed > 0) {
+        target = find_removed_target(prober);
+    }
+    if (target != NULL) {
+        /*
+         * The ID and the sequence numbers go on from where they were, so
+         * that replies to forgotten requests aren't mistaken for new ones.
+         */
+        if (init_target(target, name, addr, addr_len) != 0) {
+            return NULL;
+        }
+        target->resolve_time = 0;
+        target->sent = 0;
+        target->user_data = NULL;
+        stats_destroy(&target->stats);
+        prober->num_removed--;
+        if (hash_insert(prober, target) != 0) {
+            perror("calloc");
+            target->resolve_state = TARGET_REMOVED;
+            prober->num_removed++;
+            return NULL;
+        }
+    } else {
+        if (prober->num_targets == prober->max_targets) {
+            size_t new_max = prober->max_targets > 0
+                ? prober->max_targets * 2
+                : 16;
+            struct probe_target **new_targets =
+                realloc(prober->targets, new_max * sizeof(*new_targets));
+            if (new_targets == NULL) {
+                perror("realloc");
+                return NULL;
+            }
+            prober->targets = new_targets;
+            prober->max_targets = new_max;
+        }
+
+        target = calloc(1, sizeof(*target));
+        if (target == NULL) {
+            perror("calloc");
+            return NULL;
+        }
+        if (init_target(target, name, addr, addr_len) != 0) {
+            free(target);
+            return NULL;
+        }
+
+        /*
+         * Every target gets its own ICMP ID so that replies from the same
+         * address can still be told apart if it appears in the list more
+         * than once.
+         */
+        target->id = (uint16_t)(prober->base_id + prober->num_targets);
+        target->index = prober->num_targets;
+
+        prober->num_targets++;
+        if (hash_insert(prober, target) != 0) {
+            perror("calloc");
+            prober->num_targets--;
+            free(target->name);
+            free(target);
+            return NULL;
+        }
+        prober->targets[prober->num_targets - 1] = target;
+    }
+
+    if (prober->sockets_open && setup_target(prober, target) != 0) {
+        hash_remove(prober, target);
+        target->resolve_state = TARGET_REMOVED;
+        prober->num_removed++;
+        return NULL;
+    }
+
+    return target;
+}
+
+struct probe_target *prober_add_target(struct prober *prober,
+                                       const char *name)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    int family = ip_family(prober->config.ip_version);
+    int error;
+
+    memset(&addr, 0, sizeof(addr));
+    error = resolver_lookup(name, family, AI_NUMERICHOST, &addr, &addr_len);
+    if (error != 0 && prober->resolver != NULL) {
+        return add_target(prober, name, NULL, 0);
+    } else if (error != 0) {
+        error = resolver_lookup(name, family, 0, &addr, &addr_len);
+        if (error != 0) {
+            resolver_print_error(name, error, errno);
+            return NULL;
+        }
+    }
+    return add_target(prober, name, &addr, addr_len);
+}
+
+int prober_add_all_addresses(struct prober *prober, const char *name)
+{
+    struct sockaddr_storage addrs[MAX_ADDRESSES_PER_NAME];
+    socklen_t addr_lens[MAX_ADDRESSES_PER_NAME];
+    size_t num_addrs = 0;
+    int family = AF_UNSPEC;
+    size_t i;
+    int error;
+
+    if (prober->config.ip_version == IP_V4) {
+        family = AF_INET;
+    } else if (prober->config.ip_version == IP_V6) {
+        family = AF_INET6;
+    }
+
+    error = resolver_lookup_all(name,
+                                family,
+                                addrs,
+                                addr_lens,
+                                MAX_ADDRESSES_PER_NAME,
+                                &num_addrs);
+    if (error != 0) {
+        resolver_print_error(name, error, errno);
+        return -1;
+    }
+    for (i = 0; i < num_addrs; i++) {
+        if (add_target(prober, name, &addrs[i], addr_lens[i]) == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void prober_remove_target(struct prober *prober, struct probe_target *target)
+{
+    unsigned long count = prober->config.count;
+    unsigned int i;
+
+    if (target->resolve_state == TARGET_REMOVED) {
+        return;
+    }
+    hash_remove(prober, target);
+
+    for (i = 0; target->slots != NULL && i <= target->slot_mask; i++) {
+        if (target->slots[i].in_use) {
+            target->slots[i].in_use = 0;
+            prober->num_outstanding--;
+        }
+    }
+    if (prober->running) {
+        if (target->resolve_state != TARGET_UNRESOLVABLE
+            && (count == 0 || target->sent < count)) {
+            prober->num_unfinished--;
+        }
+        if (target->resolve_state == TARGET_RESOLVING) {
+            prober->num_resolving--;
+        }
+    }
+
+    target->resolve_state = TARGET_REMOVED;
+    prober->num_removed++;
+}
+
+int prober_start(struct prober *prober)
+{
+    size_t i;
+
+    prober->num_unfinished = 0;
+    for (i = 0; i < prober->num_targets; i++) {
+        int state = prober->targets[i]->resolve_state;
+        if (state != TARGET_REMOVED && state != TARGET_UNRESOLVABLE) {
+            prober->num_unfinished++;
+        }
+    }
+    if (start_resolving(prober) != 0) {
+        return -1;
+    }
+
+    prober->start_time = ntime();
+    prober->next_tick = (uint64_t)-1;
+    if (prober->config.tick_interval > 0) {
+        prober->next_tick = prober->start_time + prober->config.tick_interval;
+    }
+    if (prober->config.flood) {
+        for (i = 0; i < prober->num_targets; i++) {
+            flood_push(prober, prober->targets[i]);
+        }
+    }
+
+    prober->running = 1;
+    return 0;
+}
+
+/*
+ * Sends what is due, then waits for replies (or only checks for them) and
+ * reads them. Sets *busy if there may be more to do right away.
+ */
+static int poll_once(struct prober *prober,
+                     int wait,
+                     probe_event_handler handler,
+                     void *arg,
+                     int *busy)
+{
+    uint64_t now = ntime();
+    uint64_t deadline;
+    void *ready[2];
+    int num_ready;
+    int error = 0;
+    int i;
+
+    expire_probes(prober, now, handler, arg);
+
+    if (prober->resolver_client.resolver != NULL) {
+        handle_lookups(prober, now, handler, arg);
+        if (refresh_names(prober, now) != 0) {
+            return -1;
+        }
+    }
+
+    if (now >= prober->next_tick) {
+        struct probe_event event = {0};
+        event.type = PROBE_EVENT_TICK;
+        dispatch(prober, &event, handler, arg);
+        while (prober->next_tick <= now) {
+            prober->next_tick += prober->config.tick_interval;
+        }
+    }
+    if (prober->stats_requested) {
+        struct probe_event event = {0};
+        prober->stats_requested = 0;
+        event.type = PROBE_EVENT_STATS;
+        handler(&event, arg);
+    }
+
+    deadline = prober->config.flood
+        ? send_flood(prober, now, handler, arg, &error)
+        : send_scheduled(prober, now, handler, arg, &error);
+    if (error) {
+        return -1;
+    }
+
+    if (icmp_socket_flush(&prober->sock4) != 0
+        || icmp_socket_flush(&prober->sock6) != 0) {
+        return -1;
+    }
+
+    if (deadline == (uint64_t)-1
+        && prober->num_outstanding == 0
+        && prober->num_resolving == 0) {
+        return 1;
+    }
+
+    if (prober->pending_count > 0
+        && prober->pending[0].deadline < deadline) {
+        deadline = prober->pending[0].deadline;
+    }
+    if (prober->next_tick < deadline) {
+        deadline = prober->next_tick;
+    }
+    if (prober->refresh_count > 0) {
+        const struct probe_target *target =
+            prober->refresh_queue[prober->refresh_head];
+        if (target->resolve_due < deadline) {
+            deadline = target->resolve_due;
+        }
+    }
+#ifndef EVLOOP_WAKEUP
+    /*
+     * Nothing interrupts the wait when a lookup completes.
+     */
+    if (prober->num_resolving > 0
+        && deadline > now + RESOLVE_POLL_INTERVAL) {
+        deadline = now + RESOLVE_POLL_INTERVAL;
+    }
+#endif
+
+    if (wait) {
+        num_ready = evloop_wait(&prober->loop, deadline, ready, 2);
+        if (num_ready < 0) {
+            psockerror("evloop_wait");
+            return -1;
+        }
+    } else {
+        num_ready = evloop_poll(&prober->loop, deadline, ready, 2);
+        if (num_ready < 0) {
+            psockerror("evloop_poll");
+            return -1;
+        }
+    }
+
+    for (i = 0; i < num_ready; i++) {
+        if (receive_replies(prober, ready[i], handler, arg) != 0) {
+            return -1;
+        }
+    }
+
+    *busy = num_ready > 0 || deadline <= ntime();
+    return 0;
+}
+
+int prober_poll(struct prober *prober,
+                int wait,
+                probe_event_handler handler,
+                void *arg)
+{
+    int passes = 0;
+    int busy = 0;
+    int result;
+
+    do {
+        result = poll_once(prober, wait, handler, arg, &busy);
+    } while (result == 0 && !wait && busy && ++passes < MAX_POLL_PASSES);
+
+    /*
+     * Make sure that the caller comes back for the rest.
+     */
+    if (result == 0 && !wait && busy) {
+        evloop_wake(&prober->loop);
+    }
+    return result;
+}
+
+int prober_run(struct prober *prober, probe_event_handler handler, void *arg)
+{
+    int result = 0;
+
+    if (prober->num_targets == 0) {
+        return 0;
+    }
+    if (prober_start(prober) != 0) {
+        return -1;
+    }
+    while (!prober->stopped && result == 0) {
+        result = prober_poll(prober, 1, handler, arg);
+    }
+    prober->running = 0;
+
+    return result < 0 ? -1 : 0;
+}
+
+int prober_set_payload_size(struct prober *prober, size_t size)
+{
+    size_t i;
+
+    if (size > prober->max_payload_size) {
+        fprintf(stderr,
+                "Payload size %lu is larger than %lu\n",
+                (unsigned long)size,
+                (unsigned long)prober->max_payload_size);
+        return -1;
+    }
+    if (icmp_socket_flush(&prober->sock4) != 0
+        || icmp_socket_flush(&prober->sock6) != 0) {
+        return -1;
+    }
+
+    prober->config.payload_size = size;
+    prober->payload_sum = checksum_add(0,
+                                       prober->packet + ICMP_HEADER_LENGTH,
+                                       size);
+    icmp_socket_set_send_size(&prober->sock4, ICMP_HEADER_LENGTH + size);
+    icmp_socket_set_send_size(&prober->sock6, ICMP_HEADER_LENGTH + size);
+
+    /*
+     * The checksums in the request headers cover the payload.
+     */
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        if (target->resolve_state != TARGET_RESOLVED) {
+            continue;
+        }
+        build_request(prober,
+                      target,
+                      target->addr.ss_family == AF_INET6
+                          ? &prober->sock6
+                          : &prober->sock4);
+    }
+    return 0;
+}
+
+void prober_reset(struct prober *prober)
+{
+    size_t i;
+
+    for (i = 0; i < prober->num_targets; i++) {
+        struct probe_target *target = prober->targets[i];
+        target->sent = 0;
+        stats_destroy(&target->stats);
+    }
+    prober->round = 0;
+    prober->cursor = 0;
+}
+
+void prober_stop(struct prober *prober)
+{
+    prober->stopped = 1;
+    evloop_wake(&prober->loop);
+}
+
+void prober_request_stats(struct prober *prober)
+{
+    prober->stats_requested = 1;
+    evloop_wake(&prober->loop);
+}
+
+void prober_destroy(struct prober *prober)
+{
+    size_t i;
+
+    resolver_client_destroy(&prober->resolver_client);
+    evloop_destroy(&prober->loop);
+    icmp_socket_close(&prober->sock4);
+    icmp_socket_close(&prober->sock6);
+    for (i = 0; i < prober->num_targets && !prober->shared_targets; i++) {
+        stats_destroy(&prober->targets[i]->stats);
+        free(prober->targets[i]->slots);
+        free(prober->targets[i]->answered);
+        free(prober->targets[i]->name);
+        free(prober->targets[i]);
+    }
+    free(prober->targets);
+    free(prober->hash_table);
+    free(prober->pending);
+    free(prober->flood_queue);
+    free(prober->refresh_queue);
+    free(prober->packet);
+    memset(prober, 0, sizeof(*prober));
+    prober->sock4.fd = -1;
+    prober->sock6.fd = -1;
+}
@@ -0,0 +1,363 @@
+#ifndef PROBER_H
+#define PROBER_H
+
+#include "platform.h"
+#include "evloop.h"
+#include "icmp_socket.h"
+#include "resolver.h"
+#include "stats.h"
+
+#define IP_VERSION_ANY 0
+#define IP_V4 4
+#define IP_V6 6
+
+#define ICMP_PAYLOAD_SIZE 32
+
+/*
+ * All times and durations are in nanoseconds.
+ */
+#define REQUEST_TIMEOUT 1000000000
+#define REQUEST_INTERVAL 1000000000
+
+#define MAX_WINDOW 4096
+
+#define TARGET_RESOLVED 0
+#define TARGET_RESOLVING 1    /* waiting for the first lookup */
+#define TARGET_UNRESOLVABLE 2 /* the first lookup failed */
+#define TARGET_REMOVED 3      /* see prober_remove_target() */
+
+/*
+ * A request that has been sent to a target and is waiting for a reply.
+ */
+struct probe_slot {
+    uint64_t send_time;      /* by our clock, right before sending */
+    uint32_t lateness;       /* behind schedule, capped at ~4 s */
+    uint32_t tx_delay;       /* until the kernel's send timestamp */
+    uint16_t seq;
+    uint8_t in_use;
+    uint8_t flags;
+};
+
+/*
+ * A single host that is being pinged.
+ */
+struct probe_target {
+    char *name;
+    size_t index;            /* in prober->targets */
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char addr_str[INET6_ADDRSTRLEN]; /* empty until resolved */
+    int resolve_state;
+    int dynamic;             /* a host name, looked up again from time to
+                                time */
+    uint64_t resolve_time;   /* how long the last lookup took */
+    uint64_t resolve_due;    /* when to look it up again */
+    uint16_t id;
+    uint16_t seq;            /* sequence number of the next request */
+    uint32_t request[ICMP_HEADER_LENGTH / 4]; /* header for seq 0 */
+    struct probe_slot *slots; /* requests in flight, indexed by seq */
+    uint32_t *answered;      /* a bit per slot, set once a reply came */
+    uint16_t slot_mask;
+    uint16_t newest_reply;   /* highest seq answered in time */
+    int flood_queued;        /* in the flood mode send queue */
+    int refresh_queued;      /* in the refresh queue */
+    int lookup_pending;      /* a lookup has been requested */
+    uint64_t srtt;           /* smoothed RTT, 0 until the first reply */
+    uint64_t rttvar;         /* and its variation */
+    uint64_t timeout;        /* adaptive, 0 = config.timeout */
+    unsigned long sent;
+    struct rtt_stats stats;
+    void *user_data;         /* not used by the prober */
+    struct probe_target *hash_next;
+};
+
+struct prober_config {
+    int ip_version;
+    size_t payload_size;
+    uint64_t interval;       /* between two requests to the same target */
+    uint64_t rate;           /* requests per second in total, overrides
+                                interval if not 0 */
+    int flood;               /* send as soon as replies come back */
+    uint64_t timeout;        /* for each request; the ceiling of adaptive
+                                timeouts */
+    uint64_t min_timeout;    /* adapt the timeout to each target's RTTs,
+                                but not below this; 0 = fixed */
+    unsigned long count;     /* requests per target, 0 means no limit */
+    uint64_t tick_interval;  /* how often to report PROBE_EVENT_TICK, 0 =
+                                never */
+    unsigned int window;     /* requests in flight per target, 0 = auto */
+    int raw_sockets;         /* don't use unprivileged ping sockets */
+    int io_uring;            /* do socket I/O through io_uring */
+    int packet_ring;         /* read replies from an AF_PACKET ring */
+    uint64_t dns_ttl;        /* look host names up again this often, 0 =
+                                never */
+    int dont_fragment;       /* set DF, drop requests above the path MTU */
+};
+
+#define PROBE_EVENT_REPLY 1
+#define PROBE_EVENT_TIMEOUT 2
+#define PROBE_EVENT_TICK 3 /* periodic, not related to any target */
+#define PROBE_EVENT_RESOLVE 4 /* the target's name resolved to a (new)
+                                 address, see target->resolve_time */
+#define PROBE_EVENT_STATS 5 /* asked for with prober_request_stats(), not
+                               related to any target */
+#define PROBE_EVENT_LATE 6 /* a reply to a request that already timed out,
+                              with its RTT */
+#define PROBE_EVENT_DUPLICATE 7 /* another reply to the same request */
+
+#define PROBE_FLAG_BAD_CHECKSUM 0x01
+#define PROBE_FLAG_KERNEL_TX 0x02 /* send time taken by the kernel */
+#define PROBE_FLAG_KERNEL_RX 0x04 /* receive time taken by the kernel */
+#define PROBE_FLAG_CACHED 0x08    /* address taken from the DNS cache */
+#define PROBE_FLAG_ONE_WAY 0x10   /* the one-way delays below are known */
+#define PROBE_FLAG_REORDERED 0x20 /* later requests were answered first */
+
+struct probe_event {
+    int type;
+    struct probe_target *target;
+    uint16_t seq;
+    uint64_t rtt;
+    uint64_t user_rtt;       /* by our own clock, including our delays */
+    uint64_t forward_delay;  /* until the request reached a reflector */
+    uint64_t return_delay;   /* from the reflector back to us */
+    uint64_t lateness;       /* how late the request was sent */
+    uint16_t reorder;        /* with PROBE_FLAG_REORDERED, by how many
+                                sequence numbers */
+    int flags;
+};
+
+typedef void (*probe_event_handler)(const struct probe_event *event,
+                                    void *arg);
+
+/*
+ * A sent request that may not have been answered yet, kept in a heap
+ * ordered by deadline.
+ */
+struct pending_probe {
+    struct probe_target *target;
+    uint16_t seq;
+    uint64_t deadline;
+};
+
+/*
+ * How closely the actual send times followed the schedule.
+ */
+struct schedule_stats {
+    unsigned long sends;
+    uint64_t lateness_sum;
+    uint64_t lateness_max;
+};
+
+/*
+ * How much longer the round trips look from user space than by the kernel's
+ * timestamps, for replies with at least one of those: the time it takes us
+ * to send a request and to pick up its reply.
+ */
+struct overhead_stats {
+    unsigned long replies;
+    uint64_t sum;
+    uint64_t max;
+};
+
+/*
+ * Where the time goes between the network and the results, to tell our
+ * own delays apart from the network's. Cheap enough to always keep: a few
+ * counters and clock reads per reply.
+ */
+struct hot_path_stats {
+    unsigned long receive_delays; /* replies with a kernel receive time */
+    uint64_t receive_delay_sum; /* from then until the receive call
+                                   returned */
+    uint64_t receive_delay_max;
+    unsigned long checksums;
+    uint64_t checksum_time;
+    unsigned long handler_calls;
+    uint64_t handler_time;   /* in the event handler, i.e. formatting and
+                                writing out the results */
+    unsigned long not_replies; /* discarded: not an echo reply */
+    unsigned long unknown;   /* discarded: unknown ID or address */
+    unsigned long stale;     /* discarded: too old to tell whether it's
+                                late or a duplicate */
+    unsigned long bad_checksums; /* reported with PROBE_FLAG_BAD_CHECKSUM */
+};
+
+/*
+ * How long host name lookups took, not counting cache hits.
+ */
+struct resolve_stats {
+    unsigned long lookups;
+    unsigned long failures;
+    uint64_t time_sum;
+    uint64_t time_max;
+};
+
+/*
+ * The probing engine: a set of targets pinged in round-robin order through
+ * one ICMP socket per address family. Requests are sent on a fixed schedule,
+ * independently of replies, so several of them may be in flight to the same
+ * target at any time.
+ *
+ * The schedule is a sequence of absolute send times computed from the start
+ * time, so that errors don't accumulate. In flood mode there is no schedule:
+ * a target is sent a new request as soon as there is room in its window.
+ *
+ * Host names are resolved in the background by a resolver shared with other
+ * probers. Targets sit out their turns in the schedule until they have an
+ * address, so probing starts as soon as the first of them is resolved.
+ */
+struct prober {
+    struct prober_config config;
+    struct icmp_socket sock4;
+    struct icmp_socket sock6;
+    struct evloop loop;
+    struct probe_target **targets;
+    size_t num_targets;
+    size_t max_targets;
+    struct probe_target **hash_table;
+    size_t hash_size;
+    struct pending_probe *pending;
+    size_t pending_size;
+    size_t pending_count;
+    size_t num_outstanding;
+    uint64_t start_time;
+    unsigned long round;     /* index of the next request in the schedule */
+    size_t cursor;
+    size_t num_removed;      /* targets in TARGET_REMOVED */
+    struct probe_target **flood_queue;
+    size_t queue_size;       /* of flood_queue and refresh_queue */
+    size_t flood_head;
+    size_t flood_count;
+    struct schedule_stats schedule;
+    struct resolver *resolver; /* NULL to resolve names right away */
+    struct resolver_client resolver_client;
+    struct probe_target **refresh_queue; /* ordered by resolve_due */
+    size_t refresh_head;
+    size_t refresh_count;
+    size_t num_resolving;    /* targets in TARGET_RESOLVING */
+    size_t num_unfinished;   /* targets that have requests left to send */
+    struct resolve_stats resolve;
+    struct overhead_stats overhead;
+    struct hot_path_stats hot_path;
+    char *packet;
+    size_t max_payload_size; /* what packet was allocated for */
+    uint32_t payload_sum;    /* partial checksum of the payload */
+    uint64_t next_tick;
+    uint16_t base_id;
+    int shared_targets;      /* the targets belong to another prober */
+    int sockets_open;        /* targets added from now on are set up right
+                                away */
+    int running;             /* between prober_start() and the end */
+    volatile int stats_requested;
+    volatile int stopped;
+};
+
+/**
+ * Initializes a prober with the given configuration. Returns 0 on success
+ * or -1 on error.
+ */
+int prober_init(struct prober *prober, const struct prober_config *config);
+
+/**
+ * Adds a host to the list of targets. Addresses are used as they are. Host
+ * names are resolved right away if prober->resolver is NULL, otherwise in
+ * the background once prober_run() starts. Errors are reported to stderr
+ * and NULL is returned.
+ *
+ * Targets can also be added after prober_start(), from the thread that
+ * calls prober_poll(). They take the place of removed ones if there are
+ * any, and are pinged from the next round on.
+ */
+struct probe_target *prober_add_target(struct prober *prober,
+                                       const char *name);
+
+/**
+ * Resolves a host name into all of its IPv4 and IPv6 addresses (only
+ * those of config.ip_version if it's set) right away and adds each of
+ * them as a target of its own, so that they can be compared. The targets
+ * are added next to each other and keep the name. Returns -1 on error,
+ * after reporting it to stderr.
+ */
+int prober_add_all_addresses(struct prober *prober, const char *name);
+
+/**
+ * Initializes a prober that pings count targets of the parent, starting
+ * from the first one, so that several of them can run in parallel. The
+ * targets remain owned by the parent, and their IDs and share of the rate
+ * stay the same. Call prober_open_sockets() next.
+ */
+int prober_init_shard(struct prober *shard,
+                      const struct prober *parent,
+                      size_t first,
+                      size_t count);
+
+/**
+ * Opens a socket for each address family used by the targets and prepares
+ * them for probing. This must be done before dropping privileges, in case
+ * a raw socket is needed, and after all targets have been added.
+ */
+int prober_open_sockets(struct prober *prober);
+
+/**
+ * Stops pinging the target. Requests in flight to it are forgotten, without
+ * reporting them. The target stays in prober->targets with its index, in
+ * TARGET_REMOVED, until prober_add_target() reuses it.
+ */
+void prober_remove_target(struct prober *prober, struct probe_target *target);
+
+/**
+ * Pings all targets until every one of them has been sent config.count
+ * requests (or forever if count is 0) or prober_stop() is called, invoking
+ * the handler for each reply and timeout. Returns 0 on success or -1 on
+ * error.
+ */
+int prober_run(struct prober *prober, probe_event_handler handler, void *arg);
+
+/**
+ * Starts the schedule and the lookups, for driving the prober with
+ * prober_poll() rather than prober_run(). Returns -1 on error.
+ */
+int prober_start(struct prober *prober);
+
+/**
+ * Sends the requests that are due and handles the replies, lookups and
+ * timeouts that have come in, invoking the handler for each of them. If
+ * wait is set, first waits until something happens, otherwise returns
+ * right away: in that case, call it again once evloop_fd(&prober->loop) is
+ * readable. Returns 1 once all requests have been sent and answered or
+ * timed out, 0 if there is more to do or -1 on error.
+ */
+int prober_poll(struct prober *prober,
+                int wait,
+                probe_event_handler handler,
+                void *arg);
+
+/**
+ * Changes the payload size of the requests sent from now on. It can't be
+ * larger than config.payload_size was when the prober was initialized.
+ * Returns -1 if it is, or if queued requests couldn't be sent.
+ */
+int prober_set_payload_size(struct prober *prober, size_t size);
+
+/**
+ * Clears the send counts and statistics of all targets, so that
+ * prober_run() can be called again for another round of config.count
+ * requests each.
+ */
+void prober_reset(struct prober *prober);
+
+/**
+ * Asks prober_run() to return as soon as possible. Safe to call from
+ * a signal handler or another thread.
+ */
+void prober_stop(struct prober *prober);
+
+/**
+ * Asks for a PROBE_EVENT_STATS event, e.g. to show the run statistics
+ * while the prober keeps going. Safe to call from a signal handler or
+ * another thread.
+ */
+void prober_request_stats(struct prober *prober);
+
+void prober_destroy(struct prober *prober);
+
+#endif /* PROBER_H */
@@ -0,0 +1,558 @@
+#include "reflector.h"
+#include "checksum.h"
+
+#ifdef HAVE_REFLECTOR
+    #include <net/if.h>         /* struct ifreq */
+    #include <sys/ioctl.h>
+    #include <linux/if_tun.h>   /* TUNSETIFF */
+#endif
+
+#define ICMP_ECHO_REQUEST_TYPE 8
+#define ICMP_ECHO_REPLY_TYPE 0
+#define ICMP6_ECHO_REQUEST_TYPE 128
+#define ICMP6_ECHO_REPLY_TYPE 129
+
+#define IPV4_HEADER_LENGTH 20
+#define IPV6_HEADER_LENGTH 40
+#define REPLY_HOP_LIMIT 64
+
+/*
+ * The largest IP packet, and so the largest echo request we can answer.
+ */
+#define MAX_PACKET_SIZE 65535
+
+#define TUN_DEVICE "/dev/net/tun"
+
+static uint32_t get_be32(const char *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+
+    return ((uint32_t)b[0] << 24)
+        | ((uint32_t)b[1] << 16)
+        | ((uint32_t)b[2] << 8)
+        | b[3];
+}
+
+static uint64_t get_be64(const char *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+int reflector_read_timestamps(const char *icmp,
+                              size_t len,
+                              uint64_t *receive_time,
+                              uint64_t *send_time)
+{
+    const char *payload = icmp + ICMP_HEADER_LENGTH;
+
+    if (len < ICMP_HEADER_LENGTH + REFLECTOR_TIMESTAMPS_SIZE
+        || get_be32(payload) != REFLECTOR_MAGIC) {
+        return -1;
+    }
+    *receive_time = get_be64(payload + 8);
+    *send_time = get_be64(payload + 16);
+    return 0;
+}
+
+#ifdef HAVE_REFLECTOR
+
+static void put_be32(char *p, uint32_t value)
+{
+    int i;
+
+    for (i = 3; i >= 0; i--) {
+        p[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+static void put_be64(char *p, uint64_t value)
+{
+    put_be32(p, (uint32_t)(value >> 32));
+    put_be32(p + 4, (uint32_t)value);
+}
+
+static void swap_bytes(char *a, char *b, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        char c = a[i];
+        a[i] = b[i];
+        b[i] = c;
+    }
+}
+
+static void put_checksum(char *p, uint16_t checksum)
+{
+    memcpy(p, &checksum, sizeof(checksum));
+}
+
+/*
+ * Stamps the payload right before the reply goes out, if it's large enough.
+ */
+static void write_timestamps(char *icmp, size_t len, uint64_t receive_time)
+{
+    char *payload = icmp + ICMP_HEADER_LENGTH;
+
+    if (len < ICMP_HEADER_LENGTH + REFLECTOR_TIMESTAMPS_SIZE) {
+        return;
+    }
+    put_be32(payload, REFLECTOR_MAGIC);
+    put_be32(payload + 4, 0);
+    put_be64(payload + 8, receive_time);
+    put_be64(payload + 16, wtime());
+}
+
+/*
+ * Turns an IPv4 echo request into the reply in place. Returns the length of
+ * the reply or 0 if the packet is something else.
+ */
+static size_t reflect_ipv4(const struct reflector *reflector,
+                           char *packet,
+                           size_t len,
+                           uint64_t receive_time)
+{
+    uint8_t *ip = (uint8_t *)packet;
+    size_t hdr_len;
+    size_t total_len;
+    char *icmp;
+
+    if (len < IPV4_HEADER_LENGTH) {
+        return 0;
+    }
+    hdr_len = (ip[0] & 0x0f) * 4;
+    total_len = ((size_t)ip[2] << 8) | ip[3];
+
+    /*
+     * Fragments can't be answered one by one, and a reply must not come
+     * from a broadcast or multicast address.
+     */
+    if (ip[9] != IPPROTO_ICMP
+        || hdr_len < IPV4_HEADER_LENGTH
+        || total_len > len
+        || total_len < hdr_len + ICMP_HEADER_LENGTH
+        || (ip[6] & 0x3f) != 0
+        || ip[7] != 0
+        || ip[16] >= 224
+        || ip[19] == 255) {
+        return 0;
+    }
+    icmp = packet + hdr_len;
+    if ((uint8_t)icmp[0] != ICMP_ECHO_REQUEST_TYPE || icmp[1] != 0) {
+        return 0;
+    }
+
+    swap_bytes(packet + 12, packet + 16, 4);
+    ip[8] = REPLY_HOP_LIMIT;
+    put_checksum(packet + 10, 0);
+    put_checksum(packet + 10, compute_checksum(packet, hdr_len));
+
+    icmp[0] = ICMP_ECHO_REPLY_TYPE;
+    if (reflector->config.timestamps) {
+        write_timestamps(icmp, total_len - hdr_len, receive_time);
+    }
+    put_checksum(icmp + 2, 0);
+    put_checksum(icmp + 2, compute_checksum(icmp, total_len - hdr_len));
+    return total_len;
+}
+
+/*
+ * Same for IPv6, where the checksum also covers a pseudo-header made of
+ * the addresses, the length and the next header. Extension headers are
+ * not supported.
+ */
+static size_t reflect_ipv6(const struct reflector *reflector,
+                           char *packet,
+                           size_t len,
+                           uint64_t receive_time)
+{
+    uint8_t *ip = (uint8_t *)packet;
+    size_t payload_len;
+    uint32_t pseudo_hdr[2];
+    uint32_t sum;
+    char *icmp;
+
+    if (len < IPV6_HEADER_LENGTH) {
+        return 0;
+    }
+    payload_len = ((size_t)ip[4] << 8) | ip[5];
+    if (ip[6] != IPPROTO_ICMPV6
+        || IPV6_HEADER_LENGTH + payload_len > len
+        || payload_len < ICMP_HEADER_LENGTH
+        || ip[24] == 0xff) {
+        return 0;
+    }
+    icmp = packet + IPV6_HEADER_LENGTH;
+    if ((uint8_t)icmp[0] != ICMP6_ECHO_REQUEST_TYPE || icmp[1] != 0) {
+        return 0;
+    }
+
+    swap_bytes(packet + 8, packet + 24, 16);
+    ip[7] = REPLY_HOP_LIMIT;
+
+    icmp[0] = (char)ICMP6_ECHO_REPLY_TYPE;
+    if (reflector->config.timestamps) {
+        write_timestamps(icmp, payload_len, receive_time);
+    }
+    put_checksum(icmp + 2, 0);
+    pseudo_hdr[0] = htonl((uint32_t)payload_len);
+    pseudo_hdr[1] = htonl(IPPROTO_ICMPV6);
+    sum = checksum_add(0, packet + 8, 32);
+    sum = checksum_add(sum, pseudo_hdr, sizeof(pseudo_hdr));
+    sum = checksum_add(sum, icmp, payload_len);
+    put_checksum(icmp + 2, checksum_finish(sum));
+    return IPV6_HEADER_LENGTH + payload_len;
+}
+
+static size_t reflect_packet(const struct reflector *reflector,
+                             char *packet,
+                             size_t len,
+                             uint64_t receive_time)
+{
+    if (len < 1) {
+        return 0;
+    }
+    switch ((uint8_t)packet[0] >> 4) {
+        case 4:
+            return reflect_ipv4(reflector, packet, len, receive_time);
+        case 6:
+            return reflect_ipv6(reflector, packet, len, receive_time);
+    }
+    return 0;
+}
+
+/*
+ * Reads packets from the TUN device and writes back the replies until there
+ * is nothing left to read. The device has no batched I/O, so it takes a
+ * system call per packet each way.
+ */
+static int reflect_tun(struct reflector *reflector)
+{
+    while (!reflector->stopped) {
+        ssize_t len = read(reflector->tun_fd, reflector->buf, MAX_PACKET_SIZE);
+        uint64_t receive_time;
+        size_t reply_len;
+
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            perror("read");
+            return -1;
+        }
+        receive_time = wtime();
+        reflector->stats.received++;
+
+        reply_len = reflect_packet(reflector,
+                                   reflector->buf,
+                                   (size_t)len,
+                                   receive_time);
+        if (reply_len == 0) {
+            continue;
+        }
+        if (write(reflector->tun_fd, reflector->buf, reply_len) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+                perror("write");
+                return -1;
+            }
+            continue;
+        }
+        reflector->stats.replied++;
+    }
+    return 0;
+}
+
+/*
+ * Copies a request read from a raw socket into a send buffer as a whole IP
+ * packet. IPv6 sockets don't see the IP header, so it's made up from the
+ * addresses. Returns the length of the packet or 0 if it can't be answered.
+ */
+static size_t copy_request(const struct icmp_socket *sock,
+                           const struct icmp_message *message,
+                           char *packet)
+{
+    const struct sockaddr_in6 *from;
+    uint8_t *ip = (uint8_t *)packet;
+
+    if (sock->family == AF_INET) {
+        size_t len = message->header_len + message->len;
+        memcpy(packet, message->data - message->header_len, len);
+        return len;
+    }
+
+    from = (const struct sockaddr_in6 *)&message->from;
+    if (message->len > MAX_PACKET_SIZE - IPV6_HEADER_LENGTH
+        || IN6_IS_ADDR_UNSPECIFIED(&message->dst)) {
+        return 0;
+    }
+    memset(packet, 0, IPV6_HEADER_LENGTH);
+    ip[0] = 6 << 4;
+    ip[4] = (uint8_t)(message->len >> 8);
+    ip[5] = (uint8_t)message->len;
+    ip[6] = IPPROTO_ICMPV6;
+    ip[7] = REPLY_HOP_LIMIT;
+    memcpy(packet + 8, &from->sin6_addr, 16);
+    memcpy(packet + 24, &message->dst, 16);
+    memcpy(packet + IPV6_HEADER_LENGTH, message->data, message->len);
+    return IPV6_HEADER_LENGTH + message->len;
+}
+
+/*
+ * Reads requests from a raw socket in batches and sends each batch of
+ * replies at once, until there is nothing left to read.
+ */
+static int reflect_socket(struct reflector *reflector,
+                          struct icmp_socket *sock)
+{
+    socklen_t addr_len = sock->family == AF_INET6
+        ? sizeof(struct sockaddr_in6)
+        : sizeof(struct sockaddr_in);
+
+    while (!reflector->stopped) {
+        struct icmp_message *messages;
+        uint64_t wall_now;
+        int count;
+        int i;
+
+        count = icmp_socket_receive(sock, &messages);
+        if (count <= 0) {
+            return count;
+        }
+        wall_now = wtime();
+        reflector->stats.received += count;
+
+        for (i = 0; i < count; i++) {
+            const struct icmp_message *message = &messages[i];
+            char *packet;
+            size_t len;
+
+            if (message->data == NULL) {
+                continue;
+            }
+            packet = icmp_socket_queue(sock,
+                                       NULL,
+                                       0,
+                                       &message->from,
+                                       addr_len);
+            if (packet == NULL) {
+                return -1;
+            }
+            len = copy_request(sock, message, packet);
+            if (len > 0) {
+                len = reflect_packet(reflector,
+                                     packet,
+                                     len,
+                                     message->kernel_time != 0
+                                         ? message->kernel_time
+                                         : wall_now);
+            }
+            icmp_socket_trim(sock, len);
+            if (len > 0) {
+                reflector->stats.replied++;
+            }
+        }
+
+        /*
+         * The replies point to the addresses in the messages, so they must
+         * be sent before reading the next batch.
+         */
+        if (icmp_socket_flush(sock) != 0) {
+            return -1;
+        }
+        icmp_socket_release(sock);
+    }
+    return 0;
+}
+
+static int open_tun(struct reflector *reflector)
+{
+    struct ifreq ifr;
+
+    reflector->tun_fd = open(TUN_DEVICE, O_RDWR | O_NONBLOCK);
+    if (reflector->tun_fd < 0) {
+        perror(TUN_DEVICE);
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    strncpy(ifr.ifr_name, reflector->config.tun_name, IFNAMSIZ - 1);
+    if (ioctl(reflector->tun_fd, TUNSETIFF, &ifr) != 0) {
+        perror(reflector->config.tun_name);
+        return -1;
+    }
+
+    reflector->buf = malloc(MAX_PACKET_SIZE);
+    if (reflector->buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    if (evloop_add(&reflector->loop,
+                   reflector->tun_fd,
+                   &reflector->tun_fd) != 0) {
+        psockerror("evloop_add");
+        return -1;
+    }
+    return 0;
+}
+
+static int open_socket(struct reflector *reflector,
+                       struct icmp_socket *sock,
+                       int family)
+{
+    char *template_packet;
+    int result;
+
+    /*
+     * Send buffers start out as copies of this, but every reply is copied
+     * over it anyway.
+     */
+    template_packet = calloc(1, MAX_PACKET_SIZE);
+    if (template_packet == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    result = icmp_socket_open(sock,
+                              family,
+                              template_packet,
+                              MAX_PACKET_SIZE,
+                              ICMP_SOCKET_RAW
+                                  | ICMP_SOCKET_LARGE_BUFFERS
+                                  | ICMP_SOCKET_NO_TX_TIMESTAMPS);
+    free(template_packet);
+    if (result != 0) {
+        return -1;
+    }
+
+    /*
+     * Without a filter the requests are picked out of all ICMP traffic.
+     */
+    icmp_socket_set_request_filter(sock);
+
+    if (icmp_socket_include_header(sock) != 0) {
+        psockerror("setsockopt");
+        return -1;
+    }
+
+    if (evloop_add(&reflector->loop, sock->fd, sock) != 0) {
+        psockerror("evloop_add");
+        return -1;
+    }
+    return 0;
+}
+
+int reflector_init(struct reflector *reflector,
+                   const struct reflector_config *config)
+{
+    memset(reflector, 0, sizeof(*reflector));
+    reflector->config = *config;
+    reflector->tun_fd = -1;
+    reflector->sock4.fd = -1;
+    reflector->sock6.fd = -1;
+
+    if (evloop_init(&reflector->loop) != 0) {
+        psockerror("evloop_init");
+        return -1;
+    }
+    reflector->loop_ready = 1;
+
+    if (config->tun_name != NULL) {
+        if (open_tun(reflector) != 0) {
+            goto error;
+        }
+        return 0;
+    }
+
+    if (config->family != AF_INET6
+        && open_socket(reflector, &reflector->sock4, AF_INET) != 0) {
+        goto error;
+    }
+    if (config->family != AF_INET
+        && open_socket(reflector, &reflector->sock6, AF_INET6) != 0) {
+        goto error;
+    }
+    return 0;
+
+error:
+    reflector_destroy(reflector);
+    return -1;
+}
+
+int reflector_run(struct reflector *reflector)
+{
+    while (!reflector->stopped) {
+        void *ready[2];
+        int count;
+        int i;
+
+        count = evloop_wait(&reflector->loop, (uint64_t)-1, ready, 2);
+        if (count < 0) {
+            psockerror("evloop_wait");
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            int result = ready[i] == &reflector->tun_fd
+                ? reflect_tun(reflector)
+                : reflect_socket(reflector, ready[i]);
+            if (result != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void reflector_stop(struct reflector *reflector)
+{
+    reflector->stopped = 1;
+    if (reflector->loop_ready) {
+        evloop_wake(&reflector->loop);
+    }
+}
+
+void reflector_destroy(struct reflector *reflector)
+{
+    if (reflector->tun_fd >= 0) {
+        close(reflector->tun_fd);
+        reflector->tun_fd = -1;
+    }
+    icmp_socket_close(&reflector->sock4);
+    icmp_socket_close(&reflector->sock6);
+    free(reflector->buf);
+    reflector->buf = NULL;
+    if (reflector->loop_ready) {
+        evloop_destroy(&reflector->loop);
+        reflector->loop_ready = 0;
+    }
+}
+
+#else /* HAVE_REFLECTOR */
+
+int reflector_init(struct reflector *reflector,
+                   const struct reflector_config *config)
+{
+    memset(reflector, 0, sizeof(*reflector));
+    reflector->config = *config;
+    fprintf(stderr, "Answering echo requests is only supported on Linux\n");
+    return -1;
+}
+
+int reflector_run(struct reflector *reflector)
+{
+    (void)reflector;
+    return -1;
+}
+
+void reflector_stop(struct reflector *reflector)
+{
+    reflector->stopped = 1;
+}
+
+void reflector_destroy(struct reflector *reflector)
+{
+    (void)reflector;
+}
+
+#endif /* !HAVE_REFLECTOR */
@@ -0,0 +1,96 @@
+#ifndef REFLECTOR_H
+#define REFLECTOR_H
+
+#include "platform.h"
+#include "icmp_socket.h"
+#include "evloop.h"
+
+#ifdef __linux__
+    #define HAVE_REFLECTOR
+#endif
+
+/*
+ * With timestamps enabled, the reflector overwrites the start of the
+ * payload of every reply that has room for it with:
+ *
+ *   offset  size  field
+ *   0       4     REFLECTOR_MAGIC
+ *   4       4     zero
+ *   8       8     when the request arrived, ns since the Unix epoch
+ *   16      8     when the reply was sent, ns since the Unix epoch
+ *
+ * all in network byte order, so that the sender can tell the delays of the
+ * two directions apart, as far as the clocks of both hosts agree.
+ */
+#define REFLECTOR_MAGIC 0x63707274 /* "cprt" */
+#define REFLECTOR_TIMESTAMPS_SIZE 24
+
+struct reflector_config {
+    const char *tun_name;    /* TUN device to answer on, NULL: raw sockets */
+    int family;              /* raw sockets: AF_INET, AF_INET6, AF_UNSPEC */
+    int timestamps;          /* write timestamps into the payload */
+};
+
+struct reflector_stats {
+    unsigned long received;  /* packets read */
+    unsigned long replied;   /* echo requests answered */
+};
+
+/*
+ * Answers echo requests from user space, independently of the kernel's
+ * echo_ignore_all and rate limit settings.
+ *
+ * On a TUN device, every packet routed to it is read and echo requests are
+ * written back with the addresses swapped. This works on a single host:
+ * pinging an address routed through the device reaches the reflector, and
+ * its replies go back up the local stack.
+ *
+ * With raw sockets, echo requests are read in batches with recvmmsg() and
+ * the replies sent with sendmmsg(), IP header included so that they come
+ * from the address the request was sent to. The kernel answers these
+ * requests itself as well unless told not to (net.ipv4.icmp_echo_ignore_all
+ * and net.ipv6.icmp.echo_ignore_all).
+ */
+struct reflector {
+    struct reflector_config config;
+    int tun_fd;
+    struct icmp_socket sock4;
+    struct icmp_socket sock6;
+    char *buf;               /* packets read from the TUN device */
+    struct evloop loop;
+    int loop_ready;
+    volatile int stopped;
+    struct reflector_stats stats;
+};
+
+/**
+ * Opens the TUN device or the raw sockets. The device must already exist
+ * and be configured, e.g. with "ip tuntap add dev NAME mode tun".
+ * Returns 0 on success or -1 on error.
+ */
+int reflector_init(struct reflector *reflector,
+                   const struct reflector_config *config);
+
+/**
+ * Answers echo requests until reflector_stop() is called. Returns -1 on
+ * error.
+ */
+int reflector_run(struct reflector *reflector);
+
+/**
+ * Makes reflector_run() return. Safe to call from a signal handler.
+ */
+void reflector_stop(struct reflector *reflector);
+
+void reflector_destroy(struct reflector *reflector);
+
+/**
+ * Reads the timestamps written by a reflector from an echo reply (starting
+ * at the ICMP header). Returns -1 if there are none.
+ */
+int reflector_read_timestamps(const char *icmp,
+                              size_t len,
+                              uint64_t *receive_time,
+                              uint64_t *send_time);
+
+#endif /* REFLECTOR_H */
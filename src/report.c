@@ -0,0 +1,1111 @@
+#include "report.h"
+
+#define PUT_LITERAL(p, s) put_string(p, s, sizeof(s) - 1)
+
+static const char *format_names[] = {"human", "json", "csv", "binary"};
+
+static const char *event_names[] = {
+    NULL, "reply", "timeout", NULL, "resolve", NULL, "late", "duplicate"
+};
+
+/*
+ * Writers for the machine readable formats. They are called for every event,
+ * so they avoid the printf() family. The caller makes sure that there is
+ * enough room in the buffer.
+ */
+
+static char *put_string(char *p, const char *s, size_t len)
+{
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static char *put_uint(char *p, uint64_t value)
+{
+    char digits[20];
+    size_t n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+/*
+ * Writes value / 10^decimals with all of the decimals.
+ */
+static char *put_fixed(char *p, uint64_t value, int decimals)
+{
+    uint64_t scale = 1;
+    int i;
+
+    for (i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    p = put_uint(p, value / scale);
+    *p++ = '.';
+    value %= scale;
+    for (i = decimals - 1; i >= 0; i--) {
+        p[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return p + decimals;
+}
+
+/*
+ * Needs up to 6 * strlen(s) + 2 bytes.
+ */
+static char *put_json_string(char *p, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *p++ = '"';
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+/*
+ * Needs up to 2 * strlen(s) + 2 bytes.
+ */
+static char *put_csv_string(char *p, const char *s)
+{
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        return put_string(p, s, strlen(s));
+    }
+    *p++ = '"';
+    for (; *s != '\0'; s++) {
+        if (*s == '"') {
+            *p++ = '"';
+        }
+        *p++ = *s;
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char *put_le(char *p, uint64_t value, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        *p++ = (char)(value & 0xff);
+        value >>= 8;
+    }
+    return p;
+}
+
+static void write_human_event(struct report *report,
+                              const struct probe_event *event)
+{
+    const struct probe_target *target = event->target;
+    const char *timestamp = "";
+    const char *separator = "";
+
+    if (report->show_timestamp) {
+        size_t len;
+        timestamp = timestamp_format(&report->timestamp, wtime(), &len);
+        separator = " ";
+    }
+    if (event->type == PROBE_EVENT_RESOLVE) {
+        output_printf(&report->out,
+                      "%s%sResolved %s to %s in %.3f ms%s\n",
+                      timestamp,
+                      separator,
+                      target->name,
+                      target->addr_str,
+                      (double)target->resolve_time / 1000000.0,
+                      (event->flags & PROBE_FLAG_CACHED) != 0
+                          ? " (cached)"
+                          : "");
+    } else if (event->type != PROBE_EVENT_TIMEOUT) {
+        const char *kind = "Reply";
+        if (event->type == PROBE_EVENT_LATE) {
+            kind = "Late reply";
+        } else if (event->type == PROBE_EVENT_DUPLICATE) {
+            kind = "Duplicate reply";
+        }
+        output_printf(&report->out,
+                      "%s%s%s from %s: seq=%d, time=%.3f ms",
+                      timestamp,
+                      separator,
+                      kind,
+                      target->addr_str,
+                      event->seq,
+                      (double)event->rtt / 1000000.0);
+        if ((event->flags & PROBE_FLAG_REORDERED) != 0) {
+            output_printf(&report->out,
+                          " (reordered by %d)",
+                          event->reorder);
+        }
+        if ((event->flags & PROBE_FLAG_ONE_WAY) != 0) {
+            output_printf(&report->out,
+                          " (out=%.3f ms, back=%.3f ms)",
+                          (double)event->forward_delay / 1000000.0,
+                          (double)event->return_delay / 1000000.0);
+        }
+        output_printf(&report->out,
+                      "%s\n",
+                      (event->flags & PROBE_FLAG_BAD_CHECKSUM) != 0
+                          ? " (bad checksum)"
+                          : "");
+    } else if (report->multi_target) {
+        output_printf(&report->out,
+                      "%s%sRequest to %s timed out: seq=%d\n",
+                      timestamp,
+                      separator,
+                      target->addr_str,
+                      event->seq);
+    } else {
+        output_printf(&report->out,
+                      "%s%sRequest timed out: seq=%d\n",
+                      timestamp,
+                      separator,
+                      event->seq);
+    }
+}
+
+static void write_json_event(struct report *report,
+                             const struct probe_event *event)
+{
+    const struct probe_target *target = event->target;
+    const char *type = event_names[event->type];
+    char *start;
+    char *p;
+
+    start = output_reserve(&report->out, 256 + 6 * strlen(target->name));
+    if (start == NULL) {
+        return;
+    }
+    p = PUT_LITERAL(start, "{\"type\":\"");
+    p = put_string(p, type, strlen(type));
+    p = PUT_LITERAL(p, "\",\"time\":");
+    p = put_fixed(p, wtime() / 1000, 6);
+    p = PUT_LITERAL(p, ",\"target\":");
+    p = put_json_string(p, target->name);
+    p = PUT_LITERAL(p, ",\"addr\":\"");
+    p = put_string(p, target->addr_str, strlen(target->addr_str));
+    p = PUT_LITERAL(p, "\"");
+    if (event->type == PROBE_EVENT_RESOLVE) {
+        p = PUT_LITERAL(p, ",\"resolve_ms\":");
+        p = put_fixed(p, target->resolve_time, 6);
+    } else {
+        p = PUT_LITERAL(p, ",\"seq\":");
+        p = put_uint(p, event->seq);
+    }
+    if (event->type != PROBE_EVENT_TIMEOUT
+        && event->type != PROBE_EVENT_RESOLVE) {
+        p = PUT_LITERAL(p, ",\"rtt_ms\":");
+        p = put_fixed(p, event->rtt, 6);
+    }
+    if ((event->flags & PROBE_FLAG_REORDERED) != 0) {
+        p = PUT_LITERAL(p, ",\"reorder\":");
+        p = put_uint(p, event->reorder);
+    }
+    if ((event->flags & PROBE_FLAG_ONE_WAY) != 0) {
+        p = PUT_LITERAL(p, ",\"forward_ms\":");
+        p = put_fixed(p, event->forward_delay, 6);
+        p = PUT_LITERAL(p, ",\"return_ms\":");
+        p = put_fixed(p, event->return_delay, 6);
+    }
+    p = PUT_LITERAL(p, ",\"flags\":");
+    p = put_uint(p, (uint64_t)event->flags);
+    p = PUT_LITERAL(p, "}\n");
+    output_commit(&report->out, (size_t)(p - start));
+}
+
+static void write_csv_event(struct report *report,
+                            const struct probe_event *event)
+{
+    const struct probe_target *target = event->target;
+    const char *type = event_names[event->type];
+    char *start;
+    char *p;
+
+    start = output_reserve(&report->out, 128 + 2 * strlen(target->name));
+    if (start == NULL) {
+        return;
+    }
+    p = put_string(start, type, strlen(type));
+    *p++ = ',';
+    p = put_fixed(p, wtime() / 1000, 6);
+    *p++ = ',';
+    p = put_csv_string(p, target->name);
+    *p++ = ',';
+    p = put_string(p, target->addr_str, strlen(target->addr_str));
+    *p++ = ',';
+    if (event->type == PROBE_EVENT_RESOLVE) {
+        /* no sequence number, the lookup time instead of the RTT */
+        *p++ = ',';
+        p = put_fixed(p, target->resolve_time, 6);
+    } else {
+        p = put_uint(p, event->seq);
+        *p++ = ',';
+        if (event->type != PROBE_EVENT_TIMEOUT) {
+            p = put_fixed(p, event->rtt, 6);
+        }
+    }
+    *p++ = ',';
+    p = put_uint(p, (uint64_t)event->flags);
+    *p++ = ',';
+    if ((event->flags & PROBE_FLAG_REORDERED) != 0) {
+        p = put_uint(p, event->reorder);
+    }
+    *p++ = '\n';
+    output_commit(&report->out, (size_t)(p - start));
+}
+
+static void write_binary_event(struct report *report,
+                               const struct probe_event *event)
+{
+    const struct probe_target *target = event->target;
+    size_t addr_len = strlen(target->addr_str);
+    uint64_t duration = 0;
+    char *start;
+    char *p;
+
+    start = output_reserve(&report->out,
+                           REPORT_BINARY_RECORD_SIZE + 2 + addr_len);
+    if (start == NULL) {
+        return;
+    }
+    if (event->type == PROBE_EVENT_RESOLVE) {
+        duration = target->resolve_time;
+    } else if (event->type != PROBE_EVENT_TIMEOUT) {
+        duration = event->rtt;
+    }
+    p = put_le(start, (uint64_t)event->type, 1);
+    p = put_le(p, (uint64_t)event->flags, 1);
+    p = put_le(p, event->seq, 2);
+    p = put_le(p, target->index, 4);
+    p = put_le(p, wtime(), 8);
+    p = put_le(p, duration, 8);
+    p = put_le(p, event->reorder, 2);
+    p = put_le(p, 0, 2);
+    if (event->type == PROBE_EVENT_RESOLVE) {
+        p = put_le(p, addr_len, 2);
+        p = put_string(p, target->addr_str, addr_len);
+    }
+    output_commit(&report->out, (size_t)(p - start));
+}
+
+int report_parse_format(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(format_names) / sizeof(*format_names));
+         i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int report_init(struct report *report,
+                int format,
+                const char *timestamp_format,
+                int flush_policy,
+                uint64_t flush_interval)
+{
+    memset(report, 0, sizeof(*report));
+    report->format = format;
+    if (timestamp_format != NULL) {
+        report->show_timestamp = 1;
+        timestamp_init(&report->timestamp, timestamp_format);
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+    setvbuf(stderr, NULL, _IONBF, 0);
+    if (output_init(&report->out,
+                    stdout,
+                    OUTPUT_BUFFER_SIZE,
+                    flush_policy,
+                    flush_interval) != 0) {
+        return -1;
+    }
+    if (output_init(&report->log,
+                    stderr,
+                    4096,
+                    OUTPUT_FLUSH_FULL,
+                    0) != 0) {
+        output_destroy(&report->out);
+        return -1;
+    }
+    return 0;
+}
+
+int report_clone(struct report *copy,
+                 const struct report *report,
+                 const struct prober *prober)
+{
+    *copy = *report;
+    copy->partial = 1;
+    copy->prober = prober;
+    if (output_init(&copy->out,
+                    report->out.file,
+                    report->out.size,
+                    report->out.flush_policy,
+                    report->out.flush_interval) != 0) {
+        return -1;
+    }
+    if (output_init(&copy->log,
+                    report->log.file,
+                    report->log.size,
+                    report->log.flush_policy,
+                    report->log.flush_interval) != 0) {
+        output_destroy(&copy->out);
+        return -1;
+    }
+    return 0;
+}
+
+void report_start(struct report *report, const struct prober *prober)
+{
+    size_t i;
+
+    report->prober = prober;
+
+    switch (report->format) {
+        case REPORT_HUMAN:
+            if (report->multi_target) {
+                output_printf(&report->out,
+                              "Pinging %lu targets\n",
+                              (unsigned long)prober->num_targets);
+            } else if (prober->targets[0]->resolve_state
+                       == TARGET_RESOLVED) {
+                output_printf(&report->out,
+                              "Pinging %s (%s)\n",
+                              prober->targets[0]->name,
+                              prober->targets[0]->addr_str);
+            } else {
+                output_printf(&report->out,
+                              "Pinging %s\n",
+                              prober->targets[0]->name);
+            }
+            break;
+        case REPORT_CSV:
+            output_printf(&report->out,
+                          "type,time,target,addr,seq,rtt_ms,flags,reorder\n");
+            break;
+        case REPORT_BINARY: {
+            char header[16];
+            char *p = PUT_LITERAL(header, "CPINGBIN");
+            p = put_le(p, REPORT_BINARY_VERSION, 2);
+            p = put_le(p, REPORT_BINARY_RECORD_SIZE, 2);
+            put_le(p, prober->num_targets, 4);
+            output_write(&report->out, header, sizeof(header));
+            for (i = 0; i < prober->num_targets; i++) {
+                const struct probe_target *target = prober->targets[i];
+                size_t name_len = strlen(target->name);
+                size_t addr_len = strlen(target->addr_str);
+                char len[2];
+
+                put_le(len, name_len, 2);
+                output_write(&report->out, len, 2);
+                output_write(&report->out, target->name, name_len);
+                put_le(len, addr_len, 2);
+                output_write(&report->out, len, 2);
+                output_write(&report->out, target->addr_str, addr_len);
+            }
+            break;
+        }
+    }
+    output_flush(&report->out);
+}
+
+static void write_human_stats(struct output_buffer *out,
+                              const char *name,
+                              const char *addr_str,
+                              unsigned long sent,
+                              const struct rtt_stats *stats)
+{
+    output_printf(out,
+                  "%s (%s): sent=%lu, received=%lu, loss=%.1f%%",
+                  name,
+                  addr_str,
+                  sent,
+                  stats->received,
+                  stats_loss(stats) * 100.0);
+    if (stats->received > 0) {
+        output_printf(out,
+                      ", min/avg/max/mdev=%.3f/%.3f/%.3f/%.3f ms"
+                      ", p50/p90/p99/p99.9=%.3f/%.3f/%.3f/%.3f ms"
+                      ", jitter=%.3f ms",
+                      (double)stats->min / 1000000.0,
+                      stats->mean / 1000000.0,
+                      (double)stats->max / 1000000.0,
+                      stats_mdev(stats) / 1000000.0,
+                      (double)stats_percentile(stats, 0.5) / 1000000.0,
+                      (double)stats_percentile(stats, 0.9) / 1000000.0,
+                      (double)stats_percentile(stats, 0.99) / 1000000.0,
+                      (double)stats_percentile(stats, 0.999) / 1000000.0,
+                      stats->jitter / 1000000.0);
+    }
+    if (stats->late > 0) {
+        output_printf(out,
+                      ", late=%lu (max %.3f ms)",
+                      stats->late,
+                      (double)stats->late_max / 1000000.0);
+    }
+    if (stats->duplicates > 0) {
+        output_printf(out, ", duplicates=%lu", stats->duplicates);
+    }
+    if (stats->reordered > 0) {
+        output_printf(out,
+                      ", reordered=%lu (max %lu)",
+                      stats->reordered,
+                      stats->max_reorder);
+    }
+    output_printf(out, "\n");
+}
+
+/*
+ * Orders targets by average RTT, those without any replies last.
+ */
+static int compare_mean_rtt(const void *a, const void *b)
+{
+    const struct probe_target *target1 = *(struct probe_target *const *)a;
+    const struct probe_target *target2 = *(struct probe_target *const *)b;
+
+    if (target1->stats.received == 0 || target2->stats.received == 0) {
+        return (target1->stats.received == 0)
+            - (target2->stats.received == 0);
+    }
+    if (target1->stats.mean != target2->stats.mean) {
+        return target1->stats.mean < target2->stats.mean ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Lists the addresses of a name side by side, fastest first, with how much
+ * slower each one is than the fastest.
+ */
+static void write_address_comparison(struct output_buffer *out,
+                                     struct probe_target **targets,
+                                     size_t count)
+{
+    double best;
+    size_t width = 0;
+    size_t i;
+
+    qsort(targets, count, sizeof(*targets), compare_mean_rtt);
+    best = targets[0]->stats.mean;
+    for (i = 0; i < count; i++) {
+        size_t len = strlen(targets[i]->addr_str);
+        if (len > width) {
+            width = len;
+        }
+    }
+
+    output_printf(out, "%s, %lu addresses:\n",
+                  targets[0]->name,
+                  (unsigned long)count);
+    for (i = 0; i < count; i++) {
+        const struct probe_target *target = targets[i];
+        const struct rtt_stats *stats = &target->stats;
+
+        output_printf(out, "  %-*s  loss=%5.1f%%",
+                      (int)width,
+                      target->addr_str,
+                      stats_loss(stats) * 100.0);
+        if (stats->received > 0) {
+            output_printf(out,
+                          "  avg=%.3f ms  p50=%.3f ms  p99=%.3f ms"
+                          "  +%.3f ms",
+                          stats->mean / 1000000.0,
+                          (double)stats_percentile(stats, 0.5) / 1000000.0,
+                          (double)stats_percentile(stats, 0.99) / 1000000.0,
+                          (stats->mean - best) / 1000000.0);
+        } else {
+            output_printf(out, "  no replies");
+        }
+        output_printf(out, "\n");
+    }
+}
+
+/*
+ * Compares the addresses of every name that resolved to more than one.
+ * Targets of the same name are next to each other.
+ */
+static void write_address_comparisons(struct output_buffer *out,
+                                      const struct prober *prober)
+{
+    struct probe_target **group;
+    size_t first = 0;
+
+    group = malloc(prober->num_targets * sizeof(*group));
+    if (group == NULL) {
+        perror("malloc");
+        return;
+    }
+    while (first < prober->num_targets) {
+        const char *name = prober->targets[first]->name;
+        size_t count = 0;
+
+        while (first + count < prober->num_targets
+               && strcmp(prober->targets[first + count]->name, name) == 0) {
+            group[count] = prober->targets[first + count];
+            count++;
+        }
+        if (count > 1) {
+            write_address_comparison(out, group, count);
+        }
+        first += count;
+    }
+    free(group);
+}
+
+/*
+ * target is NULL for the total of all targets.
+ */
+static void write_json_stats(struct output_buffer *out,
+                             const struct probe_target *target,
+                             unsigned long sent,
+                             const struct rtt_stats *stats,
+                             int final)
+{
+    if (target != NULL) {
+        char *start = output_reserve(out, 32 + 6 * strlen(target->name));
+        if (start != NULL) {
+            char *p = PUT_LITERAL(start, "{\"type\":\"summary\",\"target\":");
+            p = put_json_string(p, target->name);
+            output_commit(out, (size_t)(p - start));
+        }
+        output_printf(out, ",\"addr\":\"%s\"", target->addr_str);
+    } else {
+        output_printf(out, "{\"type\":\"total\"");
+    }
+    output_printf(out,
+                  ",\"final\":%s,\"sent\":%lu,\"received\":%lu"
+                  ",\"loss\":%.4f",
+                  final ? "true" : "false",
+                  sent,
+                  stats->received,
+                  stats_loss(stats));
+    output_printf(out,
+                  ",\"late\":%lu,\"duplicates\":%lu,\"reordered\":%lu"
+                  ",\"max_reorder\":%lu",
+                  stats->late,
+                  stats->duplicates,
+                  stats->reordered,
+                  stats->max_reorder);
+    if (stats->late > 0) {
+        output_printf(out,
+                      ",\"late_max_ms\":%.6f",
+                      (double)stats->late_max / 1000000.0);
+    }
+    if (stats->received > 0) {
+        output_printf(out,
+                      ",\"min_ms\":%.6f,\"avg_ms\":%.6f,\"max_ms\":%.6f"
+                      ",\"mdev_ms\":%.6f,\"p50_ms\":%.6f,\"p90_ms\":%.6f"
+                      ",\"p99_ms\":%.6f,\"p999_ms\":%.6f,\"jitter_ms\":%.6f",
+                      (double)stats->min / 1000000.0,
+                      stats->mean / 1000000.0,
+                      (double)stats->max / 1000000.0,
+                      stats_mdev(stats) / 1000000.0,
+                      (double)stats_percentile(stats, 0.5) / 1000000.0,
+                      (double)stats_percentile(stats, 0.9) / 1000000.0,
+                      (double)stats_percentile(stats, 0.99) / 1000000.0,
+                      (double)stats_percentile(stats, 0.999) / 1000000.0,
+                      stats->jitter / 1000000.0);
+    }
+    output_printf(out, "}\n");
+}
+
+/*
+ * Shows how well sends and receives were batched: the average number of
+ * packets handled by one system call.
+ */
+static void write_io_stats(struct output_buffer *out,
+                           const char *name,
+                           const struct icmp_socket_stats *stats,
+                           const char *backend)
+{
+    if (stats->send_calls == 0) {
+        return;
+    }
+    output_printf(out,
+                  "%s%s%s%s: %lu packets in %lu send calls (%.1f per call), "
+                  "%lu packets in %lu receive calls (%.1f per call, "
+                  "%lu empty)",
+                  name,
+                  backend != NULL ? " (" : "",
+                  backend != NULL ? backend : "",
+                  backend != NULL ? ")" : "",
+                  stats->packets_sent,
+                  stats->send_calls,
+                  (double)stats->packets_sent / stats->send_calls,
+                  stats->packets_received,
+                  stats->receive_calls,
+                  stats->receive_calls > 0
+                      ? (double)stats->packets_received
+                          / stats->receive_calls
+                      : 0.0,
+                  stats->empty_receives);
+    if (stats->too_big > 0) {
+        output_printf(out, ", %lu too big to send", stats->too_big);
+    }
+    output_printf(out, "\n");
+}
+
+static void write_json_io_stats(struct output_buffer *out,
+                                const char *name,
+                                const struct icmp_socket_stats *stats)
+{
+    output_printf(out,
+                  ",\"%s\":{\"packets_sent\":%lu,\"send_calls\":%lu"
+                  ",\"packets_received\":%lu,\"receive_calls\":%lu"
+                  ",\"receive_syscalls\":%lu"
+                  ",\"empty_receives\":%lu,\"too_big\":%lu"
+                  ",\"timestamp_reads\":%lu}",
+                  name,
+                  stats->packets_sent,
+                  stats->send_calls,
+                  stats->packets_received,
+                  stats->receive_calls,
+                  stats->receive_syscalls,
+                  stats->empty_receives,
+                  stats->too_big,
+                  stats->timestamp_reads);
+}
+
+/*
+ * All system calls on the hot path: sends, receives, timestamp reads from
+ * the error queue, waits and timer updates. Every send call is a system
+ * call, whatever the backend.
+ */
+static unsigned long count_syscalls(const struct prober *prober)
+{
+    const struct icmp_socket_stats *sock4 = &prober->sock4.stats;
+    const struct icmp_socket_stats *sock6 = &prober->sock6.stats;
+
+    return sock4->send_calls + sock4->receive_syscalls
+        + sock4->timestamp_reads
+        + sock6->send_calls + sock6->receive_syscalls
+        + sock6->timestamp_reads
+        + prober->loop.stats.waits
+        + prober->loop.stats.timer_updates;
+}
+
+static double average_us(uint64_t sum, unsigned long count)
+{
+    return count > 0 ? (double)sum / 1000.0 / count : 0.0;
+}
+
+/*
+ * Where the time between the network and the results went, and what was
+ * thrown away on the way.
+ */
+static void write_hot_path_stats(struct output_buffer *out,
+                                 const struct prober *prober)
+{
+    const struct hot_path_stats *hot_path = &prober->hot_path;
+    const struct icmp_socket_stats *sock4 = &prober->sock4.stats;
+    const struct icmp_socket_stats *sock6 = &prober->sock6.stats;
+    double sends = (double)prober->schedule.sends;
+
+    if (prober->schedule.sends > 0) {
+        output_printf(out,
+                      "System calls: %.2f per request: %.2f send, "
+                      "%.2f receive, %.2f timestamp, %.2f wait, "
+                      "%.2f timer\n",
+                      count_syscalls(prober) / sends,
+                      (sock4->send_calls + sock6->send_calls) / sends,
+                      (sock4->receive_syscalls + sock6->receive_syscalls)
+                          / sends,
+                      (sock4->timestamp_reads + sock6->timestamp_reads)
+                          / sends,
+                      prober->loop.stats.waits / sends,
+                      prober->loop.stats.timer_updates / sends);
+    }
+    if (hot_path->receive_delays > 0) {
+        output_printf(out,
+                      "Receive delay: avg=%.3f us, max=%.3f us (kernel "
+                      "receive time to the receive call returning)\n",
+                      average_us(hot_path->receive_delay_sum,
+                                 hot_path->receive_delays),
+                      (double)hot_path->receive_delay_max / 1000.0);
+    }
+    if (hot_path->checksums > 0 || hot_path->handler_calls > 0) {
+        output_printf(out,
+                      "Time per event: checksum=%.3f us, "
+                      "output=%.3f us\n",
+                      average_us(hot_path->checksum_time,
+                                 hot_path->checksums),
+                      average_us(hot_path->handler_time,
+                                 hot_path->handler_calls));
+    }
+    if (hot_path->not_replies > 0
+        || hot_path->unknown > 0
+        || hot_path->stale > 0
+        || hot_path->bad_checksums > 0) {
+        output_printf(out,
+                      "Discarded: %lu not echo replies, %lu unknown, "
+                      "%lu too old; %lu bad checksums\n",
+                      hot_path->not_replies,
+                      hot_path->unknown,
+                      hot_path->stale,
+                      hot_path->bad_checksums);
+    }
+}
+
+/*
+ * The run statistics as a single JSON object, for tools that track them
+ * over time.
+ */
+static void write_json_run_stats(struct output_buffer *out,
+                                 const struct prober *prober,
+                                 const char *backend)
+{
+    const struct schedule_stats *schedule = &prober->schedule;
+    const struct overhead_stats *overhead = &prober->overhead;
+    const struct hot_path_stats *hot_path = &prober->hot_path;
+
+    output_printf(out,
+                  "{\"type\":\"run\",\"io\":\"%s\",\"sends\":%lu"
+                  ",\"lateness_avg_ms\":%.6f,\"lateness_max_ms\":%.6f"
+                  ",\"added_latency_replies\":%lu"
+                  ",\"added_latency_avg_us\":%.3f"
+                  ",\"added_latency_max_us\":%.3f"
+                  ",\"lookups\":%lu,\"lookup_failures\":%lu",
+                  backend != NULL ? backend : "syscall",
+                  schedule->sends,
+                  schedule->sends > 0
+                      ? (double)schedule->lateness_sum / 1000000.0
+                          / schedule->sends
+                      : 0.0,
+                  (double)schedule->lateness_max / 1000000.0,
+                  overhead->replies,
+                  overhead->replies > 0
+                      ? (double)overhead->sum / 1000.0 / overhead->replies
+                      : 0.0,
+                  (double)overhead->max / 1000.0,
+                  prober->resolve.lookups,
+                  prober->resolve.failures);
+    output_printf(out,
+                  ",\"syscalls\":%lu,\"waits\":%lu,\"timer_updates\":%lu"
+                  ",\"receive_delay_avg_us\":%.3f"
+                  ",\"receive_delay_max_us\":%.3f"
+                  ",\"checksum_avg_us\":%.3f,\"output_avg_us\":%.3f"
+                  ",\"not_replies\":%lu,\"unknown_replies\":%lu"
+                  ",\"stale_replies\":%lu,\"bad_checksums\":%lu",
+                  count_syscalls(prober),
+                  prober->loop.stats.waits,
+                  prober->loop.stats.timer_updates,
+                  average_us(hot_path->receive_delay_sum,
+                             hot_path->receive_delays),
+                  (double)hot_path->receive_delay_max / 1000.0,
+                  average_us(hot_path->checksum_time, hot_path->checksums),
+                  average_us(hot_path->handler_time,
+                             hot_path->handler_calls),
+                  hot_path->not_replies,
+                  hot_path->unknown,
+                  hot_path->stale,
+                  hot_path->bad_checksums);
+    write_json_io_stats(out, "ipv4", &prober->sock4.stats);
+    write_json_io_stats(out, "ipv6", &prober->sock6.stats);
+    output_printf(out, "}\n");
+}
+
+/*
+ * How the run went as a whole: send lateness, lookups, I/O batching and
+ * the time spent on the hot path.
+ */
+static void write_run_stats(struct report *report)
+{
+    const struct prober *prober = report->prober;
+    struct output_buffer *out;
+    const char *backend = NULL;
+
+    if (prober->config.io_uring) {
+        backend = "io_uring";
+    } else if (prober->config.packet_ring) {
+        backend = "packet ring";
+    }
+    if (report->format == REPORT_JSON) {
+        write_json_run_stats(&report->out, prober, backend);
+        output_flush(&report->out);
+        return;
+    }
+    out = report->format == REPORT_HUMAN ? &report->out : &report->log;
+    if (prober->schedule.sends > 0 && !prober->config.flood) {
+        output_printf(out,
+                      "Send lateness: avg=%.3f ms, max=%.3f ms\n",
+                      (double)prober->schedule.lateness_sum / 1000000.0
+                          / prober->schedule.sends,
+                      (double)prober->schedule.lateness_max / 1000000.0);
+    }
+    if (prober->resolve.lookups > 0) {
+        output_printf(out,
+                      "Name resolution: %lu lookups, %lu failed, "
+                      "avg=%.3f ms, max=%.3f ms\n",
+                      prober->resolve.lookups,
+                      prober->resolve.failures,
+                      (double)prober->resolve.time_sum / 1000000.0
+                          / prober->resolve.lookups,
+                      (double)prober->resolve.time_max / 1000000.0);
+    }
+    if (prober->overhead.replies > 0) {
+        output_printf(out,
+                      "Added latency: avg=%.3f us, max=%.3f us (user space "
+                      "minus kernel RTT)\n",
+                      (double)prober->overhead.sum / 1000.0
+                          / prober->overhead.replies,
+                      (double)prober->overhead.max / 1000.0);
+    }
+    write_io_stats(out, "IPv4", &prober->sock4.stats, backend);
+    write_io_stats(out, "IPv6", &prober->sock6.stats, backend);
+    write_hot_path_stats(out, prober);
+    output_flush(out);
+}
+
+void report_event(const struct probe_event *event, void *arg)
+{
+    struct report *report = arg;
+
+    if (event->type == PROBE_EVENT_TICK) {
+        report_summary(report, 0);
+        return;
+    }
+    if (event->type == PROBE_EVENT_STATS) {
+        write_run_stats(report);
+        return;
+    }
+    if (report->metrics != NULL) {
+        metrics_update(report->metrics, event);
+    }
+    if (report->quiet) {
+        return;
+    }
+
+    switch (report->format) {
+        case REPORT_HUMAN:
+            write_human_event(report, event);
+            break;
+        case REPORT_JSON:
+            write_json_event(report, event);
+            break;
+        case REPORT_CSV:
+            write_csv_event(report, event);
+            break;
+        case REPORT_BINARY:
+            write_binary_event(report, event);
+            break;
+    }
+    output_end_record(&report->out);
+}
+
+void report_summary(struct report *report, int final)
+{
+    const struct prober *prober = report->prober;
+    struct output_buffer *out;
+    struct rtt_stats total;
+    unsigned long total_sent = 0;
+    unsigned long num_resolved = 0;
+    size_t i;
+
+    if (prober == NULL) {
+        return;
+    }
+
+    /*
+     * The CSV and binary formats have no room for summaries, so they go
+     * to stderr.
+     */
+    out = report->format == REPORT_HUMAN || report->format == REPORT_JSON
+        ? &report->out
+        : &report->log;
+
+    memset(&total, 0, sizeof(total));
+
+    if (report->format != REPORT_JSON) {
+        output_printf(out, "\n");
+    }
+    for (i = 0; i < prober->num_targets; i++) {
+        const struct probe_target *target = prober->targets[i];
+
+        /* names that never resolved were already reported as errors */
+        if (target->resolve_state != TARGET_RESOLVED) {
+            continue;
+        }
+        num_resolved++;
+        if (report->format == REPORT_JSON) {
+            write_json_stats(out, target, target->sent, &target->stats,
+                             final);
+        } else {
+            write_human_stats(out, target->name, target->addr_str,
+                              target->sent, &target->stats);
+        }
+        if (prober->num_targets > 1 && !report->partial) {
+            stats_merge(&total, &target->stats);
+            total_sent += target->sent;
+        }
+    }
+    if (prober->num_targets > 1 && !report->partial) {
+        if (report->format == REPORT_JSON) {
+            write_json_stats(out, NULL, total_sent, &total, final);
+        } else {
+            char num_targets[32];
+            sprintf(num_targets, "%lu targets", num_resolved);
+            write_human_stats(out, "Total", num_targets, total_sent,
+                              &total);
+        }
+        stats_destroy(&total);
+    }
+    if (report->compare_addresses
+        && !report->partial
+        && report->format != REPORT_JSON) {
+        write_address_comparisons(out, prober);
+    }
+    output_flush(out);
+
+    if (final) {
+        write_run_stats(report);
+    }
+}
+
+void report_sweep_step(struct report *report,
+                       const struct sweep *sweep,
+                       const struct sweep_step *step)
+{
+    struct output_buffer *out =
+        report->format == REPORT_HUMAN || report->format == REPORT_JSON
+            ? &report->out
+            : &report->log;
+    double loss = step->sent > 0
+        ? (double)(step->sent - step->received) / step->sent
+        : 0.0;
+
+    if (report->format == REPORT_JSON) {
+        output_printf(out,
+                      "{\"type\":\"sweep\",\"size\":%lu"
+                      ",\"search\":%s,\"sent\":%lu,\"received\":%lu"
+                      ",\"too_big\":%lu,\"loss\":%.4f",
+                      (unsigned long)step->size,
+                      step->search ? "true" : "false",
+                      step->sent,
+                      step->received,
+                      step->too_big,
+                      loss);
+        if (step->received > 0) {
+            output_printf(out,
+                          ",\"min_ms\":%.6f,\"avg_ms\":%.6f"
+                          ",\"p50_ms\":%.6f",
+                          (double)step->min / 1000000.0,
+                          step->mean / 1000000.0,
+                          (double)step->p50 / 1000000.0);
+        }
+        output_printf(out, "}\n");
+    } else {
+        output_printf(out,
+                      "Size %lu (%lu with headers)%s: sent=%lu, "
+                      "received=%lu, loss=%.1f%%",
+                      (unsigned long)step->size,
+                      (unsigned long)(step->size + sweep->header_size),
+                      step->search ? ", MTU search" : "",
+                      step->sent,
+                      step->received,
+                      loss * 100.0);
+        if (step->received > 0) {
+            output_printf(out,
+                          ", min/avg/p50=%.3f/%.3f/%.3f ms",
+                          (double)step->min / 1000000.0,
+                          step->mean / 1000000.0,
+                          (double)step->p50 / 1000000.0);
+        }
+        if (step->too_big > 0) {
+            output_printf(out, ", %lu too big to send", step->too_big);
+        }
+        output_printf(out, "\n");
+    }
+    output_flush(out);
+}
+
+void report_sweep_result(struct report *report, const struct sweep *sweep)
+{
+    struct output_buffer *out =
+        report->format == REPORT_HUMAN || report->format == REPORT_JSON
+            ? &report->out
+            : &report->log;
+    int found = sweep->passed && sweep->failed;
+
+    if (report->format == REPORT_JSON) {
+        output_printf(out, "{\"type\":\"sweep_result\"");
+        if (sweep->passed) {
+            output_printf(out,
+                          ",\"largest_payload\":%lu,\"pmtu\":%lu"
+                          ",\"pmtu_found\":%s",
+                          (unsigned long)sweep->max_passed,
+                          (unsigned long)(sweep->max_passed
+                                          + sweep->header_size),
+                          found ? "true" : "false");
+        }
+        if (sweep->have_slope) {
+            output_printf(out,
+                          ",\"slope_ns_per_byte\":%.6f"
+                          ",\"intercept_ms\":%.6f",
+                          sweep->slope,
+                          sweep->intercept / 1000000.0);
+        }
+        output_printf(out, "}\n");
+    } else {
+        output_printf(out, "\n");
+        if (!sweep->passed) {
+            output_printf(out, "No replies at any size\n");
+        } else if (found) {
+            output_printf(out,
+                          "Path MTU: %lu bytes (largest payload: %lu)\n",
+                          (unsigned long)(sweep->max_passed
+                                          + sweep->header_size),
+                          (unsigned long)sweep->max_passed);
+        } else {
+            output_printf(out,
+                          "Path MTU: at least %lu bytes (largest payload "
+                          "tried: %lu)\n",
+                          (unsigned long)(sweep->max_passed
+                                          + sweep->header_size),
+                          (unsigned long)sweep->max_passed);
+        }
+        if (sweep->have_slope && sweep->slope > 0) {
+            /*
+             * Every byte of payload crosses the path twice.
+             */
+            output_printf(out,
+                          "RTT slope: %.3f ns per byte, %.3f ms at zero "
+                          "payload (about %.1f Mbit/s each way)\n",
+                          sweep->slope,
+                          sweep->intercept / 1000000.0,
+                          2.0 * 8.0 / sweep->slope * 1000.0);
+        } else if (sweep->have_slope) {
+            output_printf(out, "RTT slope: doesn't grow with the size\n");
+        }
+    }
+    output_flush(out);
+    write_run_stats(report);
+}
+
+void report_destroy(struct report *report)
+{
+    output_destroy(&report->out);
+    output_destroy(&report->log);
+}
@@ -0,0 +1,127 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "platform.h"
+#include "metrics.h"
+#include "output.h"
+#include "prober.h"
+#include "sweep.h"
+
+#define REPORT_HUMAN 0
+#define REPORT_JSON 1   /* JSON Lines, one object per event */
+#define REPORT_CSV 2
+#define REPORT_BINARY 3 /* fixed size records, see below */
+
+/*
+ * The binary format starts with a header:
+ *
+ *     8 bytes   "CPINGBIN"
+ *     u16       format version (4)
+ *     u16       record size (28)
+ *     u32       number of targets
+ *
+ * followed by the name and address of every target, in order:
+ *
+ *     u16       name length, then the name
+ *     u16       address length, then the address as text
+ *
+ * The address is empty for names that were not resolved yet. Then comes
+ * one record per reply, timeout or lookup:
+ *
+ *     u8        PROBE_EVENT_REPLY, PROBE_EVENT_TIMEOUT,
+ *               PROBE_EVENT_RESOLVE, PROBE_EVENT_LATE or
+ *               PROBE_EVENT_DUPLICATE
+ *     u8        PROBE_FLAG_* flags
+ *     u16       sequence number, 0 for lookups
+ *     u32       target index
+ *     u64       wall clock time in nanoseconds since the Unix epoch
+ *     u64       RTT or lookup time in nanoseconds, 0 for timeouts
+ *     u16       how many newer requests were answered first, 0 unless
+ *               PROBE_FLAG_REORDERED is set
+ *     u16       reserved, 0
+ *
+ * Lookup records are followed by the new address of the target:
+ *
+ *     u16       address length, then the address as text
+ *
+ * Version 1 had no lookup records, version 2 no late or duplicate ones
+ * and version 3 no reorder distance.
+ *
+ * All integers are little endian. Summaries are written to stderr in the
+ * human readable format, as they are in the CSV format.
+ */
+#define REPORT_BINARY_VERSION 4
+#define REPORT_BINARY_RECORD_SIZE 28
+
+struct report {
+    int format;
+    int quiet;               /* only print summaries */
+    int multi_target;        /* print target addresses in every message */
+    int compare_addresses;   /* summarize the addresses of each name
+                                together */
+    int show_timestamp;
+    int partial;             /* covers only some of the targets */
+    struct timestamp_cache timestamp;
+    const struct prober *prober;
+    struct metrics *metrics; /* published there as well, unless NULL */
+    struct output_buffer out;
+    struct output_buffer log; /* for what doesn't fit the format */
+};
+
+/**
+ * Returns the REPORT_* format with the given name, or -1 if there is none.
+ */
+int report_parse_format(const char *name);
+
+/**
+ * Prepares to write results to stdout. timestamp_format is the strftime()
+ * format of the time shown before each message in the human readable
+ * format, or NULL to show none.
+ */
+int report_init(struct report *report,
+                int format,
+                const char *timestamp_format,
+                int flush_policy,
+                uint64_t flush_interval);
+
+/**
+ * Makes a copy of the report with its own buffers, for reporting the events
+ * of the given prober on another thread. It's assumed to cover a part of
+ * the targets, so no total is given in its summaries.
+ */
+int report_clone(struct report *copy,
+                 const struct report *report,
+                 const struct prober *prober);
+
+/**
+ * Writes the banner or the header of the output.
+ */
+void report_start(struct report *report, const struct prober *prober);
+
+/**
+ * Writes the result of a probe. Can be used as a probe_event_handler.
+ */
+void report_event(const struct probe_event *event, void *arg);
+
+/**
+ * Writes the statistics of every target. The final summary also shows how
+ * well the sender kept up.
+ */
+void report_summary(struct report *report, int final);
+
+/**
+ * Reports the results of one payload size of a sweep.
+ */
+void report_sweep_step(struct report *report,
+                       const struct sweep *sweep,
+                       const struct sweep_step *step);
+
+/**
+ * Reports the path MTU and the RTT slope found by a sweep, and how the run
+ * went as with report_summary().
+ */
+void report_sweep_result(struct report *report, const struct sweep *sweep);
+
+void report_destroy(struct report *report);
+
+#endif /* REPORT_H */
@@ -0,0 +1,594 @@
+#include "resolver.h"
+
+#ifdef _WIN32
+    typedef HANDLE thread_t;
+    typedef CRITICAL_SECTION mutex_t;
+    typedef CONDITION_VARIABLE cond_t;
+    #define mutex_init InitializeCriticalSection
+    #define mutex_destroy DeleteCriticalSection
+    #define mutex_lock EnterCriticalSection
+    #define mutex_unlock LeaveCriticalSection
+    #define cond_init InitializeConditionVariable
+    #define cond_destroy(cond) ((void)(cond))
+    #define cond_wait(cond, mutex) \
+        SleepConditionVariableCS((cond), (mutex), INFINITE)
+    #define cond_signal WakeConditionVariable
+    #define cond_broadcast WakeAllConditionVariable
+#else
+    #include <pthread.h>
+    #include <signal.h>
+    typedef pthread_t thread_t;
+    typedef pthread_mutex_t mutex_t;
+    typedef pthread_cond_t cond_t;
+    #define mutex_init(mutex) pthread_mutex_init((mutex), NULL)
+    #define mutex_destroy pthread_mutex_destroy
+    #define mutex_lock pthread_mutex_lock
+    #define mutex_unlock pthread_mutex_unlock
+    #define cond_init(cond) pthread_cond_init((cond), NULL)
+    #define cond_destroy pthread_cond_destroy
+    #define cond_wait pthread_cond_wait
+    #define cond_signal pthread_cond_signal
+    #define cond_broadcast pthread_cond_broadcast
+#endif
+
+#define INITIAL_CACHE_SIZE 64
+
+/*
+ * A name in the cache. While it's being looked up, the requests waiting for
+ * it are kept in a list and get the result when it's done.
+ */
+struct resolve_entry {
+    char *name;
+    int family;
+    int busy;                /* queued or being looked up */
+    int error;
+    int sys_errno;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint64_t expires;        /* ntime() until when the result is fresh */
+    struct resolve_waiter *waiters;
+    struct resolve_entry *hash_next;
+    struct resolve_entry *queue_next;
+};
+
+struct resolve_waiter {
+    struct resolver_client *client;
+    struct resolve_result *result;
+    struct resolve_waiter *next;
+};
+
+/*
+ * All fields are protected by lock. Threads are detached: if some of them
+ * are still stuck in getaddrinfo() when the resolver is destroyed, the last
+ * one to finish frees it.
+ */
+struct resolver {
+    mutex_t lock;
+    cond_t wake;
+    uint64_t ttl;
+    struct resolve_entry **cache;
+    size_t cache_size;
+    size_t cache_count;
+    struct resolve_entry *queue_head;
+    struct resolve_entry *queue_tail;
+    size_t max_threads;
+    size_t num_threads;
+    size_t num_idle;
+    int stopping;
+};
+
+int resolver_lookup(const char *name,
+                    int family,
+                    int flags,
+                    struct sockaddr_storage *addr,
+                    socklen_t *addr_len)
+{
+    struct addrinfo *addrinfo_list = NULL;
+    int error = 0;
+
+    if (family == AF_INET || family == AF_UNSPEC) {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_RAW;
+        hints.ai_protocol = IPPROTO_ICMP;
+        hints.ai_flags = flags;
+        error = getaddrinfo(name,
+                            NULL,
+                            &hints,
+                            &addrinfo_list);
+    }
+    if (family == AF_INET6 || (family == AF_UNSPEC && error != 0)) {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_INET6;
+        hints.ai_socktype = SOCK_RAW;
+        hints.ai_protocol = IPPROTO_ICMPV6;
+        hints.ai_flags = flags;
+        error = getaddrinfo(name,
+                            NULL,
+                            &hints,
+                            &addrinfo_list);
+    }
+    if (error != 0) {
+        return error;
+    }
+
+    memcpy(addr, addrinfo_list->ai_addr, addrinfo_list->ai_addrlen);
+    *addr_len = (socklen_t)addrinfo_list->ai_addrlen;
+    freeaddrinfo(addrinfo_list);
+    return 0;
+}
+
+int resolver_lookup_all(const char *name,
+                        int family,
+                        struct sockaddr_storage *addrs,
+                        socklen_t *addr_lens,
+                        size_t max_addrs,
+                        size_t *num_addrs)
+{
+    struct addrinfo hints = {0};
+    struct addrinfo *addrinfo_list = NULL;
+    struct addrinfo *addrinfo;
+    int error;
+
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_RAW;
+    error = getaddrinfo(name, NULL, &hints, &addrinfo_list);
+    if (error != 0) {
+        return error;
+    }
+
+    *num_addrs = 0;
+    for (addrinfo = addrinfo_list;
+         addrinfo != NULL && *num_addrs < max_addrs;
+         addrinfo = addrinfo->ai_next) {
+        size_t i;
+
+        if (addrinfo->ai_family != AF_INET
+            && addrinfo->ai_family != AF_INET6) {
+            continue;
+        }
+        for (i = 0; i < *num_addrs; i++) {
+            if (addr_lens[i] == (socklen_t)addrinfo->ai_addrlen
+                && memcmp(&addrs[i],
+                          addrinfo->ai_addr,
+                          addrinfo->ai_addrlen) == 0) {
+                break;
+            }
+        }
+        if (i < *num_addrs) {
+            continue;
+        }
+        memcpy(&addrs[i], addrinfo->ai_addr, addrinfo->ai_addrlen);
+        addr_lens[i] = (socklen_t)addrinfo->ai_addrlen;
+        (*num_addrs)++;
+    }
+    freeaddrinfo(addrinfo_list);
+    return *num_addrs > 0 ? 0 : EAI_NONAME;
+}
+
+void resolver_print_error(const char *name, int error, int sys_errno)
+{
+    if (error == EAI_SYSTEM) {
+        fprintf(stderr, "%s: getaddrinfo: %s\n", name, strerror(sys_errno));
+    } else {
+        fprintf(stderr, "%s: getaddrinfo: %s\n", name, gai_strerror(error));
+    }
+}
+
+static size_t name_hash(const char *name, int family)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return (hash ^ (uint32_t)family) * 16777619u;
+}
+
+static void free_resolver(struct resolver *resolver)
+{
+    size_t i;
+
+    for (i = 0; i < resolver->cache_size; i++) {
+        struct resolve_entry *entry = resolver->cache[i];
+        while (entry != NULL) {
+            struct resolve_entry *next = entry->hash_next;
+            free(entry->name);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(resolver->cache);
+    cond_destroy(&resolver->wake);
+    mutex_destroy(&resolver->lock);
+    free(resolver);
+}
+
+/*
+ * Hands the result of a lookup to everyone waiting for it. Called with the
+ * lock held. Waiters are kept newest first, so the last one is the client
+ * that started the lookup; the others count as cache hits.
+ */
+static void deliver(struct resolve_entry *entry, uint64_t latency)
+{
+    struct resolve_waiter *waiter = entry->waiters;
+
+    entry->waiters = NULL;
+    while (waiter != NULL) {
+        struct resolve_waiter *next = waiter->next;
+        struct resolver_client *client = waiter->client;
+        struct resolve_result *result = waiter->result;
+
+        result->error = entry->error;
+        result->sys_errno = entry->sys_errno;
+        result->addr = entry->addr;
+        result->addr_len = entry->addr_len;
+        result->latency = next == NULL ? latency : 0;
+        result->cached = result->latency == 0;
+        result->next = NULL;
+        if (client->tail != NULL) {
+            client->tail->next = result;
+        } else {
+            client->head = result;
+        }
+        client->tail = result;
+        if (client->notify != NULL) {
+            client->notify(client->notify_arg);
+        }
+
+        free(waiter);
+        waiter = next;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI resolver_main(LPVOID arg)
+#else
+static void *resolver_main(void *arg)
+#endif
+{
+    struct resolver *resolver = arg;
+
+    mutex_lock(&resolver->lock);
+    for (;;) {
+        struct resolve_entry *entry;
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        uint64_t start;
+        uint64_t latency;
+        int error;
+        int sys_errno;
+
+        while (resolver->queue_head == NULL && !resolver->stopping) {
+            resolver->num_idle++;
+            cond_wait(&resolver->wake, &resolver->lock);
+            resolver->num_idle--;
+        }
+        if (resolver->stopping) {
+            break;
+        }
+
+        entry = resolver->queue_head;
+        resolver->queue_head = entry->queue_next;
+        if (resolver->queue_head == NULL) {
+            resolver->queue_tail = NULL;
+        }
+        mutex_unlock(&resolver->lock);
+
+        /*
+         * The name and family never change, so they can be read without
+         * the lock.
+         */
+        start = ntime();
+        error = resolver_lookup(entry->name,
+                                entry->family,
+                                0,
+                                &addr,
+                                &addr_len);
+        sys_errno = errno;
+        latency = ntime() - start;
+        if (latency == 0) {
+            latency = 1;
+        }
+
+        mutex_lock(&resolver->lock);
+        entry->busy = 0;
+        entry->error = error;
+        entry->sys_errno = sys_errno;
+        if (error == 0) {
+            entry->addr = addr;
+            entry->addr_len = addr_len;
+            entry->expires = ntime() + resolver->ttl;
+        } else {
+            entry->expires = 0;
+        }
+        deliver(entry, latency);
+    }
+
+    /*
+     * The last thread out cleans up after a resolver that was destroyed
+     * while it was busy.
+     */
+    if (--resolver->num_threads == 0 && resolver->num_idle == 0) {
+        mutex_unlock(&resolver->lock);
+        free_resolver(resolver);
+    } else {
+        mutex_unlock(&resolver->lock);
+    }
+
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Starts another thread if all of them are busy. Called with the lock held.
+ * If that fails, the lookup waits for one of the running threads.
+ */
+static int start_thread(struct resolver *resolver)
+{
+    thread_t thread;
+
+    if (resolver->num_idle > 0
+        || resolver->num_threads >= resolver->max_threads) {
+        return 0;
+    }
+#ifdef _WIN32
+    thread = CreateThread(NULL, 0, resolver_main, resolver, 0, NULL);
+    if (thread == NULL) {
+        return resolver->num_threads > 0 ? 0 : -1;
+    }
+    CloseHandle(thread);
+#else
+    {
+        sigset_t signals;
+        sigset_t old_signals;
+        int error;
+
+        /*
+         * Signals are left to the thread that created the resolver.
+         */
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+        error = pthread_create(&thread, NULL, resolver_main, resolver);
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            return resolver->num_threads > 0 ? 0 : -1;
+        }
+        pthread_detach(thread);
+    }
+#endif
+    resolver->num_threads++;
+    return 0;
+}
+
+struct resolver *resolver_create(size_t max_threads, uint64_t ttl)
+{
+    struct resolver *resolver = calloc(1, sizeof(*resolver));
+
+    if (resolver == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    resolver->cache = calloc(INITIAL_CACHE_SIZE, sizeof(*resolver->cache));
+    if (resolver->cache == NULL) {
+        perror("calloc");
+        free(resolver);
+        return NULL;
+    }
+    resolver->cache_size = INITIAL_CACHE_SIZE;
+    resolver->max_threads = max_threads > 0 ? max_threads : 1;
+    resolver->ttl = ttl;
+    mutex_init(&resolver->lock);
+    cond_init(&resolver->wake);
+    return resolver;
+}
+
+void resolver_destroy(struct resolver *resolver)
+{
+    int busy;
+
+    if (resolver == NULL) {
+        return;
+    }
+
+    mutex_lock(&resolver->lock);
+    resolver->stopping = 1;
+    busy = resolver->num_threads > 0;
+    cond_broadcast(&resolver->wake);
+    mutex_unlock(&resolver->lock);
+
+    if (!busy) {
+        free_resolver(resolver);
+    }
+}
+
+void resolver_client_init(struct resolver_client *client,
+                          struct resolver *resolver,
+                          void (*notify)(void *arg),
+                          void *notify_arg)
+{
+    memset(client, 0, sizeof(*client));
+    client->resolver = resolver;
+    client->notify = notify;
+    client->notify_arg = notify_arg;
+}
+
+void resolver_client_destroy(struct resolver_client *client)
+{
+    struct resolver *resolver = client->resolver;
+    struct resolve_result *result;
+    size_t i;
+
+    if (resolver == NULL) {
+        return;
+    }
+
+    mutex_lock(&resolver->lock);
+    for (i = 0; i < resolver->cache_size; i++) {
+        struct resolve_entry *entry;
+        for (entry = resolver->cache[i];
+             entry != NULL;
+             entry = entry->hash_next) {
+            struct resolve_waiter **link = &entry->waiters;
+            while (*link != NULL) {
+                struct resolve_waiter *waiter = *link;
+                if (waiter->client == client) {
+                    *link = waiter->next;
+                    free(waiter->result);
+                    free(waiter);
+                } else {
+                    link = &waiter->next;
+                }
+            }
+        }
+    }
+    result = client->head;
+    client->head = NULL;
+    client->tail = NULL;
+    mutex_unlock(&resolver->lock);
+
+    while (result != NULL) {
+        struct resolve_result *next = result->next;
+        free(result);
+        result = next;
+    }
+    memset(client, 0, sizeof(*client));
+}
+
+/*
+ * Returns the cache entry for the name, adding one if there is none.
+ * Called with the lock held.
+ */
+static struct resolve_entry *find_entry(struct resolver *resolver,
+                                        const char *name,
+                                        int family)
+{
+    size_t index = name_hash(name, family) & (resolver->cache_size - 1);
+    struct resolve_entry *entry;
+
+    for (entry = resolver->cache[index];
+         entry != NULL;
+         entry = entry->hash_next) {
+        if (entry->family == family && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+
+    if (resolver->cache_count * 2 >= resolver->cache_size) {
+        size_t new_size = resolver->cache_size * 2;
+        struct resolve_entry **new_cache;
+        size_t i;
+
+        new_cache = calloc(new_size, sizeof(*new_cache));
+        if (new_cache == NULL) {
+            return NULL;
+        }
+        for (i = 0; i < resolver->cache_size; i++) {
+            struct resolve_entry *e = resolver->cache[i];
+            while (e != NULL) {
+                struct resolve_entry *next = e->hash_next;
+                size_t j = name_hash(e->name, e->family) & (new_size - 1);
+                e->hash_next = new_cache[j];
+                new_cache[j] = e;
+                e = next;
+            }
+        }
+        free(resolver->cache);
+        resolver->cache = new_cache;
+        resolver->cache_size = new_size;
+        index = name_hash(name, family) & (new_size - 1);
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->name = malloc(strlen(name) + 1);
+    if (entry->name == NULL) {
+        free(entry);
+        return NULL;
+    }
+    strcpy(entry->name, name);
+    entry->family = family;
+    entry->hash_next = resolver->cache[index];
+    resolver->cache[index] = entry;
+    resolver->cache_count++;
+    return entry;
+}
+
+int resolver_request(struct resolver_client *client,
+                     const char *name,
+                     int family,
+                     void *owner)
+{
+    struct resolver *resolver = client->resolver;
+    struct resolve_waiter *waiter;
+    struct resolve_entry *entry;
+
+    waiter = malloc(sizeof(*waiter));
+    if (waiter == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    waiter->client = client;
+    waiter->result = calloc(1, sizeof(*waiter->result));
+    if (waiter->result == NULL) {
+        perror("calloc");
+        free(waiter);
+        return -1;
+    }
+    waiter->result->owner = owner;
+
+    mutex_lock(&resolver->lock);
+
+    entry = find_entry(resolver, name, family);
+    if (entry == NULL) {
+        mutex_unlock(&resolver->lock);
+        perror("malloc");
+        free(waiter->result);
+        free(waiter);
+        return -1;
+    }
+
+    waiter->next = entry->waiters;
+    entry->waiters = waiter;
+
+    if (!entry->busy && entry->expires > ntime()) {
+        deliver(entry, 0);
+    } else if (!entry->busy) {
+        entry->busy = 1;
+        entry->queue_next = NULL;
+        if (resolver->queue_tail != NULL) {
+            resolver->queue_tail->queue_next = entry;
+        } else {
+            resolver->queue_head = entry;
+        }
+        resolver->queue_tail = entry;
+        if (start_thread(resolver) != 0) {
+            mutex_unlock(&resolver->lock);
+            return -1;
+        }
+        cond_signal(&resolver->wake);
+    }
+
+    mutex_unlock(&resolver->lock);
+    return 0;
+}
+
+struct resolve_result *resolver_take(struct resolver_client *client)
+{
+    struct resolver *resolver = client->resolver;
+    struct resolve_result *results;
+
+    mutex_lock(&resolver->lock);
+    results = client->head;
+    client->head = NULL;
+    client->tail = NULL;
+    mutex_unlock(&resolver->lock);
+
+    return results;
+}
@@ -0,0 +1,109 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "platform.h"
+
+/*
+ * The outcome of a lookup, handed back to the client that asked for it.
+ */
+struct resolve_result {
+    void *owner;             /* passed to resolver_request() */
+    int error;               /* 0 or an EAI_* code */
+    int sys_errno;           /* errno for EAI_SYSTEM */
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint64_t latency;        /* how long the lookup took, 0 if cached */
+    int cached;
+    struct resolve_result *next;
+};
+
+struct resolver;
+
+/*
+ * One user of a resolver, usually a prober running on its own thread.
+ * Results are queued for it as lookups complete, and notify is called
+ * (from a resolver thread) so that it can pick them up with
+ * resolver_take().
+ */
+struct resolver_client {
+    struct resolver *resolver;
+    struct resolve_result *head; /* protected by the resolver's lock */
+    struct resolve_result *tail;
+    void (*notify)(void *arg);
+    void *notify_arg;
+};
+
+/**
+ * Resolves a host name into a single address with getaddrinfo(), blocking
+ * until it's done. family is AF_INET, AF_INET6 or AF_UNSPEC for IPv4 with
+ * a fall back to IPv6. flags are passed on as ai_flags, e.g. AI_NUMERICHOST
+ * to only accept addresses. Returns 0 or an EAI_* code.
+ */
+int resolver_lookup(const char *name,
+                    int family,
+                    int flags,
+                    struct sockaddr_storage *addr,
+                    socklen_t *addr_len);
+
+/**
+ * Resolves a host name into all of its addresses, blocking until it's done.
+ * Unlike resolver_lookup(), AF_UNSPEC asks for both IPv4 and IPv6. The
+ * addresses are stored in the order that getaddrinfo() returned them, each
+ * one only once, up to max_addrs of them. Returns 0 or an EAI_* code.
+ */
+int resolver_lookup_all(const char *name,
+                        int family,
+                        struct sockaddr_storage *addrs,
+                        socklen_t *addr_lens,
+                        size_t max_addrs,
+                        size_t *num_addrs);
+
+/**
+ * Prints a getaddrinfo() error to stderr.
+ */
+void resolver_print_error(const char *name, int error, int sys_errno);
+
+/**
+ * Creates a resolver that runs up to max_threads lookups in parallel and
+ * caches their results for ttl nanoseconds. Threads are only started when
+ * there is something to resolve. Returns NULL on error.
+ *
+ * getaddrinfo() doesn't tell us the TTL of the DNS records, so the same
+ * fixed TTL applies to all names.
+ */
+struct resolver *resolver_create(size_t max_threads, uint64_t ttl);
+
+/**
+ * Stops the resolver once the lookups in progress are finished, without
+ * waiting for them. All clients must be destroyed first.
+ */
+void resolver_destroy(struct resolver *resolver);
+
+void resolver_client_init(struct resolver_client *client,
+                          struct resolver *resolver,
+                          void (*notify)(void *arg),
+                          void *notify_arg);
+
+/**
+ * Cancels the client's outstanding requests and frees its results.
+ */
+void resolver_client_destroy(struct resolver_client *client);
+
+/**
+ * Asks for the name to be resolved (see resolver_lookup() for family).
+ * If a fresh result is cached, it's queued for the client right away;
+ * if the same name is already being looked up, the client gets the result
+ * of that lookup. Returns -1 if out of memory.
+ */
+int resolver_request(struct resolver_client *client,
+                     const char *name,
+                     int family,
+                     void *owner);
+
+/**
+ * Takes the results queued for the client, oldest first. The caller frees
+ * them with free().
+ */
+struct resolve_result *resolver_take(struct resolver_client *client);
+
+#endif /* RESOLVER_H */
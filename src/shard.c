@@ -0,0 +1,309 @@
+#include "shard.h"
+
+#ifdef __linux__
+    #include <sched.h> /* sched_getaffinity() */
+#endif
+#ifndef _WIN32
+    #include <signal.h>
+#endif
+
+int shard_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count;
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        return CPU_COUNT(&cpus);
+    }
+#endif
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/*
+ * Returns the CPU that the shard with the given index should run on, going
+ * around the CPUs that we are allowed to use, or -1 if threads can't be
+ * pinned on this platform.
+ */
+static int shard_cpu(size_t index)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    size_t n = index % (size_t)shard_cpu_count();
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        return -1;
+    }
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus) && n-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+#elif defined _WIN32
+    return (int)(index % (size_t)shard_cpu_count() % 64);
+#else
+    (void)index;
+    return -1;
+#endif
+}
+
+static void pin_thread(int cpu)
+{
+    if (cpu < 0) {
+        return;
+    }
+#ifdef __linux__
+    {
+        cpu_set_t cpus;
+        int error;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0) {
+            fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(error));
+        }
+    }
+#elif defined _WIN32
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0) {
+        fprintf(stderr, "SetThreadAffinityMask: error %lu\n", GetLastError());
+    }
+#endif
+}
+
+#ifdef _WIN32
+static DWORD WINAPI shard_main(LPVOID arg)
+#else
+static void *shard_main(void *arg)
+#endif
+{
+    struct shard *shard = arg;
+
+    pin_thread(shard->cpu);
+    shard->result = prober_run(&shard->prober, shard->handler, shard->arg);
+
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+static void add_io_stats(struct icmp_socket_stats *dst,
+                         const struct icmp_socket_stats *src)
+{
+    dst->send_calls += src->send_calls;
+    dst->packets_sent += src->packets_sent;
+    dst->receive_calls += src->receive_calls;
+    dst->packets_received += src->packets_received;
+    dst->receive_syscalls += src->receive_syscalls;
+    dst->empty_receives += src->empty_receives;
+    dst->too_big += src->too_big;
+    dst->timestamp_reads += src->timestamp_reads;
+}
+
+static void add_hot_path_stats(struct hot_path_stats *dst,
+                               const struct hot_path_stats *src)
+{
+    dst->receive_delays += src->receive_delays;
+    dst->receive_delay_sum += src->receive_delay_sum;
+    if (src->receive_delay_max > dst->receive_delay_max) {
+        dst->receive_delay_max = src->receive_delay_max;
+    }
+    dst->checksums += src->checksums;
+    dst->checksum_time += src->checksum_time;
+    dst->handler_calls += src->handler_calls;
+    dst->handler_time += src->handler_time;
+    dst->not_replies += src->not_replies;
+    dst->unknown += src->unknown;
+    dst->stale += src->stale;
+    dst->bad_checksums += src->bad_checksums;
+}
+
+int shards_init(struct shard_set *set, struct prober *parent, size_t count)
+{
+    size_t i;
+
+    memset(set, 0, sizeof(*set));
+    set->parent = parent;
+
+    if (count > parent->num_targets) {
+        count = parent->num_targets;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    set->shards = calloc(count, sizeof(*set->shards));
+    if (set->shards == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct shard *shard = &set->shards[i];
+        size_t first = i * parent->num_targets / count;
+        size_t last = (i + 1) * parent->num_targets / count;
+
+        if (prober_init_shard(&shard->prober, parent, first, last - first)
+            != 0) {
+            goto error;
+        }
+        set->count++;
+        if (prober_open_sockets(&shard->prober) != 0) {
+            goto error;
+        }
+        shard->cpu = shard_cpu(i);
+    }
+
+    return 0;
+
+error:
+    shards_destroy(set);
+    return -1;
+}
+
+void shards_set_handler(struct shard_set *set,
+                        size_t index,
+                        probe_event_handler handler,
+                        void *arg)
+{
+    set->shards[index].handler = handler;
+    set->shards[index].arg = arg;
+}
+
+int shards_run(struct shard_set *set)
+{
+    struct prober *parent = set->parent;
+    size_t num_started = 0;
+    int result = 0;
+    size_t i;
+#ifndef _WIN32
+    sigset_t signals;
+    sigset_t old_signals;
+
+    /*
+     * Leave SIGINT, SIGTERM and SIGUSR1 to the main thread, which passes
+     * them on to the shards.
+     */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+#endif
+
+    for (i = 0; i < set->count; i++) {
+        struct shard *shard = &set->shards[i];
+#ifdef _WIN32
+        shard->thread = CreateThread(NULL, 0, shard_main, shard, 0, NULL);
+        if (shard->thread == NULL) {
+            fprintf(stderr, "CreateThread: error %lu\n", GetLastError());
+            result = -1;
+            break;
+        }
+#else
+        int error = pthread_create(&shard->thread, NULL, shard_main, shard);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            result = -1;
+            break;
+        }
+#endif
+        num_started++;
+    }
+
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+#endif
+
+    if (result != 0) {
+        shards_stop(set);
+    }
+
+    for (i = 0; i < num_started; i++) {
+        struct shard *shard = &set->shards[i];
+#ifdef _WIN32
+        WaitForSingleObject(shard->thread, INFINITE);
+        CloseHandle(shard->thread);
+#else
+        pthread_join(shard->thread, NULL);
+#endif
+        if (shard->result != 0) {
+            result = -1;
+        }
+    }
+
+    /*
+     * The threads are gone, so their counters can be read safely.
+     */
+    for (i = 0; i < num_started; i++) {
+        const struct prober *prober = &set->shards[i].prober;
+
+        parent->schedule.sends += prober->schedule.sends;
+        parent->schedule.lateness_sum += prober->schedule.lateness_sum;
+        if (prober->schedule.lateness_max > parent->schedule.lateness_max) {
+            parent->schedule.lateness_max = prober->schedule.lateness_max;
+        }
+        if (!prober->config.io_uring) {
+            parent->config.io_uring = 0;
+        }
+        if (!prober->config.packet_ring) {
+            parent->config.packet_ring = 0;
+        }
+        parent->resolve.lookups += prober->resolve.lookups;
+        parent->resolve.failures += prober->resolve.failures;
+        parent->resolve.time_sum += prober->resolve.time_sum;
+        if (prober->resolve.time_max > parent->resolve.time_max) {
+            parent->resolve.time_max = prober->resolve.time_max;
+        }
+        parent->overhead.replies += prober->overhead.replies;
+        parent->overhead.sum += prober->overhead.sum;
+        if (prober->overhead.max > parent->overhead.max) {
+            parent->overhead.max = prober->overhead.max;
+        }
+        add_io_stats(&parent->sock4.stats, &prober->sock4.stats);
+        add_io_stats(&parent->sock6.stats, &prober->sock6.stats);
+        add_hot_path_stats(&parent->hot_path, &prober->hot_path);
+        parent->loop.stats.waits += prober->loop.stats.waits;
+        parent->loop.stats.timer_updates += prober->loop.stats.timer_updates;
+    }
+
+    return result;
+}
+
+void shards_stop(struct shard_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        prober_stop(&set->shards[i].prober);
+    }
+}
+
+void shards_request_stats(struct shard_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        prober_request_stats(&set->shards[i].prober);
+    }
+}
+
+void shards_destroy(struct shard_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        prober_destroy(&set->shards[i].prober);
+    }
+    free(set->shards);
+    memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,80 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "platform.h"
+#include "prober.h"
+
+#ifdef _WIN32
+    typedef HANDLE thread_t;
+#else
+    #include <pthread.h>
+    typedef pthread_t thread_t;
+#endif
+
+/*
+ * One worker thread with its own prober, pinned to a CPU.
+ */
+struct shard {
+    struct prober prober;
+    thread_t thread;
+    int cpu;                 /* -1 if not pinned */
+    probe_event_handler handler;
+    void *arg;
+    int result;
+};
+
+/*
+ * Splits the targets of a prober into contiguous slices that are probed in
+ * parallel. Every shard has its own sockets, its own range of ICMP IDs
+ * (so that the kernel filter only passes its own replies) and its own copy
+ * of everything touched on the hot path, so the threads never share data
+ * while they run. The statistics are collected into the parent's targets
+ * by the shards and the remaining counters are added up once they're done.
+ */
+struct shard_set {
+    struct prober *parent;
+    struct shard *shards;
+    size_t count;
+};
+
+/**
+ * Returns the number of CPUs that this process may run on.
+ */
+int shard_cpu_count(void);
+
+/**
+ * Splits the parent's targets between count shards (fewer if there are not
+ * as many targets) and opens their sockets. Like prober_open_sockets(),
+ * this must be done before dropping privileges.
+ */
+int shards_init(struct shard_set *set, struct prober *parent, size_t count);
+
+/**
+ * Sets the handler for the events of one shard. It is called on the
+ * shard's thread.
+ */
+void shards_set_handler(struct shard_set *set,
+                        size_t index,
+                        probe_event_handler handler,
+                        void *arg);
+
+/**
+ * Runs every shard on its own thread and waits for all of them to finish.
+ * Then adds their send, lookup, I/O and hot path counters to the parent's.
+ * Returns -1 if any of them failed.
+ */
+int shards_run(struct shard_set *set);
+
+/**
+ * Stops all shards. Safe to call from a signal handler.
+ */
+void shards_stop(struct shard_set *set);
+
+/**
+ * Asks every shard for its run statistics, see prober_request_stats().
+ */
+void shards_request_stats(struct shard_set *set);
+
+void shards_destroy(struct shard_set *set);
+
+#endif /* SHARD_H */
@@ -0,0 +1,197 @@
+#include "stats.h"
+
+#include <math.h>
+
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+static int highest_bit(uint64_t value)
+{
+#if defined __GNUC__ || defined __clang__
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+size_t stats_bucket_index(uint64_t value)
+{
+    int bit;
+
+    if (value < SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    if (value > HISTOGRAM_MAX_VALUE) {
+        value = HISTOGRAM_MAX_VALUE;
+    }
+    bit = highest_bit(value);
+    return ((size_t)(bit - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+        + (size_t)((value >> (bit - HISTOGRAM_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/*
+ * Returns the value in the middle of the range counted by the bucket.
+ */
+static uint64_t bucket_value(size_t index)
+{
+    int shift;
+    uint64_t low;
+
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    shift = (int)(index >> HISTOGRAM_SUB_BITS) - 1;
+    low = (uint64_t)(SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+int stats_add(struct rtt_stats *stats, uint64_t rtt)
+{
+    double delta;
+
+    stats->received++;
+    if (stats->received == 1 || rtt < stats->min) {
+        stats->min = rtt;
+    }
+    if (rtt > stats->max) {
+        stats->max = rtt;
+    }
+
+    delta = (double)rtt - stats->mean;
+    stats->mean += delta / stats->received;
+    stats->m2 += delta * ((double)rtt - stats->mean);
+
+    if (stats->received > 1) {
+        double diff = rtt > stats->last
+            ? (double)(rtt - stats->last)
+            : (double)(stats->last - rtt);
+        stats->jitter += (diff - stats->jitter) / 16.0;
+    }
+    stats->last = rtt;
+
+    if (stats->histogram == NULL) {
+        stats->histogram = calloc(1, sizeof(*stats->histogram));
+        if (stats->histogram == NULL) {
+            return -1;
+        }
+    }
+    stats->histogram->counts[stats_bucket_index(rtt)]++;
+
+    return 0;
+}
+
+void stats_add_loss(struct rtt_stats *stats)
+{
+    stats->lost++;
+}
+
+int stats_merge(struct rtt_stats *dst, const struct rtt_stats *src)
+{
+    unsigned long total = dst->received + src->received;
+    size_t i;
+
+    dst->lost += src->lost;
+    dst->late += src->late;
+    if (src->late_max > dst->late_max) {
+        dst->late_max = src->late_max;
+    }
+    dst->duplicates += src->duplicates;
+    dst->reordered += src->reordered;
+    if (src->max_reorder > dst->max_reorder) {
+        dst->max_reorder = src->max_reorder;
+    }
+    if (src->received == 0) {
+        return 0;
+    }
+
+    if (dst->received == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+
+    /*
+     * Chan et al.'s formula for combining the variance of two sets.
+     */
+    {
+        double delta = src->mean - dst->mean;
+        double n_dst = (double)dst->received;
+        double n_src = (double)src->received;
+
+        dst->mean += delta * n_src / total;
+        dst->m2 += src->m2 + delta * delta * n_dst * n_src / total;
+        dst->jitter = (dst->jitter * n_dst + src->jitter * n_src) / total;
+    }
+    dst->received = total;
+    dst->last = src->last;
+
+    if (src->histogram != NULL) {
+        if (dst->histogram == NULL) {
+            dst->histogram = calloc(1, sizeof(*dst->histogram));
+            if (dst->histogram == NULL) {
+                return -1;
+            }
+        }
+        for (i = 0; i < HISTOGRAM_SIZE; i++) {
+            dst->histogram->counts[i] += src->histogram->counts[i];
+        }
+    }
+
+    return 0;
+}
+
+double stats_mdev(const struct rtt_stats *stats)
+{
+    if (stats->received == 0) {
+        return 0.0;
+    }
+    return sqrt(stats->m2 / stats->received);
+}
+
+uint64_t stats_percentile(const struct rtt_stats *stats, double fraction)
+{
+    unsigned long rank;
+    unsigned long count = 0;
+    size_t i;
+
+    if (stats->received == 0 || stats->histogram == NULL) {
+        return 0;
+    }
+
+    rank = (unsigned long)ceil(fraction * stats->received);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (i = 0; i < HISTOGRAM_SIZE; i++) {
+        count += stats->histogram->counts[i];
+        if (count >= rank) {
+            uint64_t value = bucket_value(i);
+            if (value < stats->min) {
+                return stats->min;
+            }
+            if (value > stats->max) {
+                return stats->max;
+            }
+            return value;
+        }
+    }
+    return stats->max;
+}
+
+double stats_loss(const struct rtt_stats *stats)
+{
+    unsigned long total = stats->received + stats->lost;
+
+    return total > 0 ? (double)stats->lost / total : 0.0;
+}
+
+void stats_destroy(struct rtt_stats *stats)
+{
+    free(stats->histogram);
+    memset(stats, 0, sizeof(*stats));
+}
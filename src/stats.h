@@ -0,0 +1,87 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "platform.h"
+
+/*
+ * RTTs are counted in a log-linear histogram: every power of two range is
+ * split into 2^HISTOGRAM_SUB_BITS buckets, so percentiles are accurate to
+ * within about 3% in fixed memory. Values below 2^HISTOGRAM_SUB_BITS ns
+ * are counted exactly and values above HISTOGRAM_MAX_VALUE go into the
+ * last bucket.
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_MAX_BITS 37 /* about 137 seconds */
+#define HISTOGRAM_SIZE \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_VALUE (((uint64_t)1 << HISTOGRAM_MAX_BITS) - 1)
+
+struct rtt_histogram {
+    uint32_t counts[HISTOGRAM_SIZE];
+};
+
+/*
+ * Running statistics of the RTTs of one or more targets, updated in
+ * constant time and memory per reply. The mean and variance are computed
+ * with Welford's method, jitter as in RFC 3550 (section 6.4.1).
+ */
+struct rtt_stats {
+    unsigned long received;
+    unsigned long lost;
+    uint64_t min;
+    uint64_t max;
+    double mean;
+    double m2;               /* sum of squared differences from the mean */
+    double jitter;
+    uint64_t last;
+    unsigned long late;      /* replies to lost requests, not counted in
+                                received */
+    uint64_t late_max;       /* the longest RTT of those */
+    unsigned long duplicates;
+    unsigned long reordered; /* replies that came after newer ones */
+    unsigned long max_reorder; /* in sequence numbers */
+    struct rtt_histogram *histogram; /* allocated on the first reply */
+};
+
+/**
+ * Adds an RTT (in nanoseconds) to the statistics. Returns -1 if the
+ * histogram could not be allocated; everything else is still updated.
+ */
+int stats_add(struct rtt_stats *stats, uint64_t rtt);
+
+/**
+ * Counts a request that went unanswered.
+ */
+void stats_add_loss(struct rtt_stats *stats);
+
+/**
+ * Combines the statistics of src into dst, as if all of the RTTs had been
+ * added to dst. Jitter is averaged, weighted by the number of replies.
+ */
+int stats_merge(struct rtt_stats *dst, const struct rtt_stats *src);
+
+/**
+ * Returns the index of the histogram bucket that counts the RTT.
+ */
+size_t stats_bucket_index(uint64_t rtt);
+
+/**
+ * Returns the mean deviation (standard deviation) of the RTTs.
+ */
+double stats_mdev(const struct rtt_stats *stats);
+
+/**
+ * Returns the RTT below which the given fraction of RTTs lie, e.g. 0.99
+ * for the 99th percentile, or 0 if there are no RTTs.
+ */
+uint64_t stats_percentile(const struct rtt_stats *stats, double fraction);
+
+/**
+ * Returns the fraction of requests that went unanswered, not counting the
+ * ones still in flight.
+ */
+double stats_loss(const struct rtt_stats *stats);
+
+void stats_destroy(struct rtt_stats *stats);
+
+#endif /* STATS_H */
@@ -0,0 +1,182 @@
+#include "sweep.h"
+
+#define IPV4_HEADER_LENGTH 20
+#define IPV6_HEADER_LENGTH 40
+
+static unsigned long too_big_count(const struct prober *prober)
+{
+    return prober->sock4.stats.too_big + prober->sock6.stats.too_big;
+}
+
+/*
+ * Pings the target with count requests of the given size and records the
+ * results as a new step. Returns the step or NULL on error.
+ */
+static struct sweep_step *run_step(struct sweep *sweep,
+                                   struct prober *prober,
+                                   size_t size,
+                                   unsigned long count,
+                                   int search,
+                                   probe_event_handler handler,
+                                   void *arg)
+{
+    const struct probe_target *target = prober->targets[0];
+    unsigned long too_big = too_big_count(prober);
+    struct sweep_step *step;
+
+    if (sweep->num_steps == sweep->max_steps) {
+        size_t new_max = sweep->max_steps > 0 ? sweep->max_steps * 2 : 32;
+        struct sweep_step *new_steps =
+            realloc(sweep->steps, new_max * sizeof(*new_steps));
+        if (new_steps == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        sweep->steps = new_steps;
+        sweep->max_steps = new_max;
+    }
+
+    if (prober_set_payload_size(prober, size) != 0) {
+        return NULL;
+    }
+    prober_reset(prober);
+    prober->config.count = count;
+    if (prober_run(prober, handler, arg) != 0) {
+        return NULL;
+    }
+
+    step = &sweep->steps[sweep->num_steps++];
+    memset(step, 0, sizeof(*step));
+    step->size = size;
+    step->search = search;
+    step->sent = target->sent;
+    step->too_big = too_big_count(prober) - too_big;
+    step->received = target->stats.received;
+    if (step->received > 0) {
+        step->min = target->stats.min;
+        step->mean = target->stats.mean;
+        step->p50 = stats_percentile(&target->stats, 0.5);
+        if (!sweep->passed || size > sweep->max_passed) {
+            sweep->max_passed = size;
+        }
+        sweep->passed = 1;
+    } else if (!prober->stopped) {
+        if (!sweep->failed || size < sweep->min_failed) {
+            sweep->min_failed = size;
+        }
+        sweep->failed = 1;
+    }
+    return step;
+}
+
+/*
+ * Least squares fit of the minimum RTT against the payload size.
+ */
+static void fit_slope(struct sweep *sweep)
+{
+    double n = 0;
+    double sum_x = 0;
+    double sum_y = 0;
+    double sum_xx = 0;
+    double sum_xy = 0;
+    double d;
+    size_t i;
+
+    for (i = 0; i < sweep->num_steps; i++) {
+        const struct sweep_step *step = &sweep->steps[i];
+        double x = (double)step->size;
+        double y = (double)step->min;
+        if (step->received == 0) {
+            continue;
+        }
+        n++;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+
+    d = n * sum_xx - sum_x * sum_x;
+    if (n < 2 || d <= 0) {
+        return;
+    }
+    sweep->slope = (n * sum_xy - sum_x * sum_y) / d;
+    sweep->intercept = (sum_y - sweep->slope * sum_x) / n;
+    sweep->have_slope = 1;
+}
+
+int sweep_run(struct sweep *sweep,
+              const struct sweep_config *config,
+              struct prober *prober,
+              probe_event_handler handler,
+              void (*step_handler)(const struct sweep *sweep,
+                                   const struct sweep_step *step,
+                                   void *arg),
+              void *arg)
+{
+    size_t size;
+
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->config = *config;
+    sweep->header_size = ICMP_HEADER_LENGTH
+        + (prober->targets[0]->addr.ss_family == AF_INET6
+               ? IPV6_HEADER_LENGTH
+               : IPV4_HEADER_LENGTH);
+
+    /*
+     * Step through the range until a size gets no replies. The last step
+     * is cut short so that the largest size is always tried.
+     */
+    size = config->min_size;
+    while (!sweep->failed && !prober->stopped) {
+        const struct sweep_step *step = run_step(sweep,
+                                                 prober,
+                                                 size,
+                                                 config->count,
+                                                 0,
+                                                 handler,
+                                                 arg);
+        if (step == NULL) {
+            return -1;
+        }
+        step_handler(sweep, step, arg);
+        if (size >= config->max_size) {
+            break;
+        }
+        size = config->max_size - size > config->step
+            ? size + config->step
+            : config->max_size;
+    }
+
+    /*
+     * Then narrow the path MTU down between the largest size that got
+     * through and the smallest one that didn't.
+     */
+    while (sweep->passed
+           && sweep->failed
+           && sweep->min_failed - sweep->max_passed > 1
+           && !prober->stopped) {
+        size_t mid = sweep->max_passed
+            + (sweep->min_failed - sweep->max_passed) / 2;
+        const struct sweep_step *step = run_step(sweep,
+                                                 prober,
+                                                 mid,
+                                                 SWEEP_SEARCH_COUNT,
+                                                 1,
+                                                 handler,
+                                                 arg);
+        if (step == NULL) {
+            return -1;
+        }
+        step_handler(sweep, step, arg);
+    }
+
+    fit_slope(sweep);
+    return 0;
+}
+
+void sweep_destroy(struct sweep *sweep)
+{
+    free(sweep->steps);
+    memset(sweep, 0, sizeof(*sweep));
+}
@@ -0,0 +1,78 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "platform.h"
+#include "prober.h"
+
+/*
+ * Requests per size while searching for the path MTU. A size passes if any
+ * of them is answered.
+ */
+#define SWEEP_SEARCH_COUNT 3
+
+/*
+ * The results for one payload size.
+ */
+struct sweep_step {
+    size_t size;             /* payload bytes */
+    int search;              /* part of the path MTU search */
+    unsigned long sent;
+    unsigned long too_big;   /* refused by the kernel as above the MTU */
+    unsigned long received;
+    uint64_t min;
+    double mean;
+    uint64_t p50;
+};
+
+struct sweep_config {
+    size_t min_size;
+    size_t max_size;
+    size_t step;
+    unsigned long count;     /* requests per size */
+};
+
+/*
+ * Pings a single target with payloads of increasing size, with the Don't
+ * Fragment bit set, until one of the sizes gets no replies at all. The path
+ * MTU is then narrowed down with a binary search between the last size that
+ * got through and the first one that didn't.
+ *
+ * The round trip time grows with the size by the time it takes to put the
+ * extra bytes on the wire both ways. Fitting a line through the minimum RTT
+ * of each size gives an estimate of that per-byte cost; the minimum leaves
+ * out most of the queuing delay.
+ */
+struct sweep {
+    struct sweep_config config;
+    struct sweep_step *steps;
+    size_t num_steps;
+    size_t max_steps;
+    size_t header_size;      /* IP and ICMP headers */
+    int passed;              /* some size got through */
+    size_t max_passed;       /* largest payload that got through */
+    int failed;              /* some size didn't */
+    size_t min_failed;       /* smallest payload that didn't */
+    int have_slope;
+    double slope;            /* ns per byte of payload */
+    double intercept;        /* ns */
+};
+
+/**
+ * Runs the sweep over the prober's first target, which must have been
+ * initialized with config.payload_size set to at least config->max_size
+ * and config.dont_fragment set. Replies and timeouts go to the handler,
+ * as from prober_run(), and step_handler is called after each size.
+ * Returns -1 on error.
+ */
+int sweep_run(struct sweep *sweep,
+              const struct sweep_config *config,
+              struct prober *prober,
+              probe_event_handler handler,
+              void (*step_handler)(const struct sweep *sweep,
+                                   const struct sweep_step *step,
+                                   void *arg),
+              void *arg);
+
+void sweep_destroy(struct sweep *sweep);
+
+#endif /* SWEEP_H */
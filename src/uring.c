@@ -0,0 +1,283 @@
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+
+/*
+ * The queue heads and tails are shared with the kernel.
+ */
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd,
+                          unsigned int to_submit,
+                          unsigned int min_complete,
+                          unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter,
+                        fd,
+                        to_submit,
+                        min_complete,
+                        flags,
+                        NULL,
+                        0);
+}
+
+static int io_uring_register(int fd,
+                             unsigned int opcode,
+                             const void *arg,
+                             unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *ring,
+               unsigned int sq_entries,
+               unsigned int cq_entries)
+{
+    struct io_uring_params params;
+    char *sq;
+    char *cq;
+    unsigned int i;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+
+    ring->fd = io_uring_setup(sq_entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array
+        + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0
+        && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL,
+                         ring->sq_ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto error;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        cq = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL,
+                             ring->cq_ring_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE,
+                             ring->fd,
+                             IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto error;
+        }
+        cq = ring->cq_ring;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL,
+                      ring->sqes_size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE,
+                      ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    sq = ring->sq_ring;
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /*
+     * SQEs are always used in order, so the indirection array is fixed.
+     */
+    for (i = 0; i <= ring->sq_mask; i++) {
+        ring->sq_array[i] = i;
+    }
+
+    return 0;
+
+error:
+    uring_destroy(ring);
+    return -1;
+}
+
+void uring_destroy(struct uring *ring)
+{
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->sqe_tail - load_acquire(ring->sq_head) > ring->sq_mask) {
+        return NULL;
+    }
+    sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit(struct uring *ring, unsigned int wait_nr)
+{
+    unsigned int to_submit = ring->sqe_tail - *ring->sq_tail;
+    int result;
+
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+    store_release(ring->sq_tail, ring->sqe_tail);
+
+    do {
+        result = io_uring_enter(ring->fd,
+                                to_submit,
+                                wait_nr,
+                                wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (result < 0 && errno == EINTR);
+
+    return result;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+    unsigned int head = *ring->cq_head;
+
+    if (head == load_acquire(ring->cq_tail)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+int uring_buf_ring_init(struct uring_buf_ring *buf_ring,
+                        struct uring *ring,
+                        uint16_t group,
+                        unsigned int count,
+                        size_t buf_size)
+{
+    struct io_uring_buf_reg reg;
+    unsigned int i;
+
+    memset(buf_ring, 0, sizeof(*buf_ring));
+    buf_ring->group = group;
+    buf_ring->count = count;
+    buf_ring->buf_size = buf_size;
+
+    /*
+     * The ring must be page aligned.
+     */
+    buf_ring->ring_size = count * sizeof(struct io_uring_buf);
+    buf_ring->ring = mmap(NULL,
+                          buf_ring->ring_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+    if (buf_ring->ring == MAP_FAILED) {
+        buf_ring->ring = NULL;
+        goto error;
+    }
+    buf_ring->bufs = malloc(count * buf_size);
+    if (buf_ring->bufs == NULL) {
+        goto error;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring->ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (io_uring_register(ring->fd,
+                          IORING_REGISTER_PBUF_RING,
+                          &reg,
+                          1) != 0) {
+        goto error;
+    }
+
+    for (i = 0; i < count; i++) {
+        uring_buf_ring_add(buf_ring, (uint16_t)i);
+    }
+    uring_buf_ring_commit(buf_ring);
+
+    return 0;
+
+error:
+    uring_buf_ring_destroy(buf_ring);
+    return -1;
+}
+
+void uring_buf_ring_destroy(struct uring_buf_ring *buf_ring)
+{
+    if (buf_ring->ring != NULL) {
+        munmap(buf_ring->ring, buf_ring->ring_size);
+    }
+    free(buf_ring->bufs);
+    memset(buf_ring, 0, sizeof(*buf_ring));
+}
+
+void uring_buf_ring_add(struct uring_buf_ring *buf_ring, uint16_t bid)
+{
+    struct io_uring_buf *buf =
+        &buf_ring->ring->bufs[buf_ring->tail & (buf_ring->count - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(buf_ring, bid);
+    buf->len = (uint32_t)buf_ring->buf_size;
+    buf->bid = bid;
+    buf_ring->tail++;
+}
+
+void uring_buf_ring_commit(struct uring_buf_ring *buf_ring)
+{
+    store_release(&buf_ring->ring->tail, buf_ring->tail);
+}
+
+char *uring_buf(const struct uring_buf_ring *buf_ring, uint16_t bid)
+{
+    return buf_ring->bufs + (size_t)bid * buf_ring->buf_size;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,121 @@
+#ifndef URING_H
+#define URING_H
+
+#include "platform.h"
+
+/*
+ * HAVE_IO_URING is defined by the build when linux/io_uring.h is available.
+ * The system calls are made directly, so no liburing is needed.
+ */
+#ifdef HAVE_IO_URING
+
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+    #undef HAVE_IO_URING
+#endif
+
+#endif /* HAVE_IO_URING */
+
+#ifdef HAVE_IO_URING
+
+/*
+ * A minimal io_uring instance: the submission and completion queues mapped
+ * into our memory. Submitting takes a system call per batch; completions
+ * are read straight from the queue without any.
+ */
+struct uring {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sqe_tail;   /* SQEs handed out, not yet submitted */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;           /* NULL if shared with sq_ring */
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/*
+ * A ring of buffers that the kernel picks from for receives
+ * (IORING_REGISTER_PBUF_RING, Linux 5.19). Buffer IDs are indexes into
+ * the buffer memory.
+ */
+struct uring_buf_ring {
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    char *bufs;
+    size_t buf_size;
+    unsigned int count;
+    uint16_t tail;
+    uint16_t group;
+};
+
+/**
+ * Sets up an io_uring instance with room for sq_entries submissions and
+ * cq_entries completions. Returns -1 and sets errno if io_uring is not
+ * available, e.g. on an old kernel or when disabled by
+ * kernel.io_uring_disabled.
+ */
+int uring_init(struct uring *ring,
+               unsigned int sq_entries,
+               unsigned int cq_entries);
+
+void uring_destroy(struct uring *ring);
+
+/**
+ * Returns a zeroed submission queue entry, or NULL if the queue is full.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Submits all SQEs obtained since the last call and, if wait_nr is not 0,
+ * waits for that many completions. Returns the number of SQEs submitted or
+ * -1 on error.
+ */
+int uring_submit(struct uring *ring, unsigned int wait_nr);
+
+/**
+ * Returns the oldest completion, or NULL if there is none. Call
+ * uring_cqe_seen() once done with it.
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+void uring_cqe_seen(struct uring *ring);
+
+/**
+ * Allocates count buffers of buf_size bytes each and registers them with
+ * the ring as the given buffer group. count must be a power of two.
+ */
+int uring_buf_ring_init(struct uring_buf_ring *buf_ring,
+                        struct uring *ring,
+                        uint16_t group,
+                        unsigned int count,
+                        size_t buf_size);
+
+void uring_buf_ring_destroy(struct uring_buf_ring *buf_ring);
+
+/**
+ * Gives a buffer back to the kernel. It is not visible to the kernel until
+ * uring_buf_ring_commit() is called.
+ */
+void uring_buf_ring_add(struct uring_buf_ring *buf_ring, uint16_t bid);
+
+void uring_buf_ring_commit(struct uring_buf_ring *buf_ring);
+
+/**
+ * Returns the memory of the buffer with the given ID.
+ */
+char *uring_buf(const struct uring_buf_ring *buf_ring, uint16_t bid);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* URING_H */